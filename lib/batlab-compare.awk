@@ -0,0 +1,82 @@
+# batlab-compare.awk - Per-group medians with bootstrap confidence intervals
+#
+# Reads one tab-separated line per run, "group<TAB>value<TAB>value...",
+# and prints one line per group in input order:
+#
+#   group runs median1 lo1 hi1 median2 lo2 hi2 ...
+#
+# Each metric's median across the group's runs comes with a percentile
+# bootstrap interval. Whole runs are resampled rather than samples, since
+# samples within a run are strongly autocorrelated and the run is the
+# independent unit. Only per-run values are held, never samples. The seed
+# is fixed so a page rebuilt from the same runs is identical.
+#
+#   awk -F'\t' -v resamples=2000 -v level=95 -v seed=1 -f batlab-compare.awk
+
+# Shell sort a[1..n] ascending
+function sort_values(a, n,    gap, i, j, t) {
+    for (gap = int(n / 2); gap > 0; gap = int(gap / 2))
+        for (i = gap + 1; i <= n; i++) {
+            t = a[i]
+            for (j = i; j > gap && a[j - gap] > t; j -= gap)
+                a[j] = a[j - gap]
+            a[j] = t
+        }
+}
+
+# Quantile p (0-100) of sorted a[1..n], interpolating between closest ranks
+function quantile(a, n, p,    h, i) {
+    h = (n - 1) * p / 100
+    i = int(h) + 1
+    return i < n ? a[i] + (h - int(h)) * (a[i + 1] - a[i]) : a[n]
+}
+
+# Median of a resample given as counts c[i] of each sorted value x[i]
+function resample_median(x, c, n,    lo, hi, i, cum, a) {
+    lo = int((n + 1) / 2)
+    hi = int(n / 2) + 1
+    cum = 0
+    a = ""
+    for (i = 1; i <= n; i++) {
+        cum += c[i]
+        if (a == "" && cum >= lo) a = x[i]
+        if (cum >= hi) return (a + x[i]) / 2
+    }
+    return a
+}
+
+BEGIN {
+    if (resamples == "") resamples = 2000
+    if (level == "") level = 95
+    if (seed == "") seed = 1
+    srand(seed)
+}
+{
+    g = $1
+    if (!(g in runs)) order[++ngroups] = g
+    n = ++runs[g]
+    for (m = 2; m <= NF; m++) val[g, m, n] = $m + 0
+    if (NF > nf) nf = NF
+}
+END {
+    for (k = 1; k <= ngroups; k++) {
+        g = order[k]
+        n = runs[g]
+        line = g "\t" n
+        for (m = 2; m <= nf; m++) {
+            split("", x)
+            for (i = 1; i <= n; i++) x[i] = val[g, m, i]
+            sort_values(x, n)
+            for (b = 1; b <= resamples; b++) {
+                split("", c)
+                for (i = 1; i <= n; i++) c[int(rand() * n) + 1]++
+                meds[b] = resample_median(x, c, n)
+            }
+            sort_values(meds, resamples)
+            line = line sprintf("\t%.6g\t%.6g\t%.6g", quantile(x, n, 50),
+                quantile(meds, resamples, (100 - level) / 2),
+                quantile(meds, resamples, 100 - (100 - level) / 2))
+        }
+        print line
+    }
+}
@@ -0,0 +1,50 @@
+# batlab-downsample.awk - Min/max-per-bucket downsampling of a batlab table
+#
+# Reduces a table from batlab-table.awk to at most 2 * buckets rows in one
+# streaming pass. Rows are grouped into consecutive buckets, and for each
+# bucket every column's minimum and maximum are kept, in the order they
+# occurred. The first output row carries the bucket's start time, the second
+# its end time. Each gnuplot panel plots one column, so short spikes (a
+# one-sample burst in watts) survive where every-Nth decimation drops them.
+#
+#   awk -v total=ROWS -v buckets=1000 -f batlab-downsample.awk table
+
+BEGIN {
+    if (buckets < 1) buckets = 1000
+    size = int((total + buckets - 1) / buckets)
+    if (size < 1) size = 1
+    ncol = 4
+}
+/^#/ { print; next }
+{
+    if (n == 0) {
+        t_first = $1
+        for (k = 1; k <= ncol; k++) {
+            lo[k] = hi[k] = $(k + 1) + 0
+            lo_at[k] = hi_at[k] = 0
+        }
+    } else {
+        for (k = 1; k <= ncol; k++) {
+            v = $(k + 1) + 0
+            if (v < lo[k]) { lo[k] = v; lo_at[k] = n }
+            if (v > hi[k]) { hi[k] = v; hi_at[k] = n }
+        }
+    }
+    t_last = $1
+    if (++n == size) flush()
+}
+END { if (n > 0) flush() }
+
+function flush(    k) {
+    if (n == 1) {
+        print t_first, lo[1], lo[2], lo[3], lo[4]
+    } else {
+        for (k = 1; k <= ncol; k++) {
+            first[k] = (lo_at[k] <= hi_at[k]) ? lo[k] : hi[k]
+            second[k] = (lo_at[k] <= hi_at[k]) ? hi[k] : lo[k]
+        }
+        print t_first, first[1], first[2], first[3], first[4]
+        print t_last, second[1], second[2], second[3], second[4]
+    }
+    n = 0
+}
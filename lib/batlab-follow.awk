@@ -0,0 +1,154 @@
+# batlab-follow.awk - Incremental min/max downsampling of a growing run
+#
+# Reads the bytes appended to a JSONL run since the last call (requires
+# batlab-json.awk) and folds them into a persistent state of at most
+# 2 * buckets min/max buckets, so each refresh costs the same however
+# long the run has become. Buckets are the ones batlab-downsample.awk
+# builds: each keeps every column's minimum and maximum with the time
+# they occurred. When the buckets run out, neighbours are merged
+# pairwise and the bucket size doubles.
+#
+#   tail -c +$((offset + 1)) run.jsonl | LC_ALL=C awk -v state=FILE \
+#       -v new_state=FILE -v plot=FILE -v source=run.jsonl [-v buckets=1000] \
+#       -f batlab-json.awk -f batlab-follow.awk
+#
+# The caller discards a state whose source line names another run. The
+# state file is replaced by new_state, plot receives the table
+# (hours pct watts cpu temp) for gnuplot and stdout a summary in the
+# batlab-stats.awk "key:value" form, plus offset, the byte offset the
+# next call starts from. A trailing line without its closing brace is
+# left for the next call, as the writer may be halfway through it.
+
+BEGIN {
+    if (buckets < 1) buckets = 1000
+    CONVFMT = "%.6f"        # state values are stored as they are computed
+    ncol = 4
+    offset = 0; size = 1; nb = 0; rows = 0
+    while (state != "" && (getline line < state) > 0) {
+        split(line, f, " ")
+        if (f[1] == "bucket") {
+            nb++
+            for (k = 2; k in f; k++) b[nb, k - 1] = f[k] + 0
+        } else if (f[1] != "#") {
+            v[f[1]] = f[2]
+        }
+    }
+    if (state != "") close(state)
+    if ("offset" in v) {
+        offset = v["offset"] + 0; size = v["size"] + 0; t0 = v["t0"] + 0
+        rows = v["rows"] + 0; first_pct = v["first_pct"] + 0; last_pct = v["last_pct"] + 0
+        last_hours = v["last_hours"] + 0; sum_watts = v["sum_watts"] + 0
+    }
+}
+
+# Bucket fields: 1 n, 2 t_first, 3 t_last, then per column lo lo_t hi hi_t
+function add_row(h, c,    k, base) {
+    if (nb == 0 || b[nb, 1] >= size) {
+        nb++
+        b[nb, 1] = 0; b[nb, 2] = h
+        for (k = 1; k <= ncol; k++) {
+            base = 4 * k
+            b[nb, base] = b[nb, base + 2] = c[k]
+            b[nb, base + 1] = b[nb, base + 3] = h
+        }
+    }
+    for (k = 1; k <= ncol; k++) {
+        base = 4 * k
+        if (c[k] < b[nb, base]) { b[nb, base] = c[k]; b[nb, base + 1] = h }
+        if (c[k] > b[nb, base + 2]) { b[nb, base + 2] = c[k]; b[nb, base + 3] = h }
+    }
+    b[nb, 1]++
+    b[nb, 3] = h
+    if (nb > buckets) merge()
+}
+
+# Halve the bucket count by folding each pair into its left bucket
+function merge(    i, j, k, base, fields) {
+    fields = 3 + 4 * ncol
+    j = 0
+    for (i = 1; i <= nb; i += 2) {
+        j++
+        for (k = 1; k <= fields; k++) b[j, k] = b[i, k]
+        if (i + 1 > nb) continue
+        b[j, 1] += b[i + 1, 1]
+        b[j, 3] = b[i + 1, 3]
+        for (k = 1; k <= ncol; k++) {
+            base = 4 * k
+            if (b[i + 1, base] < b[j, base]) {
+                b[j, base] = b[i + 1, base]; b[j, base + 1] = b[i + 1, base + 1]
+            }
+            if (b[i + 1, base + 2] > b[j, base + 2]) {
+                b[j, base + 2] = b[i + 1, base + 2]; b[j, base + 3] = b[i + 1, base + 3]
+            }
+        }
+    }
+    nb = j
+    size *= 2
+}
+
+function consume(line,    epoch, h, c) {
+    offset += length(line) + 1
+    epoch = iso_epoch(json_field(line, "t"))
+    if (epoch == "") return
+    if (rows == 0) { t0 = epoch; first_pct = json_field(line, "pct") + 0 }
+    h = (epoch - t0) / 3600
+    c[1] = json_field(line, "pct") + 0
+    c[2] = json_field(line, "watts") + 0
+    c[3] = cpu_percent(line)
+    c[4] = json_field(line, "temp_c") + 0
+    rows++
+    last_pct = c[1]
+    last_hours = h
+    sum_watts += c[2]
+    add_row(h, c)
+}
+
+{
+    if (have) consume(pending)
+    pending = $0
+    have = 1
+}
+
+END {
+    if (have && pending ~ /[}][ \t\r]*$/) consume(pending)
+
+    printf "# batlab-follow 1\nsource %s\n", source > new_state
+    printf "offset %d\nsize %d\nt0 %.6f\nrows %d\n", offset, size, t0, rows > new_state
+    printf "first_pct %s\nlast_pct %s\nlast_hours %.6f\nsum_watts %.6f\n",
+        first_pct, last_pct, last_hours, sum_watts > new_state
+    print "# hours pct watts cpu temp" > plot
+    for (i = 1; i <= nb; i++) {
+        line = "bucket"
+        for (k = 1; k <= 3 + 4 * ncol; k++) line = line " " b[i, k]
+        print line > new_state
+        plot_bucket(i)
+    }
+    close(new_state)
+    close(plot)
+
+    print "offset:" offset
+    print "samples:" rows
+    printf "duration:%.6f\n", last_hours
+    print "start_pct:" (rows ? first_pct : 0)
+    print "end_pct:" (rows ? last_pct : 0)
+    printf "avg_watts:%.6f\n", rows ? sum_watts / rows : 0
+}
+
+# The bucket's extremes in the order they occurred, as batlab-downsample.awk
+function plot_bucket(i,    k, base, row1, row2) {
+    if (b[i, 1] == 1) {
+        printf "%s %s %s %s %s\n", b[i, 2], b[i, 4], b[i, 8], b[i, 12], b[i, 16] > plot
+        return
+    }
+    row1 = b[i, 2]; row2 = b[i, 3]
+    for (k = 1; k <= ncol; k++) {
+        base = 4 * k
+        if (b[i, base + 1] <= b[i, base + 3]) {
+            row1 = row1 " " b[i, base]; row2 = row2 " " b[i, base + 2]
+        } else {
+            row1 = row1 " " b[i, base + 2]; row2 = row2 " " b[i, base]
+        }
+    }
+    print row1 > plot
+    print row2 > plot
+}
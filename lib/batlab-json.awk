@@ -0,0 +1,61 @@
+# batlab-json.awk - JSONL field extraction and ISO 8601 parsing for awk
+#
+# Shared helpers for the batlab-report pipeline. Load with -f before the
+# script that uses them. Portable to POSIX awk (mawk, nawk, gawk).
+
+# Value of "key" in a flat JSON object line, unquoted. Returns "" when the
+# key is missing or its value is empty (the malformed "temp_c": , rows).
+function json_field(line, key,    i, rest, v) {
+    i = index(line, "\"" key "\":")
+    if (i == 0) return ""
+    rest = substr(line, i + length(key) + 3)
+    sub(/^[ \t]+/, "", rest)
+    if (substr(rest, 1, 1) == "\"") {
+        rest = substr(rest, 2)
+        return substr(rest, 1, index(rest, "\"") - 1)
+    }
+    match(rest, /^[^,}]*/)
+    v = substr(rest, 1, RLENGTH)
+    sub(/[ \t]+$/, "", v)
+    return v == "null" ? "" : v
+}
+
+# CPU utilization in percent: the sampler's measured cpu_pct, or the
+# load average scaled by 100 for runs from the shell collectors
+function cpu_percent(line,    v) {
+    v = json_field(line, "cpu_pct")
+    return v != "" ? v + 0 : json_field(line, "cpu_load") * 100
+}
+
+# Seconds since the epoch for an ISO 8601 timestamp such as
+# 2025-09-12T05:43:15.619660339Z or 2025-09-12T05:43:15.6+00:00,
+# computed arithmetically so no date(1) process is forked per row.
+function iso_epoch(ts,    y, m, d, hh, mm, ss, rest, frac, off, mp, days) {
+    if (ts !~ /^[0-9][0-9][0-9][0-9]-[0-9][0-9]-[0-9][0-9]T[0-9][0-9]:[0-9][0-9]:[0-9][0-9]/)
+        return ""
+    y = substr(ts, 1, 4) + 0
+    m = substr(ts, 6, 2) + 0
+    d = substr(ts, 9, 2) + 0
+    hh = substr(ts, 12, 2) + 0
+    mm = substr(ts, 15, 2) + 0
+    ss = substr(ts, 18, 2) + 0
+    rest = substr(ts, 20)
+
+    frac = 0
+    if (match(rest, /^\.[0-9]+/)) {
+        frac = ("0" substr(rest, 1, RLENGTH)) + 0
+        rest = substr(rest, RLENGTH + 1)
+    }
+
+    off = 0
+    if (rest ~ /^[+-][0-9][0-9]:?[0-9][0-9]/) {
+        off = substr(rest, 2, 2) * 3600 + substr(rest, length(rest) - 1, 2) * 60
+        if (substr(rest, 1, 1) == "-") off = -off
+    }
+
+    # Days from civil date (proleptic Gregorian), March-based year
+    if (m <= 2) { y -= 1; mp = m + 9 } else mp = m - 3
+    days = 365 * y + int(y / 4) - int(y / 100) + int(y / 400) + int((153 * mp + 2) / 5) + d - 719469
+
+    return days * 86400 + hh * 3600 + mm * 60 + ss + frac - off
+}
@@ -0,0 +1,88 @@
+# batlab-phases.awk - Per-phase power and energy from workload markers
+#
+# Reads a run's .events markers (JSONL, requires batlab-json.awk), then
+# its table from batlab-table.awk, and prints one tab-separated line per
+# phase:
+#
+#   label start_h end_h samples avg_watts energy_wh start_pct end_pct avg_cpu
+#
+# A start or phase marker opens a phase that lasts until the next marker
+# of any kind; a stop closes it. Each sample's power is held until the
+# next sample, so energy is the area under that step curve, split exactly
+# at phase boundaries, and avg_watts is its time-weighted mean. The table
+# is read once, in order, alongside the phases.
+#
+#   awk -v first="$(first JSONL sample)" -f batlab-json.awk \
+#       -f batlab-phases.awk run.events table
+#
+# first is the run's first sample line; table hours count from it.
+
+BEGIN {
+    t0 = iso_epoch(json_field(first, "t"))
+    FS = " "
+}
+
+# Markers
+FILENAME == ARGV[1] {
+    e = iso_epoch(json_field($0, "t"))
+    kind = json_field($0, "event")
+    if (e == "" || t0 == "" || (kind != "start" && kind != "stop" && kind != "phase")) next
+    label = json_field($0, "label")
+    gsub(/\t/, " ", label)
+    if (label == "") label = "(" kind ")"
+
+    # Insertion sort by time: markers arrive in order, nearly always
+    for (k = ++nev; k > 1 && ev_h[k - 1] > (e - t0) / 3600; k--) {
+        ev_h[k] = ev_h[k - 1]; ev_kind[k] = ev_kind[k - 1]; ev_label[k] = ev_label[k - 1]
+    }
+    ev_h[k] = (e - t0) / 3600; ev_kind[k] = kind; ev_label[k] = label
+    next
+}
+
+# First table line: turn the markers into phases
+!built {
+    built = 1
+    for (k = 1; k <= nev; k++) {
+        if (ev_kind[k] == "stop") continue
+        nph++
+        ph_label[nph] = ev_label[k]
+        ph_lo[nph] = ev_h[k]
+        ph_hi[nph] = k < nev ? ev_h[k + 1] : 1e30
+    }
+    cur = 1
+}
+
+/^#/ || NF < 5 { next }
+{
+    h = $1 + 0
+    if (rows++ > 0) {
+        # The previous sample's watts and CPU over [prev_h, h)
+        while (cur <= nph && ph_hi[cur] <= prev_h) cur++
+        for (j = cur; j <= nph && ph_lo[j] < h; j++) {
+            lo = ph_lo[j] > prev_h ? ph_lo[j] : prev_h
+            hi = ph_hi[j] < h ? ph_hi[j] : h
+            if (hi > lo) {
+                span[j] += hi - lo
+                energy[j] += prev_w * (hi - lo)
+                cpu_area[j] += prev_c * (hi - lo)
+            }
+        }
+    }
+    for (j = cur; j <= nph && ph_lo[j] <= h; j++) {
+        if (h >= ph_hi[j]) continue
+        if (!samples[j]++) start_pct[j] = $2 + 0
+        end_pct[j] = $2 + 0
+    }
+    prev_h = h; prev_w = $3 + 0; prev_c = $4 + 0
+}
+
+END {
+    for (j = 1; j <= nph; j++) {
+        if (!samples[j] && span[j] <= 0) continue
+        lo = ph_lo[j] > 0 ? ph_lo[j] : 0
+        hi = ph_hi[j] < prev_h ? ph_hi[j] : prev_h
+        printf "%s\t%.6f\t%.6f\t%d\t%.3f\t%.4f\t%.1f\t%.1f\t%.1f\n", ph_label[j], lo, hi,
+            samples[j], (span[j] > 0 ? energy[j] / span[j] : 0), energy[j],
+            start_pct[j], end_pct[j], (span[j] > 0 ? cpu_area[j] / span[j] : 0)
+    }
+}
@@ -0,0 +1,32 @@
+# batlab-quantile.awk - Exact quantiles of a sorted stream
+#
+# Reads one value per line in ascending order, as sort -n writes them
+# (or sort -m -n merging runs that are already sorted), and prints a
+# pN_name:value line for each percentile in q. n is the number of values,
+# so only the two values around each rank are kept and memory is constant
+# however many samples are streamed. Quantiles interpolate between the
+# closest ranks, like R's default (type 7) and numpy.
+#
+#   sort -n | awk -v n=COUNT -v q="50 95" -v name=watts -f batlab-quantile.awk
+
+BEGIN {
+    k = split(q, pct, " ")
+    for (i = 1; i <= k; i++) {
+        h = (n - 1) * pct[i] / 100
+        rank[i] = int(h) + 1
+        frac[i] = h - int(h)
+    }
+}
+{
+    for (i = 1; i <= k; i++) {
+        if (NR == rank[i]) lo[i] = $1 + 0
+        if (NR == rank[i] + 1) hi[i] = $1 + 0
+    }
+}
+END {
+    if (NR == 0) exit 1
+    for (i = 1; i <= k; i++) {
+        v = frac[i] > 0 ? lo[i] + frac[i] * (hi[i] - lo[i]) : lo[i]
+        print "p" pct[i] "_" name ":" v
+    }
+}
@@ -0,0 +1,85 @@
+# batlab-sketch.awk - Merge watts sketches and report their quantiles
+#
+# Sketches are the watts_sketch objects in run summaries, written by
+# batlab-stats.awk: value v is counted in bucket ceil(log_gamma |v|) with
+# gamma = (1 + alpha) / (1 - alpha), near-zero values apart. Buckets merge
+# by adding counts, so any set of runs is summarised from its summaries
+# without reading samples, and every quantile is within alpha (1%) of
+# the true value.
+#
+# Input is one bucket per line, as jq flattens the summaries:
+#
+#   group<TAB>pos|neg|zero<TAB>index<TAB>count
+#
+# and output one line per group, in order of first appearance, after an
+# optional fleet-wide group named by -v fleet=NAME:
+#
+#   group<TAB>count<TAB>p50<TAB>p95<TAB>p99
+#
+#   awk -F'\t' -v fleet=all -v q="50 95 99" -f batlab-sketch.awk
+
+function add(g, sign, k, c) {
+    if (!(g in total)) order[++ngroups] = g
+    total[g] += c
+    if (sign == "zero") return
+    k += 0
+    if (!((g, sign) in lo) || k < lo[g, sign]) lo[g, sign] = k
+    if (!((g, sign) in hi) || k > hi[g, sign]) hi[g, sign] = k
+    bin[g, sign, k] += c
+}
+
+# Representative value of bucket k: the midpoint that bounds the error
+function value(k) {
+    return 2 * exp(k * log_gamma) / (gamma + 1)
+}
+
+# Value at 0-based rank r of group g: negative buckets from the largest
+# magnitude, then zero, then positive buckets upward
+function rank_value(g, r,    k, cum) {
+    cum = 0
+    if ((g, "neg") in lo)
+        for (k = hi[g, "neg"]; k >= lo[g, "neg"]; k--)
+            if ((g, "neg", k) in bin && (cum += bin[g, "neg", k]) > r)
+                return -value(k)
+    cum += total[g] - count_bins(g, "neg") - count_bins(g, "pos")
+    if (cum > r) return 0
+    if ((g, "pos") in lo)
+        for (k = lo[g, "pos"]; k <= hi[g, "pos"]; k++)
+            if ((g, "pos", k) in bin && (cum += bin[g, "pos", k]) > r)
+                return value(k)
+    return value(hi[g, "pos"])
+}
+
+function count_bins(g, sign,    k, n) {
+    n = 0
+    if ((g, sign) in lo)
+        for (k = lo[g, sign]; k <= hi[g, sign]; k++)
+            if ((g, sign, k) in bin) n += bin[g, sign, k]
+    return n
+}
+
+BEGIN {
+    if (alpha == "") alpha = 0.01
+    if (q == "") q = "50 95 99"
+    gamma = (1 + alpha) / (1 - alpha)
+    log_gamma = log(gamma)
+    nq = split(q, pct, " ")
+    if (fleet != "") {
+        order[++ngroups] = fleet
+        total[fleet] = 0
+    }
+}
+NF == 4 {
+    if (fleet != "") add(fleet, $2, $3, $4)
+    add($1, $2, $3, $4)
+}
+END {
+    for (i = 1; i <= ngroups; i++) {
+        g = order[i]
+        if (total[g] == 0) continue
+        line = g "\t" total[g]
+        for (j = 1; j <= nq; j++)
+            line = line sprintf("\t%.6g", rank_value(g, pct[j] / 100 * (total[g] - 1)))
+        print line
+    }
+}
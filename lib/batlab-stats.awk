@@ -0,0 +1,122 @@
+# batlab-stats.awk - Single-pass run statistics for batlab-report
+#
+# Reads the columnar table produced by batlab-table.awk and prints the
+# key:value summary used by calculate_stats. Memory use is constant.
+#
+# watts are also counted into a mergeable quantile sketch, printed as a
+# watts_sketch:JSON line: log-spaced buckets (DDSketch) with relative
+# accuracy alpha, so runs can be combined by adding bucket counts (see
+# batlab-sketch.awk). A run needs at most a few hundred buckets.
+#
+# energy_wh integrates watts over hours with the trapezoidal rule, so
+# uneven sample spacing is weighted by the time it actually covered;
+# projected_hours is the full-charge runtime at the observed drain rate.
+
+# Count v in bucket ceil(log_gamma |v|), near-zero values apart
+function sketch_add(v,    m, x, k) {
+    if (v > -1e-9 && v < 1e-9) {
+        sketch_zero++
+        return
+    }
+    m = v < 0 ? -v : v
+    x = log(m) / log_gamma
+    k = int(x)
+    if (k < x) k++
+    if (v > 0) {
+        if (!pos_n++) pos_lo = pos_hi = k
+        if (k < pos_lo) pos_lo = k
+        if (k > pos_hi) pos_hi = k
+        pos[k]++
+    } else {
+        if (!neg_n++) neg_lo = neg_hi = k
+        if (k < neg_lo) neg_lo = k
+        if (k > neg_hi) neg_hi = k
+        neg[k]++
+    }
+}
+
+# Buckets lo..hi of b as a JSON object, in index order
+function sketch_bins(b, n, lo, hi,    k, out, sep) {
+    out = "{"
+    for (k = lo; n > 0 && k <= hi; k++)
+        if (k in b) {
+            out = out sep "\"" k "\":" b[k]
+            sep = ","
+        }
+    return out "}"
+}
+
+BEGIN {
+    alpha = 0.01
+    log_gamma = log((1 + alpha) / (1 - alpha))
+}
+
+/^#/ { next }
+{
+    hours = $1 + 0
+    pct = $2 + 0
+    watts = $3 + 0
+    cpu = $4 + 0
+    temp = $5 + 0
+
+    if (count == 0) {
+        start_pct = pct
+        min_pct = max_pct = pct
+        min_watts = max_watts = watts
+        min_cpu = max_cpu = cpu
+        min_temp = max_temp = temp
+    }
+
+    if (count > 0 && hours > prev_hours)
+        energy_wh += (prev_watts + watts) / 2 * (hours - prev_hours)
+    prev_hours = hours
+    prev_watts = watts
+    duration = hours
+    end_pct = pct
+
+    if (pct < min_pct) min_pct = pct
+    if (pct > max_pct) max_pct = pct
+    if (watts < min_watts) min_watts = watts
+    if (watts > max_watts) max_watts = watts
+    if (cpu < min_cpu) min_cpu = cpu
+    if (cpu > max_cpu) max_cpu = cpu
+    if (temp < min_temp) min_temp = temp
+    if (temp > max_temp) max_temp = temp
+
+    sum_watts += watts
+    sketch_add(watts)
+    sum_cpu += cpu
+    sum_temp += temp
+    count++
+}
+END {
+    if (count == 0) exit 1
+
+    avg_watts = sum_watts / count
+    avg_cpu = sum_cpu / count
+    avg_temp = sum_temp / count
+    battery_drain = start_pct - end_pct
+    drain_rate = (count > 1 && duration > 0) ? battery_drain / duration : 0
+    projected_hours = drain_rate > 0 ? 100 / drain_rate : 0
+
+    print "duration:" duration
+    print "samples:" count
+    print "start_pct:" start_pct
+    print "end_pct:" end_pct
+    print "battery_drain:" battery_drain
+    print "drain_rate:" drain_rate
+    print "avg_watts:" avg_watts
+    print "min_watts:" min_watts
+    print "max_watts:" max_watts
+    print "avg_cpu:" avg_cpu
+    print "min_cpu:" min_cpu
+    print "max_cpu:" max_cpu
+    print "avg_temp:" avg_temp
+    print "min_temp:" min_temp
+    print "max_temp:" max_temp
+    print "energy_wh:" (energy_wh + 0)
+    print "projected_hours:" projected_hours
+    print "watts_sketch:{\"alpha\":" alpha ",\"zero\":" (sketch_zero + 0) \
+        ",\"pos\":" sketch_bins(pos, pos_n, pos_lo, pos_hi) \
+        ",\"neg\":" sketch_bins(neg, neg_n, neg_lo, neg_hi) "}"
+}
@@ -0,0 +1,133 @@
+# batlab-svg.awk - Four-panel SVG graph of a batlab table
+#
+# Renders a table from batlab-table.awk (or batlab-downsample.awk) as the
+# standard 2x2 layout of battery %, power, CPU load and temperature over
+# time, the same panels the gnuplot script draws, as one self-contained
+# SVG. No fonts are loaded and no process is started, so a report's graph
+# costs a few milliseconds and can be inlined into its HTML.
+#
+#   awk -v title="Battery Analysis: NAME" -f batlab-svg.awk table > graph.svg
+#
+# Rows are held in memory, so downsample tables over a few thousand rows
+# first, as batlab-report and batlab-graph do.
+
+BEGIN {
+    width = 1200; height = 800
+    head = 50                   # space for the overall title
+    pw = width / 2; ph = (height - head) / 2
+    ml = 75; mr = 25; mt = 40; mb = 50
+
+    ptitle[1] = "Battery Drain"; ylabel[1] = "Battery %"; color[1] = "#cc0000"
+    ptitle[2] = "Power Consumption"; ylabel[2] = "Power (W)"; color[2] = "#990000"
+    ptitle[3] = "CPU Load"; ylabel[3] = "CPU %"; color[3] = "#660000"
+    ptitle[4] = "Temperature"; ylabel[4] = "Temperature (°C)"; color[4] = "#aa3333"
+    floor0[3] = 1               # CPU axis starts at 0, as "set yrange [0:*]"
+}
+/^#/ || NF < 5 { next }
+{
+    n++
+    for (k = 1; k <= 5; k++) col[n, k] = $k + 0
+}
+
+END {
+    printf "<svg xmlns=\"http://www.w3.org/2000/svg\" viewBox=\"0 0 %d %d\" " \
+        "width=\"%d\" height=\"%d\" font-family=\"Arial, Helvetica, sans-serif\" font-size=\"12\">\n",
+        width, height, width, height
+    printf "<rect width=\"%d\" height=\"%d\" fill=\"#ffffff\"/>\n", width, height
+    printf "<text x=\"%d\" y=\"30\" text-anchor=\"middle\" font-size=\"16\">%s</text>\n",
+        width / 2, xml(title != "" ? title : "Battery Analysis")
+
+    xmin = n ? col[1, 1] : 0; xmax = xmin
+    for (i = 2; i <= n; i++) {
+        if (col[i, 1] < xmin) xmin = col[i, 1]
+        if (col[i, 1] > xmax) xmax = col[i, 1]
+    }
+    axis(xmin, xmax, 0)
+    xlo = a_lo; xhi = a_hi; xstep = a_step
+
+    for (p = 1; p <= 4; p++)
+        panel(p, (p - 1) % 2 * pw, head + int((p - 1) / 2) * ph)
+    print "</svg>"
+}
+
+function xml(s) {
+    gsub(/&/, "\\&amp;", s); gsub(/</, "\\&lt;", s); gsub(/>/, "\\&gt;", s)
+    gsub(/"/, "\\&quot;", s)
+    return s
+}
+
+function floor(x) { return x == int(x) ? x : x < 0 ? int(x) - 1 : int(x) }
+function ceil(x) { return x == int(x) ? x : x > 0 ? int(x) + 1 : int(x) }
+
+# Round the range lo..hi out to "nice" ticks, 1, 2 or 5 times a power of
+# ten and about five of them, into a_lo, a_hi and a_step
+function axis(lo, hi, from_zero,    raw, mag, f) {
+    if (from_zero && lo > 0) lo = 0
+    if (hi <= lo) { hi = lo + 1; if (!from_zero) lo -= 1 }
+    raw = (hi - lo) / 5
+    mag = exp(log(10) * floor(log(raw) / log(10)))
+    f = raw / mag
+    a_step = (f <= 1 ? 1 : f <= 2 ? 2 : f <= 5 ? 5 : 10) * mag
+    a_lo = a_step * floor(lo / a_step + 1e-9)
+    a_hi = a_step * ceil(hi / a_step - 1e-9)
+}
+
+# Tick label with as many decimals as the step needs
+function label(v, step) {
+    if (step > 0.999) return sprintf("%d", v + (v < 0 ? -0.5 : 0.5))
+    return sprintf(step > 0.0999 ? "%.1f" : "%.2f", v)
+}
+
+function panel(p, x0, y0,    ylo, yhi, ystep, i, v, left, right, top, bottom, sx, sy, j, t) {
+    left = x0 + ml; right = x0 + pw - mr; top = y0 + mt; bottom = y0 + ph - mb
+
+    ylo = n ? col[1, p + 1] : 0; yhi = ylo
+    for (i = 2; i <= n; i++) {
+        v = col[i, p + 1]
+        if (v < ylo) ylo = v
+        if (v > yhi) yhi = v
+    }
+    axis(ylo, yhi, floor0[p])
+    ylo = a_lo; yhi = a_hi; ystep = a_step
+    sx = (right - left) / (xhi - xlo)
+    sy = (bottom - top) / (yhi - ylo)
+
+    printf "<g>\n<text x=\"%.1f\" y=\"%.1f\" text-anchor=\"middle\" font-size=\"14\">%s</text>\n",
+        (left + right) / 2, y0 + 25, ptitle[p]
+
+    # Grid and tick labels
+    printf "<g stroke=\"#dddddd\" stroke-dasharray=\"2,3\">\n"
+    for (j = 0; (t = xlo + j * xstep) <= xhi + xstep / 2; j++)
+        printf "<line x1=\"%.1f\" y1=\"%.1f\" x2=\"%.1f\" y2=\"%.1f\"/>\n",
+            left + (t - xlo) * sx, top, left + (t - xlo) * sx, bottom
+    for (j = 0; (t = ylo + j * ystep) <= yhi + ystep / 2; j++)
+        printf "<line x1=\"%.1f\" y1=\"%.1f\" x2=\"%.1f\" y2=\"%.1f\"/>\n",
+            left, bottom - (t - ylo) * sy, right, bottom - (t - ylo) * sy
+    print "</g>"
+    printf "<g fill=\"#333333\">\n"
+    for (j = 0; (t = xlo + j * xstep) <= xhi + xstep / 2; j++)
+        printf "<text x=\"%.1f\" y=\"%.1f\" text-anchor=\"middle\">%s</text>\n",
+            left + (t - xlo) * sx, bottom + 16, label(t, xstep)
+    for (j = 0; (t = ylo + j * ystep) <= yhi + ystep / 2; j++)
+        printf "<text x=\"%.1f\" y=\"%.1f\" text-anchor=\"end\">%s</text>\n",
+            left - 6, bottom - (t - ylo) * sy + 4, label(t, ystep)
+    printf "<text x=\"%.1f\" y=\"%.1f\" text-anchor=\"middle\">Time (hours)</text>\n",
+        (left + right) / 2, bottom + 38
+    printf "<text transform=\"translate(%.1f %.1f) rotate(-90)\" text-anchor=\"middle\">%s</text>\n",
+        x0 + 22, (top + bottom) / 2, ylabel[p]
+    print "</g>"
+    printf "<rect x=\"%.1f\" y=\"%.1f\" width=\"%.1f\" height=\"%.1f\" fill=\"none\" stroke=\"#333333\"/>\n",
+        left, top, right - left, bottom - top
+
+    if (n == 0) {
+        printf "<text x=\"%.1f\" y=\"%.1f\" text-anchor=\"middle\" fill=\"#666666\">No data</text>\n",
+            (left + right) / 2, (top + bottom) / 2
+    } else {
+        printf "<polyline fill=\"none\" stroke=\"%s\" stroke-width=\"2\" stroke-linejoin=\"round\" points=\"", color[p]
+        for (i = 1; i <= n; i++)
+            printf "%s%.1f,%.1f", (i > 1 ? " " : ""),
+                left + (col[i, 1] - xlo) * sx, bottom - (col[i, p + 1] - ylo) * sy
+        print "\"/>"
+    }
+    print "</g>"
+}
@@ -0,0 +1,43 @@
+# batlab-table.awk - Decode batlab JSONL into the shared columnar table
+#
+# Reads JSONL samples (requires batlab-json.awk) and prints one
+# whitespace-separated row per sample:
+#
+#   hours pct watts cpu temp
+#
+# hours is time since the first sample, cpu is the measured utilization
+# (cpu_pct, or cpu_load as a percentage for older runs) and a missing
+# temp_c reads as 0. Rows with an unparseable timestamp
+# are dropped. gnuplot plots the table directly and batlab-stats.awk
+# summarises it, so each run is parsed from JSON exactly once.
+#
+# -v from=T -v to=T keep only samples inside a window, where T is an
+# ISO 8601 time or +N[smh] from the first sample; hours then count from
+# the first sample kept.
+
+# Epoch seconds for a window bound, relative to run_start
+function window_bound(spec, run_start,    n, unit) {
+    if (substr(spec, 1, 1) != "+") return iso_epoch(spec)
+    unit = substr(spec, length(spec))
+    n = substr(spec, 2) + 0
+    if (unit == "m") n *= 60
+    else if (unit == "h") n *= 3600
+    return run_start + n
+}
+
+BEGIN { print "# hours pct watts cpu temp" }
+{
+    epoch = iso_epoch(json_field($0, "t"))
+    if (epoch == "") next
+    if (seen++ == 0) {
+        lo = from != "" ? window_bound(from, epoch) : ""
+        hi = to != "" ? window_bound(to, epoch) : ""
+    }
+    if (lo != "" && epoch < lo) next
+    if (hi != "" && epoch > hi) exit
+    if (rows++ == 0) start_time = epoch
+
+    printf "%.6f %s %s %s %s\n", (epoch - start_time) / 3600,
+        json_field($0, "pct") + 0, json_field($0, "watts") + 0,
+        cpu_percent($0), json_field($0, "temp_c") + 0
+}
@@ -0,0 +1,220 @@
+# batlab-template.awk - Compiled HTML templates for batlab-report
+#
+# Renders every page of a batlab-report run in one process. Each template
+# under dir is parsed once, on first use, into an instruction list that
+# every page using it then walks; partials are inlined when compiled.
+#
+#   {{NAME}}              the value, as is: records hold HTML, text escaped
+#   {{NAME:FMT}}          the value through printf FMT, or N/A if not a number
+#   {{#NAME}}...{{/NAME}} once per item of list NAME, or once if NAME is set
+#   {{?NAME}}...{{/NAME}} once if list NAME has items or NAME is set
+#   {{^NAME}}...{{/NAME}} once if neither
+#   {{>FILE}}             the partial dir/FILE
+#
+# A line holding nothing but section tags is dropped from the output, and
+# a partial alone on its line is indented to match it. Inside an item,
+# names are looked up in the item, then the page, then the defaults.
+#
+# Records on stdin, one per line, values escaped as by jq's @tsv:
+#
+#   @page<TAB>TEMPLATE<TAB>OUTPUT   start a page rendered to OUTPUT
+#   @item<TAB>LIST                  start the next item of LIST
+#   NAME<TAB>VALUE                  set NAME on the item, page or defaults
+#
+# Lines before the first @page are defaults shared by every page, and
+# lines after an @item belong to that item, so a page's own values come
+# before its lists. A page is rendered when the next one starts, through
+# awk's buffered output, and its file closed at once; the page count is
+# printed at the end.
+#
+#   awk -v dir="$TEMPLATES_DIR" -f batlab-template.awk records
+
+BEGIN {
+    pages = 0
+    failed = 0
+}
+
+function fail(msg) {
+    printf "batlab-template: %s\n", msg > "/dev/stderr"
+    failed = 1
+}
+
+# @tsv escapes back to tabs, newlines and backslashes
+function unescape(s,    parts, n, i, out) {
+    if (index(s, "\\") == 0) return s
+    n = split(s, parts, /\\\\/)
+    out = ""
+    for (i = 1; i <= n; i++) {
+        gsub(/\\n/, "\n", parts[i])
+        gsub(/\\t/, "\t", parts[i])
+        gsub(/\\r/, "\r", parts[i])
+        out = out (i > 1 ? "\\" : "") parts[i]
+    }
+    return out
+}
+
+function emit(t, op, a, f,    n) {
+    n = ++ncode[t]
+    code[t, n] = op
+    arg[t, n] = a
+    fmt[t, n] = f
+}
+
+# Append the instructions for the text of file to template t
+function compile_file(t, file, indent,    path, line, ok, lines, nl, i) {
+    path = dir "/" file
+    nl = 0
+    while ((ok = (getline line < path)) > 0)
+        lines[++nl] = line
+    close(path)
+    if (ok < 0) {
+        fail("cannot read template " path)
+        return
+    }
+    for (i = 1; i <= nl; i++)
+        compile_line(t, lines[i], indent)
+}
+
+function compile_line(t, line, indent,    standalone, tag, name, op, p, q, rest) {
+    standalone = line ~ /^[ \t]*(\{\{[#?^\/>][^}]*\}\}[ \t]*)+$/
+    if (standalone && line ~ /^[ \t]*\{\{>[^}]*\}\}[ \t]*$/) {
+        match(line, /^[ \t]*/)
+        name = substr(line, RLENGTH + 4)
+        sub(/\}\}[ \t]*$/, "", name)
+        compile_file(t, name, indent substr(line, 1, RLENGTH))
+        return
+    }
+    if (standalone)
+        gsub(/^[ \t]+|[ \t]+$/, "", line)
+    else
+        line = indent line "\n"
+
+    while ((p = index(line, "{{")) > 0) {
+        if (p > 1) emit(t, "text", substr(line, 1, p - 1))
+        rest = substr(line, p + 2)
+        q = index(rest, "}}")
+        if (q == 0) {
+            fail("unclosed tag in template " t)
+            return
+        }
+        tag = substr(rest, 1, q - 1)
+        line = substr(rest, q + 2)
+        op = substr(tag, 1, 1)
+        name = substr(tag, 2)
+        if (op == "#" || op == "?" || op == "^") {
+            emit(t, op, name)
+            open[t, ++depth[t]] = ncode[t]
+        } else if (op == "/") {
+            if (depth[t] == 0 || arg[t, open[t, depth[t]]] != name) {
+                fail("unmatched {{/" name "}} in template " t)
+                return
+            }
+            emit(t, "/", name)
+            jump[t, open[t, depth[t]--]] = ncode[t]
+        } else if (op == ">") {
+            compile_file(t, name, "")
+        } else if ((p = index(tag, ":")) > 0) {
+            emit(t, "value", substr(tag, 1, p - 1), substr(tag, p + 1))
+        } else {
+            emit(t, "value", tag, "")
+        }
+    }
+    if (line != "") emit(t, "text", line)
+}
+
+function compile(t) {
+    if (t in compiled) return compiled[t]
+    ncode[t] = 0
+    depth[t] = 0
+    compile_file(t, t, "")
+    if (depth[t] > 0) fail("unclosed {{" code[t, open[t, depth[t]]] arg[t, open[t, depth[t]]] "}} in template " t)
+    compiled[t] = !failed
+    return compiled[t]
+}
+
+function lookup(name, list, item) {
+    if (item && ((list, item, name) in ival)) return ival[list, item, name]
+    if (name in val) return val[name]
+    if (name in def) return def[name]
+    return ""
+}
+
+function is_number(s) {
+    return s ~ /^-?[0-9]*\.?[0-9]+([eE][-+]?[0-9]+)?$/
+}
+
+# Write instructions from..to of template t to out
+function render(t, from, to, list, item, out,    i, op, v, k, set) {
+    for (i = from; i <= to; i++) {
+        op = code[t, i]
+        if (op == "text") {
+            printf "%s", arg[t, i] > out
+        } else if (op == "value") {
+            v = lookup(arg[t, i], list, item)
+            if (fmt[t, i] == "") printf "%s", v > out
+            else if (is_number(v)) printf fmt[t, i], v > out
+            else printf "N/A" > out
+        } else if (op == "#" || op == "?" || op == "^") {
+            k = arg[t, i]
+            set = items[k] > 0 || lookup(k, list, item) != ""
+            if (op == "#" && items[k] > 0) {
+                for (v = 1; v <= items[k]; v++)
+                    render(t, i + 1, jump[t, i] - 1, k, v, out)
+            } else if ((op == "^") != set) {
+                render(t, i + 1, jump[t, i] - 1, list, item, out)
+            }
+            i = jump[t, i]
+        }
+    }
+}
+
+function finish_page() {
+    if (page_template == "") return
+    if (compile(page_template)) {
+        render(page_template, 1, ncode[page_template], "", 0, page_output)
+        close(page_output)
+        pages++
+    }
+    page_template = ""
+}
+
+{
+    p = index($0, "\t")
+    name = p ? substr($0, 1, p - 1) : $0
+    value = p ? substr($0, p + 1) : ""
+}
+
+name == "@page" {
+    finish_page()
+    p = index(value, "\t")
+    page_template = substr(value, 1, p - 1)
+    page_output = substr(value, p + 1)
+    if (p == 0 || page_template == "" || page_output == "") {
+        fail("bad @page record: " $0)
+        page_template = ""
+    }
+    in_page = 1
+    list = ""
+    delete val
+    delete ival
+    delete items
+    next
+}
+
+name == "@item" {
+    list = value
+    item = ++items[list]
+    next
+}
+
+name == "" { next }
+
+!in_page { def[name] = unescape(value); next }
+list != "" { ival[list, item, name] = unescape(value); next }
+{ val[name] = unescape(value) }
+
+END {
+    finish_page()
+    if (failed) exit 1
+    print pages
+}
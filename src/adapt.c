@@ -0,0 +1,124 @@
+/*
+ * adapt.c - Adaptive sample persistence for batlab-sampler
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "adapt.h"
+
+int adapt_init(struct adapt *a, const char *max)
+{
+    char *end;
+    double value = strtod(max, &end);
+
+    memset(a, 0, sizeof(*a));
+    if (end == max || value <= 0.0)
+        return -1;
+    if (*end == 'm')
+        value *= 60.0;
+    else if (*end == 'h')
+        value *= 3600.0;
+    else if (*end != 's' && *end != '\0')
+        return -1;
+    if (*end != '\0' && end[1] != '\0')
+        return -1;
+
+    a->max_s = value;
+    a->watts = ADAPT_WATTS;
+    a->pct = ADAPT_PCT;
+    a->cpu_load = ADAPT_CPU_LOAD;
+    a->cpu_pct = ADAPT_CPU_PCT;
+    a->temp_c = ADAPT_TEMP_C;
+    return 0;
+}
+
+int adapt_parse_thresholds(struct adapt *a, const char *spec)
+{
+    static const char *const names[] = { "watts", "pct", "cpu_load", "cpu_pct", "temp_c" };
+    double *fields[] = { &a->watts, &a->pct, &a->cpu_load, &a->cpu_pct, &a->temp_c };
+    const char *p = spec;
+
+    while (*p != '\0') {
+        size_t n = strcspn(p, "=");
+        char *end;
+        double value;
+        size_t i;
+
+        for (i = 0; i < sizeof(names) / sizeof(names[0]); i++)
+            if (strlen(names[i]) == n && strncmp(p, names[i], n) == 0)
+                break;
+        if (i == sizeof(names) / sizeof(names[0]) || p[n] != '=')
+            return -1;
+        value = strtod(p + n + 1, &end);
+        if (end == p + n + 1 || value < 0.0 || (*end != ',' && *end != '\0'))
+            return -1;
+        *fields[i] = value;
+        p = *end == ',' ? end + 1 : end;
+    }
+    return 0;
+}
+
+static int moved(double now, double then, double threshold)
+{
+    double d = now - then;
+
+    return d > threshold || d < -threshold;
+}
+
+enum adapt_verdict adapt_check(struct adapt *a, const struct sample *s, int64_t mono_ns)
+{
+    const struct sample *l = &a->last;
+
+    a->probed++;
+    if (!a->have_last)
+        return ADAPT_KEEP;
+    if (moved(s->watts, l->watts, a->watts) || moved(s->pct, l->pct, a->pct) ||
+        moved(s->cpu_load, l->cpu_load, a->cpu_load) ||
+        moved(s->temp_c, l->temp_c, a->temp_c) ||
+        (s->cpu_pct >= 0.0 && l->cpu_pct >= 0.0 && moved(s->cpu_pct, l->cpu_pct, a->cpu_pct)) ||
+        strcmp(s->src, l->src) != 0) {
+        a->changes++;
+        return ADAPT_CHANGE;
+    }
+    if ((double)(mono_ns - a->last_ns) / 1e9 >= a->max_s) {
+        a->expiries++;
+        return ADAPT_KEEP;
+    }
+    return ADAPT_SKIP;
+}
+
+void adapt_wrote(struct adapt *a, const struct sample *s, int64_t mono_ns)
+{
+    a->last = *s;
+    a->last_ns = mono_ns;
+    a->have_last = 1;
+    a->held_len = 0;
+    a->written++;
+}
+
+void adapt_hold(struct adapt *a, const char *line, size_t len, int64_t t_ns)
+{
+    if (len > sizeof(a->held))
+        return;
+    memcpy(a->held, line, len);
+    a->held_len = len;
+    a->held_t_ns = t_ns;
+}
+
+void adapt_describe(const struct adapt *a, double hz, FILE *f)
+{
+    fprintf(f,
+        "{\"mode\": \"adaptive\", \"probe_hz\": %g, \"max_interval_s\": %g, "
+        "\"thresholds\": {\"watts\": %g, \"pct\": %g, \"cpu_load\": %g, "
+        "\"cpu_pct\": %g, \"temp_c\": %g}}\n",
+        hz, a->max_s, a->watts, a->pct, a->cpu_load, a->cpu_pct, a->temp_c);
+}
+
+void adapt_write_stats(const struct adapt *a, FILE *f)
+{
+    fprintf(f,
+        "adaptive {\"probed\": %llu, \"written\": %llu, \"changes\": %llu, \"expiries\": %llu}\n",
+        (unsigned long long)a->probed, (unsigned long long)a->written,
+        (unsigned long long)a->changes, (unsigned long long)a->expiries);
+}
@@ -0,0 +1,77 @@
+/*
+ * adapt.h - Adaptive sample persistence for batlab-sampler
+ *
+ * With --adaptive MAX, the probes are still read at --hz, but a sample
+ * is written only when one of its values has moved more than a
+ * threshold from the last written sample, its source changed, or MAX
+ * has passed since the last write. An idle plateau then costs one line
+ * per MAX, while a power transient is written at the full probe rate.
+ *
+ * When a change is written, the unwritten sample just before it goes
+ * first, so a plateau keeps both its ends and a step stays a step
+ * instead of becoming a ramp between kept points. The last sample of
+ * the run is always written. energy_wh is still integrated over every
+ * probe reading, so it is as exact as without --adaptive; plain means
+ * over the written samples weigh transients more than their duration.
+ */
+
+#ifndef BATLAB_ADAPT_H
+#define BATLAB_ADAPT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "probe.h"
+#include "writer.h"
+
+/* Default thresholds, in each field's own unit; cpu_pct read at tens of
+ * Hz moves in whole scheduler ticks, so its threshold rides over them */
+#define ADAPT_WATTS     0.5
+#define ADAPT_PCT       1.0
+#define ADAPT_CPU_LOAD  0.5
+#define ADAPT_CPU_PCT   25.0
+#define ADAPT_TEMP_C    2.0
+
+enum adapt_verdict {
+    ADAPT_SKIP,                 /* hold the sample, it adds nothing yet */
+    ADAPT_KEEP,                 /* write it: first sample or MAX expired */
+    ADAPT_CHANGE                /* write the held sample, then this one */
+};
+
+struct adapt {
+    double max_s;
+    double watts;
+    double pct;
+    double cpu_load;
+    double cpu_pct;
+    double temp_c;
+
+    struct sample last;         /* last written */
+    int64_t last_ns;
+    int have_last;
+    char held[WRITER_LINE_MAX]; /* latest unwritten sample line */
+    size_t held_len;
+    int64_t held_t_ns;
+
+    uint64_t probed;
+    uint64_t written;
+    uint64_t changes;
+    uint64_t expiries;
+};
+
+/* max is seconds, with an optional s, m or h suffix; -1 if invalid */
+int adapt_init(struct adapt *a, const char *max);
+/* Thresholds as FIELD=DELTA[,...]: watts, pct, cpu_load, cpu_pct, temp_c */
+int adapt_parse_thresholds(struct adapt *a, const char *spec);
+/* Whether the sample just read at mono_ns is written */
+enum adapt_verdict adapt_check(struct adapt *a, const struct sample *s, int64_t mono_ns);
+/* Record the verdict: a written sample, or the line held instead */
+void adapt_wrote(struct adapt *a, const struct sample *s, int64_t mono_ns);
+void adapt_hold(struct adapt *a, const char *line, size_t len, int64_t t_ns);
+/* The policy as JSON, for the run's .meta.json */
+void adapt_describe(const struct adapt *a, double hz, FILE *f);
+/* Write the counters as an "adaptive {json}" stats line */
+void adapt_write_stats(const struct adapt *a, FILE *f);
+
+#endif /* BATLAB_ADAPT_H */
@@ -0,0 +1,979 @@
+/*
+ * batlab-aggregator - Central collector for pushed batlab runs
+ *
+ * Receives the batches batlab-sampler --push sends from a fleet of
+ * laptops (see push.h) and files them into a run store laid out like a
+ * local data/ directory, so batlab-report and batlab-data read it as is:
+ *
+ *   RUN_ID.jsonl          samples, one write(2) per batch
+ *   RUN_ID.meta.json      pushed when the run starts and again when it ends
+ *   RUN_ID.events         workload markers, pushed when the run ends
+ *   RUN_ID.summary.json   the report's summary sidecar, kept current
+ *
+ * A single-threaded poll(2) loop serves every connection; answers are
+ * sent from it without blocking, so a client that stops reading holds
+ * only its own slot until it idles out. Appends are
+ * group-committed: a batch is acknowledged after the next sync pass,
+ * which fsyncs each run written since the last pass once, however many
+ * batches it received, so the fsync rate is set by the number of active
+ * runs and --sync-every, never by samples or hosts. Each run's
+ * statistics are updated from its rows as they arrive (see stats.h), and
+ * the same pass rewrites the .summary.json of the runs that changed,
+ * after the data it describes is on disk, so the report's index uses it
+ * without re-reading the run.
+ *
+ *   POST /runs/ID/samples   append a batch, gzip or not, placed by its
+ *                           X-Batlab-Offset: bytes already stored from a
+ *                           retried batch are skipped, and a batch past
+ *                           the end of the stored stream is refused with
+ *                           409 and the offset to resume from
+ *   PUT  /runs/ID/meta      replace RUN_ID.meta.json
+ *   PUT  /runs/ID/events    replace RUN_ID.events
+ *   GET  /runs              the runs seen since startup, as JSON
+ *
+ * It listens on 127.0.0.1 unless --listen names another address. With
+ * --token (or BATLAB_TOKEN), every request must carry the same token in
+ * an X-Batlab-Token header, which batlab-sampler sends from its own
+ * BATLAB_TOKEN, and is refused with 401 otherwise.
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(BATLAB_ZLIB)
+#include <zlib.h>
+#endif
+
+#include "jsonl.h"
+#include "push.h"
+#include "stats.h"
+
+#define PROGRAM_NAME "batlab-aggregator"
+#define VERSION "2.0.0"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0          /* SIGPIPE is ignored in main */
+#endif
+
+#define AGG_CLIENTS_MAX     256
+#define AGG_RUNS_MAX        256     /* runs held open; idle ones are evicted */
+#define AGG_HEAD_MAX        8192
+#define AGG_BODY_MAX        (4u << 20)
+#define AGG_RAW_MAX         (16u << 20)     /* a batch once inflated */
+#define AGG_META_MAX        (1u << 20)
+#define AGG_CLIENT_IDLE_NS  30000000000LL
+#define AGG_RUN_IDLE_NS     600000000000LL
+
+struct run {
+    char id[PUSH_RUN_MAX];      /* "" when the slot is free */
+    int fd;                     /* RUN_ID.jsonl, appending */
+    uint64_t size;
+    uint64_t stream;            /* end of the pushed stream stored so far */
+    int64_t t0_ns;              /* first sample, hours count from it */
+    struct stats st;
+    int unsynced;               /* written since the last sync pass */
+    int sync_failed;
+    int stale;                  /* .summary.json is behind st */
+    int64_t seen_ns;
+    uint64_t batches;
+    uint64_t dup_bytes;
+};
+
+struct client {
+    int fd;                     /* -1 when the slot is free */
+    char *buf;
+    size_t len;
+    size_t cap;
+    size_t head_len;            /* 0 until the headers are complete */
+    size_t body_len;
+    int64_t seen_ns;
+    struct run *waiting;        /* answered after this run's next fsync */
+    char reply[96];
+    char *out;                  /* the answer being sent, NULL until then */
+    size_t out_len;
+    size_t out_sent;
+};
+
+static struct run runs[AGG_RUNS_MAX];
+static struct client clients[AGG_CLIENTS_MAX];
+static const char *data_dir = "data";
+static const char *token = NULL;     /* required X-Batlab-Token, if set */
+static int64_t sync_ns = 5000000000LL;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_stop(int sig)
+{
+    (void)sig;
+    stop_requested = 1;
+}
+
+static void usage(FILE *out)
+{
+    fprintf(out,
+        "%s %s - Central collector for pushed batlab runs\n"
+        "\n"
+        "USAGE:\n"
+        "    %s [--listen [HOST:]PORT] [--data DIR] [--sync-every Ns] [--token T]\n"
+        "\n"
+        "OPTIONS:\n"
+        "    --listen ADDR    Accept pushes on ADDR (default: 127.0.0.1:%s);\n"
+        "                     0.0.0.0:PORT accepts them from any host\n"
+        "    --token T        Refuse requests without X-Batlab-Token: T\n"
+        "                     (default: $BATLAB_TOKEN, none when unset)\n"
+        "    --data DIR       Run store, laid out like batlab's data/ (default: data)\n"
+        "    --sync-every Ns  fsync the runs written to, and acknowledge their\n"
+        "                     batches, every N seconds; 0 syncs each batch\n"
+        "                     (default: 5s)\n"
+        "    --help           Show this help\n"
+        "    --version        Show version\n"
+        "\n"
+        "Laptops push with: [BATLAB_TOKEN=T] batlab log --push http://HOST:PORT\n",
+        PROGRAM_NAME, VERSION, PROGRAM_NAME, PUSH_DEFAULT_PORT);
+}
+
+static void log_error(const char *msg, const char *arg)
+{
+    fprintf(stderr, "[ERROR] %s%s\n", msg, arg ? arg : "");
+}
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int listen_on(const char *addr)
+{
+    struct addrinfo hints, *res, *ai;
+    char host[256] = "127.0.0.1";
+    const char *port = addr;
+    const char *colon = strrchr(addr, ':');
+    int fd = -1, one = 1;
+
+    if (colon != NULL) {
+        size_t n = (size_t)(colon - addr);
+
+        if (n >= sizeof(host))
+            return -1;
+        if (n > 0) {
+            memcpy(host, addr, n);
+            host[n] = '\0';
+        }
+        port = colon + 1;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(host, port, &hints, &res) != 0)
+        return -1;
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0)
+            continue;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, 64) == 0)
+            break;
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    if (fd < 0)
+        return -1;
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+/* Run IDs become file names: no separators, no leading dot */
+static int valid_run_id(const char *s, size_t n)
+{
+    size_t i;
+
+    if (n == 0 || n >= PUSH_RUN_MAX || s[0] == '.')
+        return 0;
+    for (i = 0; i < n; i++)
+        if (!isalnum((unsigned char)s[i]) && strchr("._:-+", s[i]) == NULL)
+            return 0;
+    return 1;
+}
+
+static int run_path(char *buf, size_t len, const struct run *r, const char *suffix)
+{
+    return snprintf(buf, len, "%s/%s%s", data_dir, r->id, suffix) < (int)len ? 0 : -1;
+}
+
+static int write_all(int fd, const char *p, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/* Read a whole small file (the .meta.json) into memory */
+static char *slurp(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    char *buf;
+
+    *len = 0;
+    if (f == NULL)
+        return NULL;
+    buf = malloc(AGG_META_MAX);
+    if (buf != NULL)
+        *len = fread(buf, 1, AGG_META_MAX, f);
+    fclose(f);
+    return buf;
+}
+
+/* batlab-report's report name: the ID without its timestamp */
+static void report_name(const char *id, char *out, size_t len)
+{
+    const char *p = id;
+    const char *gramr;
+
+    while (isdigit((unsigned char)*p) || *p == 'T' || *p == ':' || *p == '-')
+        p++;
+    p = p[0] == 'Z' && p[1] == '_' ? p + 2 : id;
+    gramr = strstr(p, "_gramr_");
+    if (gramr != NULL)
+        snprintf(out, len, "%.*s%s", (int)(gramr - p), p, gramr + 7);
+    else
+        snprintf(out, len, "%s", p);
+}
+
+/*
+ * Write RUN_ID.summary.json as batlab-report's write_summary does, from
+ * the run's running statistics and the fields of its .meta.json
+ */
+static void write_summary(struct run *r)
+{
+    static const char *const fields[] = { "config", "host", "os", "start_time", "run_id" };
+    char path[4096], tmp[4096], meta_path[4096], name[PUSH_RUN_MAX];
+    char value[512];
+    size_t meta_len, i;
+    char *meta;
+    FILE *f;
+
+    if (r->st.count == 0 || run_path(path, sizeof(path), r, ".summary.json") != 0 ||
+        run_path(tmp, sizeof(tmp), r, ".summary.json.tmp") != 0 ||
+        run_path(meta_path, sizeof(meta_path), r, ".meta.json") != 0)
+        return;
+
+    meta = slurp(meta_path, &meta_len);
+    f = fopen(tmp, "w");
+    if (f == NULL) {
+        free(meta);
+        log_error("Cannot write summary: ", tmp);
+        return;
+    }
+    report_name(r->id, name, sizeof(name));
+    fprintf(f, "{\"report\": \"%s\", \"data_file\": \"%s.jsonl\"", name, r->id);
+    for (i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+        if (meta == NULL || jsonl_object_string(meta, meta_len, fields[i], value, sizeof(value)) != 0)
+            strcpy(value, "Unknown");
+        fprintf(f, ", \"%s\": \"%s\"", fields[i], value);
+    }
+    fprintf(f, ", \"stats\": ");
+    stats_print_json(&r->st, f);
+    fprintf(f, ", \"watts_sketch\": ");
+    stats_print_sketch(&r->st, f);
+    fprintf(f, "}\n");
+    free(meta);
+    if (fclose(f) != 0 || rename(tmp, path) != 0) {
+        log_error("Cannot write summary: ", path);
+        unlink(tmp);
+        return;
+    }
+    r->stale = 0;
+}
+
+static void add_row(struct run *r, const struct jsonl_row *jr)
+{
+    struct stats_row row;
+
+    if (r->st.count == 0)
+        r->t0_ns = jr->t_ns;
+    stats_row_from_jsonl(&row, jr, r->t0_ns);
+    stats_add(&r->st, &row);
+}
+
+static int rebuild_row(const struct jsonl_row *jr, void *ctx)
+{
+    add_row(ctx, jr);
+    return 0;
+}
+
+static void run_evict(struct run *r)
+{
+    if (r->stale)
+        write_summary(r);
+    if (r->fd >= 0)
+        close(r->fd);
+    r->fd = -1;
+    r->id[0] = '\0';
+}
+
+/*
+ * The run with this ID, opened on first use. A run already on disk,
+ * from before a restart or an eviction, has its statistics rebuilt from
+ * the file once, so the summary stays whole.
+ */
+static struct run *run_get(const char *id, size_t n)
+{
+    struct run *r = NULL;
+    char path[4096];
+    struct stat st;
+    int i;
+
+    for (i = 0; i < AGG_RUNS_MAX; i++) {
+        if (strlen(runs[i].id) == n && memcmp(runs[i].id, id, n) == 0) {
+            runs[i].seen_ns = now_ns();
+            return &runs[i];
+        }
+        if (runs[i].id[0] == '\0' && r == NULL)
+            r = &runs[i];
+    }
+    if (r == NULL) {
+        /* Make room by closing the longest idle run that is on disk */
+        for (i = 0; i < AGG_RUNS_MAX; i++)
+            if (!runs[i].unsynced && (r == NULL || runs[i].seen_ns < r->seen_ns))
+                r = &runs[i];
+        if (r == NULL)
+            return NULL;
+        run_evict(r);
+    }
+
+    memset(r, 0, sizeof(*r));
+    memcpy(r->id, id, n);
+    r->id[n] = '\0';
+    r->seen_ns = now_ns();
+    if (run_path(path, sizeof(path), r, ".jsonl") != 0)
+        goto fail;
+    r->fd = open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (r->fd < 0 || fstat(r->fd, &st) != 0) {
+        log_error("Cannot open run: ", path);
+        goto fail;
+    }
+    r->size = r->stream = (uint64_t)st.st_size;
+    if (r->size > 0 && jsonl_scan_file(path, rebuild_row, r) < 0)
+        log_error("Cannot read run, its summary starts afresh: ", path);
+    return r;
+
+fail:
+    if (r->fd >= 0)
+        close(r->fd);
+    r->fd = -1;
+    r->id[0] = '\0';
+    return NULL;
+}
+
+/*
+ * Append the part of a batch at stream offset off that is not stored
+ * yet; 1 if it starts past the end of the stream, which would leave a
+ * gap. The stream ends where the stored bytes do, so the offset a
+ * restart reads back from the file size is the one acknowledged.
+ */
+static int ingest(struct run *r, uint64_t off, const char *data, size_t len)
+{
+    size_t skip = 0;
+    size_t n;
+    const char *line;
+
+    if (off > r->stream)
+        return 1;
+    if (off < r->stream) {
+        skip = r->stream - off < len ? (size_t)(r->stream - off) : len;
+        r->dup_bytes += skip;
+    }
+    /* Whole lines only; a batch is cut at the last newline, and the
+     * stream ends there */
+    for (n = len; n > skip && data[n - 1] != '\n'; n--)
+        ;
+    if (n > skip) {
+        if (write_all(r->fd, data + skip, n - skip) != 0)
+            return -1;
+        r->size += n - skip;
+        r->unsynced = 1;
+        r->stale = 1;
+        for (line = data + skip; line < data + n;) {
+            const char *nl = memchr(line, '\n', (size_t)(data + n - line));
+            struct jsonl_row jr;
+
+            if (jsonl_parse_row(line, (size_t)(nl - line), &jr) == 0)
+                add_row(r, &jr);
+            line = nl + 1;
+        }
+    }
+    if (off + n > r->stream)
+        r->stream = off + n;
+    r->batches++;
+    return 0;
+}
+
+#if defined(BATLAB_ZLIB)
+/* Inflate a gzip (or zlib) body into a buffer of its own */
+static char *inflate_body(const char *in, size_t len, size_t *out_len)
+{
+    z_stream z;
+    size_t cap = len * 8 + 4096;
+    char *out = NULL;
+    int rc;
+
+    memset(&z, 0, sizeof(z));
+    if (inflateInit2(&z, 15 + 32) != Z_OK)
+        return NULL;
+    z.next_in = (Bytef *)in;
+    z.avail_in = (uInt)len;
+    do {
+        char *grown;
+
+        if (cap > AGG_RAW_MAX)
+            cap = AGG_RAW_MAX;
+        grown = realloc(out, cap);
+        if (grown == NULL)
+            break;
+        out = grown;
+        z.next_out = (Bytef *)out + z.total_out;
+        z.avail_out = (uInt)(cap - z.total_out);
+        rc = inflate(&z, Z_NO_FLUSH);
+        if (rc == Z_STREAM_END) {
+            *out_len = (size_t)z.total_out;
+            inflateEnd(&z);
+            return out;
+        }
+        if (rc != Z_OK && rc != Z_BUF_ERROR)
+            break;
+        if (z.avail_out > 0 || cap == AGG_RAW_MAX)
+            break;              /* truncated input, or too large */
+        cap *= 2;
+    } while (1);
+    inflateEnd(&z);
+    free(out);
+    return NULL;
+}
+#endif
+
+/* Replace one of a run's files whole, durably */
+static int put_file(struct run *r, const char *suffix, const char *data, size_t len)
+{
+    char path[4096], tmp[4096];
+    int fd;
+
+    if (run_path(path, sizeof(path), r, suffix) != 0 ||
+        snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+        return -1;
+    fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return -1;
+    if (write_all(fd, data, len) != 0 || fsync(fd) != 0) {
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+    if (close(fd) != 0 || rename(tmp, path) != 0) {
+        unlink(tmp);
+        return -1;
+    }
+    r->stale = 1;
+    return 0;
+}
+
+/* Value of a request header, case-insensitively; NULL when absent */
+static const char *header(const struct client *c, const char *name, char *out, size_t len)
+{
+    size_t n = strlen(name);
+    const char *p = c->buf;
+    const char *end = c->buf + c->head_len;
+
+    while ((p = memchr(p, '\n', (size_t)(end - p))) != NULL && ++p < end) {
+        size_t v;
+
+        if ((size_t)(end - p) <= n || strncasecmp(p, name, n) != 0 || p[n] != ':')
+            continue;
+        for (p += n + 1; *p == ' ' || *p == '\t'; p++)
+            ;
+        for (v = 0; v + 1 < len && p[v] != '\r' && p[v] != '\n'; v++)
+            out[v] = p[v];
+        out[v] = '\0';
+        return out;
+    }
+    return NULL;
+}
+
+static void drop(struct client *c)
+{
+    close(c->fd);
+    c->fd = -1;
+    free(c->buf);
+    c->buf = NULL;
+    c->len = c->cap = c->head_len = c->body_len = 0;
+    c->waiting = NULL;
+    free(c->out);
+    c->out = NULL;
+    c->out_len = c->out_sent = 0;
+}
+
+/* Send what the socket takes of the answer; close once it is all sent */
+static void write_client(struct client *c)
+{
+    while (c->out_sent < c->out_len) {
+        ssize_t n = send(c->fd, c->out + c->out_sent, c->out_len - c->out_sent,
+                         MSG_DONTWAIT | MSG_NOSIGNAL);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;             /* the rest goes when poll says it can */
+        if (n <= 0)
+            break;
+        c->out_sent += (size_t)n;
+        c->seen_ns = now_ns();
+    }
+    drop(c);
+}
+
+/* Queue the answer and send what goes at once; the poll loop sends the rest */
+static void respond(struct client *c, int status, const char *body)
+{
+    const char *reason = status == 200 ? "OK" : status == 400 ? "Bad Request" :
+                         status == 401 ? "Unauthorized" : status == 404 ? "Not Found" :
+                         status == 409 ? "Conflict" : status == 413 ? "Payload Too Large" :
+                         status == 415 ? "Unsupported Media Type" :
+                         status == 503 ? "Service Unavailable" : "Internal Server Error";
+    size_t body_len = strlen(body);
+    char head[256];
+    size_t head_len;
+
+    head_len = (size_t)snprintf(head, sizeof(head),
+        "HTTP/1.1 %d %s\r\n"
+        "Content-Type: application/json\r\n"
+        "Content-Length: %lu\r\n"
+        "Connection: close\r\n"
+        "\r\n", status, reason, (unsigned long)body_len);
+    c->waiting = NULL;
+    c->out = malloc(head_len + body_len);
+    if (c->out == NULL) {
+        drop(c);
+        return;
+    }
+    memcpy(c->out, head, head_len);
+    memcpy(c->out + head_len, body, body_len);
+    c->out_len = head_len + body_len;
+    c->out_sent = 0;
+    write_client(c);
+}
+
+static void list_runs(struct client *c)
+{
+    static char body[AGG_RUNS_MAX * 512 + 64];
+    int64_t now = now_ns();
+    size_t n = 0;
+    int i;
+
+    n += (size_t)snprintf(body + n, sizeof(body) - n, "[");
+    for (i = 0; i < AGG_RUNS_MAX; i++) {
+        const struct run *r = &runs[i];
+
+        if (r->id[0] == '\0' || n > sizeof(body) - 512)
+            continue;
+        n += (size_t)snprintf(body + n, sizeof(body) - n,
+            "%s\n{\"run_id\": \"%s\", \"bytes\": %llu, \"samples\": %llu, \"batches\": %llu, "
+            "\"duplicate_bytes\": %llu, \"idle_s\": %.0f}",
+            n > 1 ? "," : "", r->id, (unsigned long long)r->size, r->st.count,
+            (unsigned long long)r->batches, (unsigned long long)r->dup_bytes,
+            (double)(now - r->seen_ns) / 1e9);
+    }
+    snprintf(body + n, sizeof(body) - n, "]\n");
+    respond(c, 200, body);
+}
+
+/* Whether the request carries the --token, compared in constant time */
+static int authorized(const struct client *c)
+{
+    char value[256];
+    size_t n, i;
+    unsigned char diff = 0;
+
+    if (token == NULL)
+        return 1;
+    if (header(c, "X-Batlab-Token", value, sizeof(value)) == NULL)
+        return 0;
+    n = strlen(token);
+    if (strlen(value) != n)
+        return 0;
+    for (i = 0; i < n; i++)
+        diff |= (unsigned char)(value[i] ^ token[i]);
+    return diff == 0;
+}
+
+static void handle(struct client *c)
+{
+    char method[8], target[256], value[64];
+    const char *id, *slash, *kind;
+    const char *body = c->buf + c->head_len;
+    char *raw = NULL;
+    size_t raw_len = c->body_len;
+    struct run *r;
+    int gzip;
+
+    if (sscanf(c->buf, "%7s %255s", method, target) != 2) {
+        respond(c, 400, "{\"error\": \"malformed request\"}\n");
+        return;
+    }
+    if (!authorized(c)) {
+        respond(c, 401, "{\"error\": \"missing or wrong X-Batlab-Token\"}\n");
+        return;
+    }
+    if (strcmp(method, "GET") == 0 && strcmp(target, "/runs") == 0) {
+        list_runs(c);
+        return;
+    }
+    if (strncmp(target, "/runs/", 6) != 0 || (slash = strchr(target + 6, '/')) == NULL) {
+        respond(c, 404, "{\"error\": \"not found\"}\n");
+        return;
+    }
+    id = target + 6;
+    kind = slash + 1;
+    if (!valid_run_id(id, (size_t)(slash - id)) ||
+        !((strcmp(method, "POST") == 0 && strcmp(kind, "samples") == 0) ||
+          (strcmp(method, "PUT") == 0 && (strcmp(kind, "meta") == 0 || strcmp(kind, "events") == 0)))) {
+        respond(c, 404, "{\"error\": \"not found\"}\n");
+        return;
+    }
+
+    gzip = header(c, "Content-Encoding", value, sizeof(value)) != NULL &&
+           strcasecmp(value, "identity") != 0;
+    if (gzip) {
+#if defined(BATLAB_ZLIB)
+        if (strcasecmp(value, "gzip") != 0 ||
+            (raw = inflate_body(body, c->body_len, &raw_len)) == NULL) {
+            respond(c, 400, "{\"error\": \"cannot decompress body\"}\n");
+            return;
+        }
+        body = raw;
+#else
+        respond(c, 415, "{\"error\": \"built without zlib, send uncompressed\"}\n");
+        return;
+#endif
+    }
+
+    r = run_get(id, (size_t)(slash - id));
+    if (r == NULL) {
+        free(raw);
+        respond(c, 503, "{\"error\": \"cannot open run\"}\n");
+        return;
+    }
+
+    if (strcmp(kind, "samples") == 0) {
+        uint64_t off = header(c, "X-Batlab-Offset", value, sizeof(value)) != NULL
+                       ? strtoull(value, NULL, 10) : r->stream;
+        int rc = ingest(r, off, body, raw_len);
+
+        if (rc > 0) {
+            free(raw);
+            snprintf(c->reply, sizeof(c->reply),
+                     "{\"error\": \"offset past the stored stream\", \"offset\": %llu}\n",
+                     (unsigned long long)r->stream);
+            respond(c, 409, c->reply);
+            return;
+        }
+        if (rc != 0) {
+            free(raw);
+            log_error("Cannot append to run: ", r->id);
+            respond(c, 500, "{\"error\": \"write failed\"}\n");
+            return;
+        }
+        free(raw);
+        snprintf(c->reply, sizeof(c->reply), "{\"offset\": %llu}\n",
+                 (unsigned long long)r->stream);
+        if (r->unsynced && sync_ns > 0) {
+            c->waiting = r;     /* group commit: answered after the sync pass */
+            return;
+        }
+        if (r->unsynced && fsync(r->fd) != 0) {
+            respond(c, 500, "{\"error\": \"fsync failed\"}\n");
+            return;
+        }
+        r->unsynced = 0;
+        respond(c, 200, c->reply);
+        return;
+    }
+
+    if (put_file(r, strcmp(kind, "meta") == 0 ? ".meta.json" : ".events", body, raw_len) != 0) {
+        free(raw);
+        log_error("Cannot write run file: ", r->id);
+        respond(c, 500, "{\"error\": \"write failed\"}\n");
+        return;
+    }
+    free(raw);
+    respond(c, 200, "{}\n");
+}
+
+static void read_client(struct client *c)
+{
+    ssize_t n;
+
+    if (c->len == c->cap) {
+        size_t cap = c->cap ? c->cap * 2 : 16384;
+        char *grown;
+
+        if (c->head_len > 0 && cap > c->head_len + c->body_len)
+            cap = c->head_len + c->body_len;
+        grown = realloc(c->buf, cap + 1);
+        if (grown == NULL) {
+            drop(c);
+            return;
+        }
+        c->buf = grown;
+        c->cap = cap;
+    }
+    n = recv(c->fd, c->buf + c->len, c->cap - c->len, MSG_DONTWAIT);
+    if (n <= 0) {
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+            drop(c);
+        return;
+    }
+    c->len += (size_t)n;
+    c->buf[c->len] = '\0';
+    c->seen_ns = now_ns();
+
+    if (c->head_len == 0) {
+        char *end = strstr(c->buf, "\r\n\r\n");
+        char value[32];
+
+        if (end == NULL) {
+            if (c->len >= AGG_HEAD_MAX)
+                respond(c, 400, "{\"error\": \"headers too large\"}\n");
+            return;
+        }
+        c->head_len = (size_t)(end - c->buf) + 4;
+        c->body_len = header(c, "Content-Length", value, sizeof(value)) != NULL
+                      ? strtoul(value, NULL, 10) : 0;
+        if (c->body_len > AGG_BODY_MAX) {
+            respond(c, 413, "{\"error\": \"batch too large\"}\n");
+            return;
+        }
+    }
+    if (c->len >= c->head_len + c->body_len)
+        handle(c);
+}
+
+static void accept_clients(int lfd)
+{
+    for (;;) {
+        int fd = accept(lfd, NULL, NULL);
+        int i;
+
+        if (fd < 0)
+            return;
+        for (i = 0; i < AGG_CLIENTS_MAX && clients[i].fd >= 0; i++)
+            ;
+        if (i == AGG_CLIENTS_MAX) {
+            close(fd);          /* the sampler retries later */
+            continue;
+        }
+        /* Accepted sockets inherit O_NONBLOCK on the BSDs but not on Linux */
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        clients[i].fd = fd;
+        clients[i].seen_ns = now_ns();
+    }
+}
+
+/*
+ * One fsync per run written to since the last pass, then the answers
+ * to the batches that pass made durable, then the summaries
+ */
+static void sync_pass(void)
+{
+    int64_t now = now_ns();
+    int i;
+
+    for (i = 0; i < AGG_RUNS_MAX; i++) {
+        struct run *r = &runs[i];
+
+        if (r->id[0] == '\0' || !r->unsynced)
+            continue;
+        r->sync_failed = fsync(r->fd) != 0;
+        if (r->sync_failed)
+            log_error("fsync failed for run: ", r->id);
+        r->unsynced = 0;
+    }
+    for (i = 0; i < AGG_CLIENTS_MAX; i++) {
+        struct client *c = &clients[i];
+
+        if (c->fd < 0)
+            continue;
+        if (c->out != NULL) {
+            if (now - c->seen_ns > AGG_CLIENT_IDLE_NS)
+                drop(c);        /* stopped reading its answer */
+        } else if (c->waiting != NULL) {
+            if (c->waiting->sync_failed)
+                respond(c, 500, "{\"error\": \"fsync failed\"}\n");
+            else
+                respond(c, 200, c->reply);
+        } else if (now - c->seen_ns > AGG_CLIENT_IDLE_NS) {
+            drop(c);
+        }
+    }
+    for (i = 0; i < AGG_RUNS_MAX; i++) {
+        struct run *r = &runs[i];
+
+        if (r->id[0] == '\0')
+            continue;
+        r->sync_failed = 0;
+        if (r->stale)
+            write_summary(r);
+        if (now - r->seen_ns > AGG_RUN_IDLE_NS)
+            run_evict(r);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    struct pollfd pfd[AGG_CLIENTS_MAX + 1];
+    int slot[AGG_CLIENTS_MAX + 1];
+    struct sigaction sa;
+    const char *listen_addr = "127.0.0.1:" PUSH_DEFAULT_PORT;
+    int64_t next_pass;
+    int lfd;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--listen") == 0 && i + 1 < argc) {
+            listen_addr = argv[++i];
+        } else if (strcmp(argv[i], "--token") == 0 && i + 1 < argc) {
+            token = argv[++i];
+        } else if (strcmp(argv[i], "--data") == 0 && i + 1 < argc) {
+            data_dir = argv[++i];
+        } else if (strcmp(argv[i], "--sync-every") == 0 && i + 1 < argc) {
+            char *end;
+            double s = strtod(argv[++i], &end);
+
+            if (end == argv[i] || s < 0 || (*end != '\0' && strcmp(end, "s") != 0)) {
+                log_error("Invalid --sync-every value: ", argv[i]);
+                return 1;
+            }
+            sync_ns = (int64_t)(s * 1e9);
+        } else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            usage(stdout);
+            return 0;
+        } else if (strcmp(argv[i], "--version") == 0 || strcmp(argv[i], "-v") == 0) {
+            printf("%s %s\n", PROGRAM_NAME, VERSION);
+            return 0;
+        } else {
+            log_error("Unknown option: ", argv[i]);
+            usage(stderr);
+            return 1;
+        }
+    }
+
+    if (token == NULL)
+        token = getenv("BATLAB_TOKEN");
+    if (token != NULL && *token == '\0')
+        token = NULL;
+    if (token != NULL && strlen(token) >= PUSH_TOKEN_MAX) {
+        log_error("Token too long", NULL);
+        return 1;
+    }
+
+    if (mkdir(data_dir, 0755) != 0 && errno != EEXIST) {
+        log_error("Cannot create run store: ", data_dir);
+        return 1;
+    }
+    lfd = listen_on(listen_addr);
+    if (lfd < 0) {
+        log_error("Cannot listen on: ", listen_addr);
+        return 1;
+    }
+    for (i = 0; i < AGG_CLIENTS_MAX; i++)
+        clients[i].fd = -1;
+    for (i = 0; i < AGG_RUNS_MAX; i++)
+        runs[i].fd = -1;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_stop;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    fprintf(stderr, "%s: listening on %s%s, storing runs in %s\n", PROGRAM_NAME, listen_addr,
+            token != NULL ? " (token required)" : "", data_dir);
+
+    /* Summaries and idle connections are seen to at least once a second */
+    next_pass = now_ns() + (sync_ns > 0 ? sync_ns : 1000000000LL);
+    while (!stop_requested) {
+        int64_t left = next_pass - now_ns();
+        int nfds = 0;
+
+        pfd[nfds].fd = lfd;
+        pfd[nfds].events = POLLIN;
+        slot[nfds++] = -1;
+        for (i = 0; i < AGG_CLIENTS_MAX; i++) {
+            if (clients[i].fd >= 0 && clients[i].waiting == NULL) {
+                pfd[nfds].fd = clients[i].fd;
+                pfd[nfds].events = clients[i].out != NULL ? POLLOUT : POLLIN;
+                slot[nfds++] = i;
+            }
+        }
+
+        if (left > 0 && poll(pfd, (nfds_t)nfds, (int)(left / 1000000) + 1) > 0) {
+            for (i = 1; i < nfds; i++) {
+                struct client *c = &clients[slot[i]];
+
+                if (c->out != NULL && (pfd[i].revents & (POLLOUT | POLLHUP | POLLERR)))
+                    write_client(c);
+                else if (pfd[i].revents & (POLLIN | POLLHUP | POLLERR))
+                    read_client(c);
+            }
+            if (pfd[0].revents & POLLIN)
+                accept_clients(lfd);
+        }
+        if (now_ns() >= next_pass) {
+            sync_pass();
+            next_pass = now_ns() + (sync_ns > 0 ? sync_ns : 1000000000LL);
+        }
+    }
+
+    /* Acknowledge what has arrived and leave every summary current */
+    sync_pass();
+    for (i = 0; i < AGG_RUNS_MAX; i++)
+        if (runs[i].id[0] != '\0')
+            run_evict(&runs[i]);
+    for (i = 0; i < AGG_CLIENTS_MAX; i++)
+        if (clients[i].fd >= 0)
+            drop(&clients[i]);
+    close(lfd);
+    return 0;
+}
@@ -0,0 +1,644 @@
+/*
+ * attrib.c - Per-component and per-process power attribution
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "attrib.h"
+
+#if defined(__FreeBSD__)
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/sysctl.h>
+#include <sys/user.h>
+#include <sys/cpuctl.h>
+#endif
+
+#define POWERCAP_DIR "/sys/class/powercap"
+
+/* Command names go into JSON unescaped: keep them to printable ASCII */
+static void copy_comm(char *dst, const char *src, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i + 1 < ATTRIB_COMM_LEN && i < n && src[i] != '\0'; i++) {
+        unsigned char c = (unsigned char)src[i];
+
+        dst[i] = (c < 0x20 || c > 0x7e || c == '"' || c == '\\') ? '?' : (char)c;
+    }
+    dst[i] = '\0';
+}
+
+static struct attrib_proc *proc_slot(struct attrib_proc *table, int pid)
+{
+    unsigned i = ((unsigned)pid * 2654435761u) & (ATTRIB_PROCS_MAX - 1);
+
+    while (table[i].pid != 0 && table[i].pid != pid)
+        i = (i + 1) & (ATTRIB_PROCS_MAX - 1);
+    return &table[i];
+}
+
+static struct attrib_comm *find_comm(struct attrib *a, const char *comm)
+{
+    int i;
+
+    for (i = 0; i < a->ncomms; i++)
+        if (strcmp(a->comms[i].comm, comm) == 0)
+            return &a->comms[i];
+    if (a->ncomms < ATTRIB_COMMS_MAX - 1) {
+        copy_comm(a->comms[a->ncomms].comm, comm, ATTRIB_COMM_LEN);
+        return &a->comms[a->ncomms++];
+    }
+    /* The last slot collects everything past the table */
+    if (a->ncomms == ATTRIB_COMMS_MAX - 1) {
+        strcpy(a->comms[a->ncomms].comm, "(other)");
+        a->ncomms++;
+    }
+    return &a->comms[ATTRIB_COMMS_MAX - 1];
+}
+
+static void fold_proc(struct attrib *a, const struct attrib_proc *p)
+{
+    struct attrib_comm *c;
+
+    if (p->run_cpu_s <= 0.0 && p->run_j <= 0.0)
+        return;
+    c = find_comm(a, p->comm);
+    c->cpu_s += p->run_cpu_s;
+    c->j += p->run_j;
+}
+
+/* Record a process's cumulative CPU time as read at now_ns */
+static void proc_update(struct attrib *a, int pid, const char *comm, size_t comm_len,
+                        double cpu_s, int64_t now_ns)
+{
+    struct attrib_proc *p;
+
+    if (pid <= 0)
+        return;
+    p = proc_slot(a->procs, pid);
+    if (p->pid == 0) {
+        /* Keep the table at most three quarters full */
+        if (a->nprocs >= ATTRIB_PROCS_MAX / 4 * 3)
+            return;
+        memset(p, 0, sizeof(*p));
+        p->pid = pid;
+        p->cpu_s = cpu_s;
+        p->read_ns = now_ns;
+        a->nprocs++;
+    } else if (now_ns > p->read_ns) {
+        double d = cpu_s > p->cpu_s ? cpu_s - p->cpu_s : 0.0;
+
+        p->rate = d / ((double)(now_ns - p->read_ns) / 1e9);
+        p->run_cpu_s += d;
+        p->cpu_s = cpu_s;
+        p->read_ns = now_ns;
+    }
+    copy_comm(p->comm, comm, comm_len);
+    p->cycle = a->cycle;
+}
+
+/* End of a walk over every process: drop the ones that have exited */
+static void proc_sweep(struct attrib *a)
+{
+    unsigned i;
+
+    memcpy(a->spare, a->procs, sizeof(*a->procs) * ATTRIB_PROCS_MAX);
+    memset(a->procs, 0, sizeof(*a->procs) * ATTRIB_PROCS_MAX);
+    a->nprocs = 0;
+    for (i = 0; i < ATTRIB_PROCS_MAX; i++) {
+        const struct attrib_proc *p = &a->spare[i];
+
+        if (p->pid == 0)
+            continue;
+        if (p->cycle != a->cycle) {
+            fold_proc(a, p);
+            continue;
+        }
+        *proc_slot(a->procs, p->pid) = *p;
+        a->nprocs++;
+    }
+    a->cycle++;
+}
+
+static void add_domain(struct attrib *a, const char *name, int fd, int msr, double range_j)
+{
+    struct attrib_domain *d;
+
+    if (a->ndomains >= ATTRIB_DOMAINS_MAX)
+        return;
+    d = &a->domains[a->ndomains++];
+    memset(d, 0, sizeof(*d));
+    snprintf(d->name, sizeof(d->name), "%.15s", name);
+    d->fd = fd;
+    d->msr = msr;
+    d->range_j = range_j;
+    if (a->basis < 0 && strncmp(name, "package", 7) == 0)
+        a->basis = a->ndomains - 1;
+}
+
+#if defined(__linux__)
+
+static int read_small(int fd, char *buf, size_t len)
+{
+    ssize_t n = pread(fd, buf, len - 1, 0);
+
+    if (n <= 0)
+        return -1;
+    buf[n] = '\0';
+    return 0;
+}
+
+static int read_attr(const char *dir, const char *name, char *buf, size_t len)
+{
+    char path[512];
+    int fd, rc;
+
+    snprintf(path, sizeof(path), "%s/%s/%s", POWERCAP_DIR, dir, name);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    rc = read_small(fd, buf, len);
+    close(fd);
+    return rc;
+}
+
+static int cmp_names(const void *x, const void *y)
+{
+    return strcmp((const char *)x, (const char *)y);
+}
+
+/* intel-rapl:P is package P, intel-rapl:P:M its core, uncore or dram */
+static void open_domains(struct attrib *a)
+{
+    char dirs[ATTRIB_DOMAINS_MAX * 2][32];
+    struct dirent *ent;
+    DIR *d = opendir(POWERCAP_DIR);
+    int n = 0, i;
+
+    if (d == NULL)
+        return;
+    while ((ent = readdir(d)) != NULL && n < ATTRIB_DOMAINS_MAX * 2) {
+        if (strncmp(ent->d_name, "intel-rapl:", 11) == 0 &&
+            strlen(ent->d_name) < sizeof(dirs[0]))
+            strcpy(dirs[n++], ent->d_name);
+    }
+    closedir(d);
+    qsort(dirs, (size_t)n, sizeof(dirs[0]), cmp_names);
+
+    for (i = 0; i < n; i++) {
+        char name[32], label[32], buf[64], path[512];
+        const char *sub = strchr(dirs[i] + 11, ':');
+        double range = 0.0;
+        int fd;
+
+        if (read_attr(dirs[i], "name", name, sizeof(name)) != 0)
+            continue;
+        name[strcspn(name, "\n")] = '\0';
+        if (read_attr(dirs[i], "max_energy_range_uj", buf, sizeof(buf)) == 0)
+            range = strtod(buf, NULL) / 1e6;
+        snprintf(path, sizeof(path), "%s/%s/energy_uj", POWERCAP_DIR, dirs[i]);
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        /* energy_uj is root-only on kernels since 5.10 */
+        if (fd < 0 || read_small(fd, buf, sizeof(buf)) != 0) {
+            if (fd >= 0)
+                close(fd);
+            continue;
+        }
+        /* Subdomains of a second package get its number */
+        if (sub != NULL && atoi(dirs[i] + 11) > 0)
+            snprintf(label, sizeof(label), "%.16s-%d", name, atoi(dirs[i] + 11));
+        else
+            snprintf(label, sizeof(label), "%s", name);
+        add_domain(a, label, fd, 0, range);
+    }
+}
+
+static int read_domain(struct attrib *a, struct attrib_domain *d, double *j)
+{
+    char buf[64];
+
+    (void)a;
+    if (read_small(d->fd, buf, sizeof(buf)) != 0)
+        return -1;
+    *j = strtod(buf, NULL) / 1e6;
+    return 0;
+}
+
+static int open_procs(struct attrib *a)
+{
+    long tck = sysconf(_SC_CLK_TCK);
+
+    a->tick_s = tck > 0 ? 1.0 / (double)tck : 0.01;
+    a->scan = opendir("/proc");
+    if (a->scan == NULL)
+        return -1;
+    a->method = "/proc/PID/stat";
+    return 0;
+}
+
+/* utime + stime of one process, from the fields after its (comm) */
+static void read_proc(struct attrib *a, int pid, int64_t now_ns)
+{
+    char path[64], buf[1024];
+    unsigned long utime, stime;
+    const char *open_paren, *close_paren;
+    ssize_t n;
+    int fd;
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return;
+    n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0)
+        return;
+    buf[n] = '\0';
+
+    open_paren = strchr(buf, '(');
+    close_paren = strrchr(buf, ')');
+    if (open_paren == NULL || close_paren == NULL || close_paren < open_paren)
+        return;
+    if (sscanf(close_paren + 1, " %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+               &utime, &stime) != 2)
+        return;
+    proc_update(a, pid, open_paren + 1, (size_t)(close_paren - open_paren - 1),
+                (double)(utime + stime) * a->tick_s, now_ns);
+}
+
+/* Continue the /proc walk for up to ATTRIB_PROC_BUDGET processes */
+static void read_procs(struct attrib *a, int64_t now_ns)
+{
+    DIR *d = a->scan;
+    struct dirent *ent;
+    int reads = 0;
+
+    while (reads < ATTRIB_PROC_BUDGET) {
+        char *end;
+        long pid;
+
+        ent = readdir(d);
+        if (ent == NULL) {
+            proc_sweep(a);
+            rewinddir(d);
+            break;
+        }
+        pid = strtol(ent->d_name, &end, 10);
+        if (*end != '\0' || pid <= 0)
+            continue;
+        read_proc(a, (int)pid, now_ns);
+        reads++;
+    }
+}
+
+static void close_platform(struct attrib *a)
+{
+    int i;
+
+    for (i = 0; i < a->ndomains; i++)
+        if (a->domains[i].fd >= 0)
+            close(a->domains[i].fd);
+    if (a->scan != NULL)
+        closedir(a->scan);
+    a->scan = NULL;
+}
+
+#elif defined(__FreeBSD__)
+
+#define MSR_RAPL_POWER_UNIT     0x606
+#define MSR_PKG_ENERGY_STATUS   0x611
+#define MSR_DRAM_ENERGY_STATUS  0x619
+#define MSR_PP0_ENERGY_STATUS   0x639
+#define MSR_PP1_ENERGY_STATUS   0x641
+#define MSR_AMD_RAPL_POWER_UNIT 0xc0010299
+#define MSR_AMD_PKG_ENERGY      0xc001029b
+
+static int read_msr(int fd, int msr, uint64_t *value)
+{
+    cpuctl_msr_args_t args;
+
+    args.msr = msr;
+    args.data = 0;
+    if (ioctl(fd, CPUCTL_RDMSR, &args) != 0)
+        return -1;
+    *value = args.data;
+    return 0;
+}
+
+/* Package 0's energy status MSRs, through cpuctl(4) on CPU 0 */
+static void open_domains(struct attrib *a)
+{
+    static const struct { int msr; const char *name; } intel[] = {
+        { MSR_PKG_ENERGY_STATUS, "package-0" },
+        { MSR_PP0_ENERGY_STATUS, "core" },
+        { MSR_PP1_ENERGY_STATUS, "uncore" },
+        { MSR_DRAM_ENERGY_STATUS, "dram" }
+    };
+    uint64_t unit, value;
+    size_t i;
+    int fd = open("/dev/cpuctl0", O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0)
+        return;
+    if (read_msr(fd, MSR_RAPL_POWER_UNIT, &unit) == 0) {
+        a->energy_unit_j = 1.0 / (double)(1ULL << ((unit >> 8) & 0x1f));
+        for (i = 0; i < sizeof(intel) / sizeof(intel[0]); i++)
+            if (read_msr(fd, intel[i].msr, &value) == 0)
+                add_domain(a, intel[i].name, -1, intel[i].msr, 4294967296.0 * a->energy_unit_j);
+    } else if (read_msr(fd, (int)MSR_AMD_RAPL_POWER_UNIT, &unit) == 0) {
+        a->energy_unit_j = 1.0 / (double)(1ULL << ((unit >> 8) & 0x1f));
+        if (read_msr(fd, (int)MSR_AMD_PKG_ENERGY, &value) == 0)
+            add_domain(a, "package-0", -1, (int)MSR_AMD_PKG_ENERGY,
+                       4294967296.0 * a->energy_unit_j);
+    }
+    /* The device is shared by every domain; the first one owns it */
+    if (a->ndomains > 0)
+        a->domains[0].fd = fd;
+    else
+        close(fd);
+}
+
+static int read_domain(struct attrib *a, struct attrib_domain *d, double *j)
+{
+    uint64_t value;
+
+    if (read_msr(a->domains[0].fd, d->msr, &value) != 0)
+        return -1;
+    *j = (double)(value & 0xffffffffULL) * a->energy_unit_j;
+    return 0;
+}
+
+static int open_procs(struct attrib *a)
+{
+    int mib[3] = { CTL_KERN, KERN_PROC, KERN_PROC_PROC };
+    size_t len = 0;
+
+    if (sysctl(mib, 3, NULL, &len, NULL, 0) != 0)
+        return -1;
+    a->kbuf_len = len * 2;
+    a->kbuf = malloc(a->kbuf_len);
+    if (a->kbuf == NULL)
+        return -1;
+    a->method = "kern.proc.proc";
+    return 0;
+}
+
+/* The whole process table in one sysctl; ki_runtime is in microseconds */
+static void read_procs(struct attrib *a, int64_t now_ns)
+{
+    int mib[3] = { CTL_KERN, KERN_PROC, KERN_PROC_PROC };
+    const struct kinfo_proc *kp;
+    size_t len = a->kbuf_len, i;
+
+    if (sysctl(mib, 3, a->kbuf, &len, NULL, 0) != 0) {
+        if (errno == ENOMEM) {
+            void *grown = realloc(a->kbuf, a->kbuf_len * 2);
+
+            if (grown != NULL) {
+                a->kbuf = grown;
+                a->kbuf_len *= 2;
+            }
+        }
+        return;
+    }
+    kp = a->kbuf;
+    for (i = 0; i < len / sizeof(*kp); i++)
+        proc_update(a, kp[i].ki_pid, kp[i].ki_comm, sizeof(kp[i].ki_comm),
+                    (double)kp[i].ki_runtime / 1e6, now_ns);
+    proc_sweep(a);
+}
+
+static void close_platform(struct attrib *a)
+{
+    if (a->ndomains > 0 && a->domains[0].fd >= 0)
+        close(a->domains[0].fd);
+    free(a->kbuf);
+    a->kbuf = NULL;
+}
+
+#else
+
+static void open_domains(struct attrib *a)
+{
+    (void)a;
+}
+
+static int read_domain(struct attrib *a, struct attrib_domain *d, double *j)
+{
+    (void)a;
+    (void)d;
+    (void)j;
+    return -1;
+}
+
+static int open_procs(struct attrib *a)
+{
+    (void)a;
+    return -1;
+}
+
+static void read_procs(struct attrib *a, int64_t now_ns)
+{
+    (void)a;
+    (void)now_ns;
+}
+
+static void close_platform(struct attrib *a)
+{
+    (void)a;
+}
+
+#endif
+
+int attrib_open(struct attrib *a, int top)
+{
+    long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+
+    memset(a, 0, sizeof(*a));
+    a->top = top;
+    a->ncpu = ncpu > 0 ? (double)ncpu : 1.0;
+    a->basis = -1;
+    open_domains(a);
+
+    if (top > 0) {
+        a->procs = calloc(ATTRIB_PROCS_MAX, sizeof(*a->procs));
+        a->spare = calloc(ATTRIB_PROCS_MAX, sizeof(*a->spare));
+        if (a->procs == NULL || a->spare == NULL || open_procs(a) != 0) {
+            free(a->procs);
+            free(a->spare);
+            a->procs = a->spare = NULL;
+            a->top = 0;
+        }
+    }
+    if (a->ndomains == 0 && a->top == 0) {
+        attrib_close(a);
+        return -1;
+    }
+    return 0;
+}
+
+void attrib_read(struct attrib *a, const struct sample *s, int64_t mono_ns)
+{
+    double dt = a->samples > 0 && mono_ns > a->last_ns ?
+                (double)(mono_ns - a->last_ns) / 1e9 : 0.0;
+    unsigned i;
+    int k;
+
+    for (k = 0; k < a->ndomains; k++) {
+        struct attrib_domain *d = &a->domains[k];
+        double j, delta;
+
+        if (read_domain(a, d, &j) != 0)
+            continue;
+        if (d->primed && dt > 0.0) {
+            delta = j >= d->last_j ? j - d->last_j : d->range_j - d->last_j + j;
+            d->watts = delta / dt;
+            d->total_j += delta;
+        }
+        d->last_j = j;
+        d->primed = 1;
+    }
+    a->basis_watts = a->basis >= 0 ? a->domains[a->basis].watts : s->watts;
+
+    if (a->top > 0) {
+        read_procs(a, mono_ns);
+
+        /* Split the interval's energy by each process's share of the
+         * CPUs; rates read a few intervals apart can overshoot them */
+        a->busy = 0.0;
+        for (i = 0; i < ATTRIB_PROCS_MAX; i++)
+            if (a->procs[i].pid != 0)
+                a->busy += a->procs[i].rate;
+        if (dt > 0.0) {
+            double capacity = a->busy > a->ncpu ? a->busy : a->ncpu;
+
+            for (i = 0; i < ATTRIB_PROCS_MAX; i++)
+                if (a->procs[i].pid != 0 && a->procs[i].rate > 0.0)
+                    a->procs[i].run_j += a->basis_watts * dt * a->procs[i].rate / capacity;
+            a->idle_j += a->basis_watts * dt * (1.0 - a->busy / capacity);
+        }
+    }
+
+    if (a->samples++ == 0)
+        a->first_ns = mono_ns;
+    a->last_ns = mono_ns;
+}
+
+/* Indexes of the n busiest tracked processes, busiest first */
+static int top_procs(const struct attrib *a, unsigned *idx, int n)
+{
+    int found = 0, k;
+    unsigned i;
+
+    for (i = 0; i < ATTRIB_PROCS_MAX; i++) {
+        const struct attrib_proc *p = &a->procs[i];
+
+        if (p->pid == 0 || p->rate <= 0.0)
+            continue;
+        if (found == n && p->rate <= a->procs[idx[n - 1]].rate)
+            continue;
+        k = found < n ? found++ : n - 1;
+        for (; k > 0 && a->procs[idx[k - 1]].rate < p->rate; k--)
+            idx[k] = idx[k - 1];
+        idx[k] = i;
+    }
+    return found;
+}
+
+#define APPEND(...)                                                     \
+    do {                                                                \
+        if (n >= 0 && (size_t)n < len)                                  \
+            n += snprintf(buf + n, len - (size_t)n, __VA_ARGS__);       \
+    } while (0)
+
+int attrib_format(const struct attrib *a, char *buf, size_t len)
+{
+    unsigned idx[ATTRIB_TOP_MAX];
+    int n = 0, k, found;
+
+    if (a->ndomains > 0 && a->samples > 1) {
+        APPEND(", \"rapl\": {");
+        for (k = 0; k < a->ndomains; k++)
+            APPEND("%s\"%s\": %.3f", k > 0 ? ", " : "", a->domains[k].name, a->domains[k].watts);
+        APPEND("}");
+    }
+    if (a->top > 0) {
+        found = top_procs(a, idx, a->top);
+        APPEND(", \"top\": [");
+        for (k = 0; k < found; k++) {
+            const struct attrib_proc *p = &a->procs[idx[k]];
+
+            APPEND("%s{\"pid\": %d, \"comm\": \"%s\", \"cpu\": %.1f, \"w\": %.3f}",
+                   k > 0 ? ", " : "", p->pid, p->comm, 100.0 * p->rate,
+                   a->basis_watts * p->rate / (a->busy > a->ncpu ? a->busy : a->ncpu));
+        }
+        APPEND("]");
+    }
+    return n;
+}
+
+static int cmp_comms(const void *x, const void *y)
+{
+    const struct attrib_comm *a = x, *b = y;
+
+    if (a->j != b->j)
+        return a->j < b->j ? 1 : -1;
+    if (a->cpu_s != b->cpu_s)
+        return a->cpu_s < b->cpu_s ? 1 : -1;
+    return strcmp(a->comm, b->comm);
+}
+
+void attrib_write_stats(struct attrib *a, FILE *f)
+{
+    double elapsed = (double)(a->last_ns - a->first_ns) / 1e9;
+    unsigned i;
+    int k;
+
+    /* Fold the processes still running into the run totals */
+    if (a->procs != NULL) {
+        for (i = 0; i < ATTRIB_PROCS_MAX; i++)
+            if (a->procs[i].pid != 0)
+                fold_proc(a, &a->procs[i]);
+        memset(a->procs, 0, sizeof(*a->procs) * ATTRIB_PROCS_MAX);
+        a->nprocs = 0;
+    }
+    qsort(a->comms, (size_t)a->ncomms, sizeof(a->comms[0]), cmp_comms);
+
+    fprintf(f, "attribution {\"basis\": \"%s\", ",
+            a->basis >= 0 ? a->domains[a->basis].name : "battery");
+    if (a->method != NULL)
+        fprintf(f, "\"process_probe\": \"%s\", ", a->method);
+    else
+        fprintf(f, "\"process_probe\": null, ");
+    fprintf(f, "\"domains\": {");
+    for (k = 0; k < a->ndomains; k++)
+        fprintf(f, "%s\"%s\": {\"avg_watts\": %.3f, \"energy_wh\": %.5f}", k > 0 ? ", " : "",
+                a->domains[k].name, elapsed > 0.0 ? a->domains[k].total_j / elapsed : 0.0,
+                a->domains[k].total_j / 3600.0);
+    fprintf(f, "}, \"top\": [");
+    for (k = 0; k < a->ncomms && k < ATTRIB_TOP_MAX * 2; k++)
+        fprintf(f, "%s{\"comm\": \"%s\", \"cpu_s\": %.2f, \"energy_wh\": %.5f}", k > 0 ? ", " : "",
+                a->comms[k].comm, a->comms[k].cpu_s, a->comms[k].j / 3600.0);
+    fprintf(f, "], \"idle_wh\": %.5f}\n", a->idle_j / 3600.0);
+}
+
+void attrib_close(struct attrib *a)
+{
+    close_platform(a);
+    free(a->procs);
+    free(a->spare);
+    a->procs = a->spare = NULL;
+    a->ndomains = 0;
+    a->top = 0;
+}
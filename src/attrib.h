@@ -0,0 +1,104 @@
+/*
+ * attrib.h - Per-component and per-process power attribution
+ *
+ * An optional batlab-sampler extension (--attribute N) that splits the
+ * laptop-wide watts into where they go:
+ *
+ *   RAPL domains   package, core, uncore, dram and psys power from the
+ *                  Linux powercap counters, or the package, PP0, PP1 and
+ *                  DRAM energy MSRs through cpuctl(4) on FreeBSD
+ *   processes      CPU time deltas per process, with each process's
+ *                  share of the package power (or of the battery watts
+ *                  when there is no RAPL), as the top N per interval.
+ *                  Shares are of the CPUs' whole capacity, so the power
+ *                  of an idle machine is kept apart as idle, not handed
+ *                  to whichever process happened to wake up
+ *
+ * Every sample costs a fixed number of syscalls: one read per RAPL
+ * domain, plus either one sysctl for the whole process table (FreeBSD)
+ * or at most ATTRIB_PROC_BUDGET /proc/PID/stat reads (Linux). Linux
+ * walks /proc round-robin across samples, so with more processes than
+ * the budget each one is re-read every few intervals and its rate is
+ * averaged over the interval it was actually measured over.
+ */
+
+#ifndef BATLAB_ATTRIB_H
+#define BATLAB_ATTRIB_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "probe.h"
+
+#define ATTRIB_TOP_MAX      5       /* keeps a sample within WRITER_LINE_MAX */
+#define ATTRIB_DOMAINS_MAX  6
+#define ATTRIB_PROC_BUDGET  64      /* /proc/PID/stat reads per sample */
+#define ATTRIB_PROCS_MAX    2048    /* tracked processes, a power of two */
+#define ATTRIB_COMMS_MAX    256     /* run totals, by command name */
+#define ATTRIB_COMM_LEN     16
+
+struct attrib_domain {
+    char name[16];              /* "package-0", "core", "dram", ... */
+    int fd;                     /* sysfs energy_uj, or cpuctl device */
+    int msr;                    /* FreeBSD energy status MSR */
+    double range_j;             /* counter wraps after this many joules */
+    double last_j;
+    double watts;
+    double total_j;
+    int primed;
+};
+
+struct attrib_proc {
+    int pid;                    /* 0: free slot */
+    char comm[ATTRIB_COMM_LEN];
+    double cpu_s;               /* cumulative CPU time as last read */
+    int64_t read_ns;
+    double rate;                /* CPU seconds per second, last interval */
+    double run_cpu_s;           /* this run's CPU time and energy share */
+    double run_j;
+    unsigned cycle;             /* last /proc walk the process was seen in */
+};
+
+struct attrib_comm {
+    char comm[ATTRIB_COMM_LEN];
+    double cpu_s;
+    double j;
+};
+
+struct attrib {
+    int top;                    /* processes per sample, 0 disables */
+    int ndomains;
+    struct attrib_domain domains[ATTRIB_DOMAINS_MAX];
+    int basis;                  /* domain the process shares split, -1: battery */
+    double energy_unit_j;       /* FreeBSD MSR energy unit */
+    uint64_t samples;
+    int64_t first_ns;
+    int64_t last_ns;
+    double basis_watts;
+    double busy;                /* summed process rates, CPUs busy */
+    double ncpu;
+    double idle_j;              /* power not taken by any process */
+    double tick_s;              /* Linux clock tick */
+    struct attrib_proc *procs;
+    struct attrib_proc *spare;  /* rebuilt into at the end of each walk */
+    unsigned nprocs;
+    unsigned cycle;
+    void *scan;                 /* Linux: open /proc directory */
+    void *kbuf;                 /* FreeBSD: kinfo_proc buffer */
+    size_t kbuf_len;
+    struct attrib_comm comms[ATTRIB_COMMS_MAX];
+    int ncomms;
+    const char *method;         /* process probe, for the stats line */
+};
+
+/* Resolve the RAPL domains and process probe; -1 if neither exists */
+int attrib_open(struct attrib *a, int top);
+void attrib_read(struct attrib *a, const struct sample *s, int64_t mono_ns);
+/* Append ", \"rapl\": {...}, \"top\": [...]" to a JSONL record */
+int attrib_format(const struct attrib *a, char *buf, size_t len);
+/* Write the run totals as an "attribution {json}" stats line */
+void attrib_write_stats(struct attrib *a, FILE *f);
+void attrib_close(struct attrib *a);
+
+#endif /* BATLAB_ATTRIB_H */
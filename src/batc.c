@@ -0,0 +1,479 @@
+/*
+ * batc.c - Compact columnar run format (.batc)
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "batc.h"
+
+static const struct {
+    const char *name;
+    enum batc_type type;
+    int scale;
+    int optional;               /* added after version 1 files existed */
+} column_spec[BATC_NCOLS] = {
+    { "t",        BATC_I32, -3, 0 },    /* millisecond deltas */
+    { "pct",      BATC_U16, -2, 0 },
+    { "watts",    BATC_I32, -3, 0 },
+    { "cpu_load", BATC_U16, -2, 0 },
+    { "ram_pct",  BATC_U16, -2, 0 },
+    { "temp_c",   BATC_I16, -2, 0 },
+    { "src",      BATC_U8,   0, 0 },    /* index into the src dictionary */
+    { "cpu_pct",  BATC_U16, -2, 1 }
+};
+
+static size_t type_width(enum batc_type type)
+{
+    switch (type) {
+    case BATC_I32: return 4;
+    case BATC_U16:
+    case BATC_I16: return 2;
+    case BATC_U8:  return 1;
+    case BATC_ZONES: break;
+    }
+    return 0;
+}
+
+static uint64_t le_get(const unsigned char *p, size_t n)
+{
+    uint64_t v = 0;
+
+    while (n-- > 0)
+        v = (v << 8) | p[n];
+    return v;
+}
+
+static void le_put(unsigned char *p, uint64_t v, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++, v >>= 8)
+        p[i] = (unsigned char)(v & 0xff);
+}
+
+static size_t align8(size_t n)
+{
+    return (n + 7) & ~(size_t)7;
+}
+
+/* int64 words per zone map block: the base, then min and max per column */
+static size_t zone_words(unsigned ncols)
+{
+    return 1 + 2 * (size_t)ncols;
+}
+
+int batc_open(struct batc *b, const char *path)
+{
+    struct stat st;
+    const unsigned char *p;
+    size_t dict_off, dict_len, off;
+    unsigned ncols, i, j;
+    int fd;
+
+    memset(b, 0, sizeof(*b));
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) != 0 || st.st_size < BATC_HEADER_SIZE) {
+        close(fd);
+        errno = EINVAL;
+        return -1;
+    }
+    b->map_len = (size_t)st.st_size;
+    b->map = mmap(NULL, b->map_len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (b->map == MAP_FAILED) {
+        b->map = NULL;
+        return -1;
+    }
+
+    p = b->map;
+    ncols = (unsigned)le_get(p + 6, 2);
+    if (memcmp(p, BATC_MAGIC, 4) != 0 || le_get(p + 4, 2) != BATC_VERSION)
+        goto invalid;
+    b->nrows = le_get(p + 8, 8);
+    b->t0_ns = (int64_t)le_get(p + 16, 8);
+    b->meta_len = (uint32_t)le_get(p + 24, 4);
+    dict_len = (size_t)le_get(p + 28, 4);
+
+    off = BATC_HEADER_SIZE + (size_t)ncols * BATC_DIRENT_SIZE;
+    if (off + b->meta_len + dict_len > b->map_len)
+        goto invalid;
+    b->meta = (const char *)p + off;
+    dict_off = off + b->meta_len;
+
+    if (dict_len > 0) {
+        const unsigned char *d = p + dict_off;
+        const unsigned char *dend = d + dict_len;
+
+        b->nsrc = *d++;
+        for (i = 0; i < b->nsrc; i++) {
+            size_t len, n;
+
+            if (d >= dend || d + 1 + *d > dend)
+                goto invalid;
+            len = *d++;
+            n = len < JSONL_SRC_MAX ? len : JSONL_SRC_MAX - 1;
+            memcpy(b->src[i], d, n);
+            b->src[i][n] = '\0';
+            d += len;
+        }
+    }
+
+    /* Columns are located by name, so later versions may append more */
+    for (i = 0; i < ncols; i++) {
+        const unsigned char *e = p + BATC_HEADER_SIZE + (size_t)i * BATC_DIRENT_SIZE;
+        uint64_t coff = le_get(e + 16, 8);
+        uint64_t clen = le_get(e + 24, 8);
+
+        if (strncmp((const char *)e, "zones", 12) == 0 && e[12] == BATC_ZONES) {
+            const unsigned char *z = p + coff;
+
+            if (coff > b->map_len || clen > b->map_len - coff || clen < 8)
+                goto invalid;
+            b->zone_rows = (unsigned)le_get(z, 4);
+            b->zone_cols = (unsigned)le_get(z + 4, 2);
+            if (b->zone_rows == 0 || b->zone_cols < BATC_NCOLS)
+                goto invalid;
+            b->nzones = (b->nrows + b->zone_rows - 1) / b->zone_rows;
+            if ((clen - 8) / 8 / zone_words(b->zone_cols) < b->nzones)
+                goto invalid;
+            b->zones = z + 8;
+            continue;
+        }
+
+        for (j = 0; j < BATC_NCOLS; j++) {
+            struct batc_column *c = &b->col[j];
+
+            if (strncmp((const char *)e, column_spec[j].name, 12) != 0)
+                continue;
+            if (e[12] != column_spec[j].type || coff > b->map_len ||
+                clen > b->map_len - coff ||
+                clen < b->nrows * type_width(column_spec[j].type))
+                goto invalid;
+            memcpy(c->name, e, 12);
+            c->name[12] = '\0';
+            c->type = (enum batc_type)e[12];
+            c->scale = (int16_t)le_get(e + 14, 2);
+            c->data = p + coff;
+            c->length = clen;
+        }
+    }
+    for (j = 0; j < BATC_NCOLS; j++)
+        if (b->col[j].data == NULL && b->nrows > 0 && !column_spec[j].optional)
+            goto invalid;
+
+    return 0;
+
+invalid:
+    batc_close(b);
+    errno = EINVAL;
+    return -1;
+}
+
+void batc_close(struct batc *b)
+{
+    if (b->map != NULL)
+        munmap(b->map, b->map_len);
+    b->map = NULL;
+}
+
+int batc_has(const struct batc *b, enum batc_col col)
+{
+    return b->col[col].data != NULL;
+}
+
+int64_t batc_raw(const struct batc *b, enum batc_col col, uint64_t row)
+{
+    const struct batc_column *c = &b->col[col];
+
+    switch (c->type) {
+    case BATC_I32: return (int32_t)(uint32_t)le_get(c->data + row * 4, 4);
+    case BATC_U16: return (int64_t)le_get(c->data + row * 2, 2);
+    case BATC_I16: return (int16_t)(uint16_t)le_get(c->data + row * 2, 2);
+    case BATC_U8:  return c->data[row];
+    case BATC_ZONES: break;
+    }
+    return 0;
+}
+
+double batc_value(const struct batc *b, enum batc_col col, uint64_t row)
+{
+    return batc_decode(b, col, batc_raw(b, col, row));
+}
+
+double batc_decode(const struct batc *b, enum batc_col col, int64_t raw)
+{
+    double v = (double)raw;
+    double p = 1.0;
+    int e = b->col[col].scale;
+
+    /* Divide by an exact power of ten so the result is the double nearest
+     * the stored decimal, the same value strtod gives for the JSONL text */
+    for (; e < 0; e++)
+        p *= 10.0;
+    for (; e > 0; e--)
+        v *= 10.0;
+    return v / p;
+}
+
+int batc_zone(const struct batc *b, uint64_t z, enum batc_col col, int64_t *min, int64_t *max)
+{
+    const unsigned char *e;
+
+    if (b->zones == NULL || z >= b->nzones)
+        return -1;
+    e = b->zones + (z * zone_words(b->zone_cols) + 1 + 2 * (size_t)col) * 8;
+    *min = (int64_t)le_get(e, 8);
+    *max = (int64_t)le_get(e + 8, 8);
+    return *min <= *max ? 0 : -1;
+}
+
+int64_t batc_zone_base(const struct batc *b, uint64_t z)
+{
+    if (b->zones == NULL || z >= b->nzones)
+        return 0;
+    return (int64_t)le_get(b->zones + z * zone_words(b->zone_cols) * 8, 8);
+}
+
+void batc_builder_init(struct batc_builder *bb)
+{
+    memset(bb, 0, sizeof(*bb));
+}
+
+/* Round to the column's fixed-point scale, saturating at the type's range */
+static int64_t encode(double v, int col)
+{
+    int e;
+    double lo, hi;
+
+    for (e = column_spec[col].scale; e < 0; e++)
+        v *= 10.0;
+    switch (column_spec[col].type) {
+    case BATC_I32: lo = -2147483648.0; hi = 2147483647.0; break;
+    case BATC_U16: lo = 0.0; hi = 65535.0; break;
+    case BATC_I16: lo = -32767.0; hi = 32767.0; break;
+    default:       lo = 0.0; hi = 255.0; break;
+    }
+    v = v < 0 ? v - 0.5 : v + 0.5;
+    if (v < lo)
+        v = lo;
+    if (v > hi)
+        v = hi;
+    return (int64_t)v;
+}
+
+static unsigned src_index(struct batc_builder *bb, const char *src)
+{
+    unsigned i;
+
+    for (i = 0; i < bb->nsrc; i++)
+        if (strcmp(bb->src[i], src) == 0)
+            return i;
+    if (bb->nsrc == BATC_SRC_MAX)
+        return 0;
+    strcpy(bb->src[bb->nsrc], src);
+    return bb->nsrc++;
+}
+
+int batc_builder_add(struct batc_builder *bb, const struct jsonl_row *row)
+{
+    int64_t ms, delta;
+    int64_t v[BATC_NCOLS];
+    int64_t *zone;
+    int c;
+
+    if (bb->nrows == bb->cap) {
+        uint64_t cap = bb->cap ? bb->cap * 2 : 4096;
+        int64_t *zones;
+
+        for (c = 0; c < BATC_NCOLS; c++) {
+            unsigned char *d = realloc(bb->data[c], cap * type_width(column_spec[c].type));
+
+            if (d == NULL)
+                return -1;
+            bb->data[c] = d;
+        }
+        /* cap stays a multiple of BATC_ZONE_ROWS */
+        zones = realloc(bb->zones, cap / BATC_ZONE_ROWS * zone_words(BATC_NCOLS) * sizeof(int64_t));
+        if (zones == NULL)
+            return -1;
+        bb->zones = zones;
+        bb->cap = cap;
+    }
+
+    if (bb->nrows == 0)
+        bb->t0_ns = row->t_ns;
+    ms = (row->t_ns - bb->t0_ns + (row->t_ns >= bb->t0_ns ? 500000 : -500000)) / 1000000;
+    delta = ms - bb->last_ms;
+    if (delta > INT32_MAX || delta < INT32_MIN) {
+        errno = ERANGE;
+        return -1;
+    }
+
+    zone = bb->zones + bb->nrows / BATC_ZONE_ROWS * zone_words(BATC_NCOLS);
+    if (bb->nrows % BATC_ZONE_ROWS == 0) {
+        zone[0] = bb->last_ms;
+        for (c = 0; c < BATC_NCOLS; c++) {
+            zone[1 + 2 * c] = INT64_MAX;
+            zone[2 + 2 * c] = INT64_MIN;
+        }
+    }
+    bb->last_ms = ms;
+
+    /* Stored integers, with the time column's zone range in absolute ms */
+    v[BATC_COL_T] = delta;
+    v[BATC_COL_PCT] = encode(row->pct, BATC_COL_PCT);
+    v[BATC_COL_WATTS] = encode(row->watts, BATC_COL_WATTS);
+    v[BATC_COL_CPU_LOAD] = encode(row->cpu_load, BATC_COL_CPU_LOAD);
+    v[BATC_COL_RAM_PCT] = encode(row->ram_pct, BATC_COL_RAM_PCT);
+    v[BATC_COL_TEMP_C] = row->has_temp ? encode(row->temp_c, BATC_COL_TEMP_C) : BATC_TEMP_NULL;
+    v[BATC_COL_SRC] = src_index(bb, row->src);
+    v[BATC_COL_CPU_PCT] = row->has_cpu_pct ? encode(row->cpu_pct, BATC_COL_CPU_PCT) : BATC_U16_NULL;
+    for (c = 0; c < BATC_NCOLS; c++) {
+        int64_t zv = c == BATC_COL_T ? ms : v[c];
+
+        le_put(bb->data[c] + bb->nrows * type_width(column_spec[c].type), (uint64_t)v[c],
+               type_width(column_spec[c].type));
+        if ((c == BATC_COL_TEMP_C && !row->has_temp) || (c == BATC_COL_CPU_PCT && !row->has_cpu_pct))
+            continue;
+        if (zv < zone[1 + 2 * c])
+            zone[1 + 2 * c] = zv;
+        if (zv > zone[2 + 2 * c])
+            zone[2 + 2 * c] = zv;
+    }
+
+    bb->nrows++;
+    return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int batc_builder_write(const struct batc_builder *bb, const char *meta,
+                       size_t meta_len, int fd)
+{
+    static const unsigned char zeros[8];
+    unsigned char *head, *zones;
+    size_t dict_len = 1;
+    uint64_t nzones = (bb->nrows + BATC_ZONE_ROWS - 1) / BATC_ZONE_ROWS;
+    size_t zones_len = 8 + (size_t)nzones * zone_words(BATC_NCOLS) * 8;
+    size_t head_len, off, pad, k;
+    unsigned i;
+    int c, rc = -1;
+
+    for (i = 0; i < bb->nsrc; i++)
+        dict_len += 1 + strlen(bb->src[i]);
+
+    off = BATC_HEADER_SIZE + (BATC_NCOLS + 1) * BATC_DIRENT_SIZE;
+    head_len = align8(off + meta_len + dict_len);
+    head = calloc(1, head_len);
+    zones = malloc(zones_len);
+    if (head == NULL || zones == NULL) {
+        free(head);
+        free(zones);
+        return -1;
+    }
+
+    memcpy(head, BATC_MAGIC, 4);
+    le_put(head + 4, BATC_VERSION, 2);
+    le_put(head + 6, BATC_NCOLS + 1, 2);
+    le_put(head + 8, bb->nrows, 8);
+    le_put(head + 16, (uint64_t)bb->t0_ns, 8);
+    le_put(head + 24, meta_len, 4);
+    le_put(head + 28, dict_len, 4);
+
+    memcpy(head + off, meta, meta_len);
+    off += meta_len;
+    head[off++] = (unsigned char)bb->nsrc;
+    for (i = 0; i < bb->nsrc; i++) {
+        size_t n = strlen(bb->src[i]);
+
+        head[off++] = (unsigned char)n;
+        memcpy(head + off, bb->src[i], n);
+        off += n;
+    }
+
+    off = head_len;
+    for (c = 0; c < BATC_NCOLS; c++) {
+        unsigned char *e = head + BATC_HEADER_SIZE + c * BATC_DIRENT_SIZE;
+        size_t len = bb->nrows * type_width(column_spec[c].type);
+
+        strncpy((char *)e, column_spec[c].name, 12);
+        e[12] = (unsigned char)column_spec[c].type;
+        le_put(e + 14, (uint64_t)(int64_t)column_spec[c].scale, 2);
+        le_put(e + 16, off, 8);
+        le_put(e + 24, len, 8);
+        off += align8(len);
+    }
+
+    /* The zone map follows the columns; older readers skip the entry */
+    {
+        unsigned char *e = head + BATC_HEADER_SIZE + BATC_NCOLS * BATC_DIRENT_SIZE;
+
+        strncpy((char *)e, "zones", 12);
+        e[12] = BATC_ZONES;
+        le_put(e + 16, off, 8);
+        le_put(e + 24, zones_len, 8);
+    }
+    le_put(zones, BATC_ZONE_ROWS, 4);
+    le_put(zones + 4, BATC_NCOLS, 2);
+    le_put(zones + 6, 0, 2);
+    for (k = 0; k < (size_t)nzones * zone_words(BATC_NCOLS); k++)
+        le_put(zones + 8 + k * 8, (uint64_t)bb->zones[k], 8);
+
+    if (write_all(fd, head, head_len) != 0)
+        goto out;
+    for (c = 0; c < BATC_NCOLS; c++) {
+        size_t len = bb->nrows * type_width(column_spec[c].type);
+
+        pad = align8(len) - len;
+        if ((len > 0 && write_all(fd, bb->data[c], len) != 0) ||
+            (pad > 0 && write_all(fd, zeros, pad) != 0))
+            goto out;
+    }
+    if (write_all(fd, zones, zones_len) != 0)
+        goto out;
+    rc = 0;
+
+out:
+    free(head);
+    free(zones);
+    return rc;
+}
+
+void batc_builder_free(struct batc_builder *bb)
+{
+    int c;
+
+    for (c = 0; c < BATC_NCOLS; c++)
+        free(bb->data[c]);
+    free(bb->zones);
+    memset(bb, 0, sizeof(*bb));
+}
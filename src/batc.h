@@ -0,0 +1,137 @@
+/*
+ * batc.h - Compact columnar run format (.batc)
+ *
+ * A .batc file holds one run as fixed-width columns, so a reader can
+ * mmap it and scan a single metric without touching the others. All
+ * integers are little-endian.
+ *
+ *   offset  size  field
+ *   0       4     magic "BATC"
+ *   4       2     version (1)
+ *   6       2     column count
+ *   8       8     row count
+ *   16      8     t0, first sample in nanoseconds since the epoch
+ *   24      4     meta length (the run's .meta.json, verbatim)
+ *   28      4     src dictionary length
+ *   32      32*n  column directory: name[12], type u8, pad u8,
+ *                 scale i16 (value = raw * 10^scale), pad u32,
+ *                 offset u64, length u64
+ *   ...           meta JSON, src dictionary (u8 count, then u8 length
+ *                 + bytes per entry), column data, each 8-byte aligned
+ *
+ * Columns are stored as scaled integers at the precision the samplers
+ * write. "t" holds millisecond deltas from the previous sample; the
+ * first delta is relative to t0. A temp_c of BATC_TEMP_NULL is missing,
+ * as is a cpu_pct of BATC_U16_NULL; files written before the cpu_pct
+ * column existed have none, and read as missing throughout.
+ *
+ * A "zones" directory entry (type BATC_ZONES) adds a zone map: u32 rows
+ * per block, u16 column count, u16 pad, then per block of BATC_ZONE_ROWS
+ * rows an i64 base (milliseconds from t0 before the block's first delta)
+ * and an i64 min and max of each column's stored integers, missing
+ * values left out; for "t" they are milliseconds from t0. Readers may
+ * skip a block whose range cannot match a predicate, and resume the time
+ * column at the next block's base. Files without one are scanned whole.
+ */
+
+#ifndef BATLAB_BATC_H
+#define BATLAB_BATC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "jsonl.h"
+
+#define BATC_MAGIC          "BATC"
+#define BATC_VERSION        1
+#define BATC_HEADER_SIZE    32
+#define BATC_DIRENT_SIZE    32
+#define BATC_SRC_MAX        255
+#define BATC_TEMP_NULL      INT16_MIN
+#define BATC_U16_NULL       UINT16_MAX
+#define BATC_ZONE_ROWS      1024
+
+enum batc_type {
+    BATC_I32 = 1,
+    BATC_U16 = 2,
+    BATC_I16 = 3,
+    BATC_U8 = 4,
+    BATC_ZONES = 5          /* the zone map, not a column */
+};
+
+enum batc_col {
+    BATC_COL_T,
+    BATC_COL_PCT,
+    BATC_COL_WATTS,
+    BATC_COL_CPU_LOAD,
+    BATC_COL_RAM_PCT,
+    BATC_COL_TEMP_C,
+    BATC_COL_SRC,
+    BATC_COL_CPU_PCT,
+    BATC_NCOLS
+};
+
+struct batc_column {
+    char name[13];
+    enum batc_type type;
+    int scale;
+    const unsigned char *data;
+    uint64_t length;
+};
+
+/* Read-only view of a mapped .batc file */
+struct batc {
+    unsigned char *map;
+    size_t map_len;
+    uint64_t nrows;
+    int64_t t0_ns;
+    const char *meta;
+    uint32_t meta_len;
+    unsigned nsrc;
+    char src[BATC_SRC_MAX][JSONL_SRC_MAX];
+    struct batc_column col[BATC_NCOLS];
+    const unsigned char *zones; /* NULL without a zone map */
+    uint64_t nzones;
+    unsigned zone_rows;
+    unsigned zone_cols;
+};
+
+/* Accumulates rows for batc_builder_write() */
+struct batc_builder {
+    uint64_t nrows;
+    uint64_t cap;
+    int64_t t0_ns;
+    int64_t last_ms;
+    unsigned nsrc;
+    char src[BATC_SRC_MAX][JSONL_SRC_MAX];
+    unsigned char *data[BATC_NCOLS];
+    int64_t *zones;         /* base, then min and max per column, per block */
+};
+
+int batc_open(struct batc *b, const char *path);
+void batc_close(struct batc *b);
+
+/* Whether an optional column was stored at all */
+int batc_has(const struct batc *b, enum batc_col col);
+/* Stored integer of one cell, and the same cell decoded to its value */
+int64_t batc_raw(const struct batc *b, enum batc_col col, uint64_t row);
+double batc_value(const struct batc *b, enum batc_col col, uint64_t row);
+/* Decode a stored integer of a column to its value */
+double batc_decode(const struct batc *b, enum batc_col col, int64_t raw);
+
+/*
+ * Range of a column's stored integers in zone map block z, rows
+ * z * zone_rows onwards; -1 without a zone map or when every value in
+ * the block is missing. batc_zone_base is the time column's running sum
+ * before the block.
+ */
+int batc_zone(const struct batc *b, uint64_t z, enum batc_col col, int64_t *min, int64_t *max);
+int64_t batc_zone_base(const struct batc *b, uint64_t z);
+
+void batc_builder_init(struct batc_builder *bb);
+int batc_builder_add(struct batc_builder *bb, const struct jsonl_row *row);
+int batc_builder_write(const struct batc_builder *bb, const char *meta,
+                       size_t meta_len, int fd);
+void batc_builder_free(struct batc_builder *bb);
+
+#endif /* BATLAB_BATC_H */
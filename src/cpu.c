@@ -0,0 +1,423 @@
+/*
+ * cpu.c - Per-core utilization, frequency and C-state residency
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cpu.h"
+
+#if defined(__FreeBSD__)
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/sysctl.h>
+#endif
+
+/* Fold this sample's busy and total counters into the interval figures */
+static void note_times(struct cpu_probes *c, int idx, unsigned long long busy,
+                       unsigned long long total)
+{
+    if (c->primed && total > c->total[idx]) {
+        double pct = 100.0 * (double)(busy - c->busy[idx]) / (double)(total - c->total[idx]);
+
+        if (idx == c->ncores)
+            c->cpu_pct = pct;
+        else
+            c->core_pct[idx] = pct;
+    }
+    c->busy[idx] = busy;
+    c->total[idx] = total;
+}
+
+/* Cores without a frequency reading of their own share the last one's */
+static void fill_mhz(struct cpu_probes *c, const int *have)
+{
+    int i, last = -1;
+
+    for (i = 0; i < c->ncores; i++) {
+        if (have[i])
+            last = c->mhz[i];
+        else if (last >= 0)
+            c->mhz[i] = last;
+    }
+    c->have_mhz = last >= 0;
+}
+
+#if defined(__linux__)
+
+#define CPU_SYSFS "/sys/devices/system/cpu"
+
+static int open_path(const char *path)
+{
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+static int read_text(int fd, char *buf, size_t len)
+{
+    ssize_t n;
+
+    if (fd < 0)
+        return -1;
+    n = pread(fd, buf, len - 1, 0);
+    if (n <= 0)
+        return -1;
+    buf[n] = '\0';
+    return 0;
+}
+
+static int read_ulong(int fd, unsigned long long *v)
+{
+    char buf[32];
+    char *end;
+
+    if (read_text(fd, buf, sizeof(buf)) != 0)
+        return -1;
+    *v = strtoull(buf, &end, 10);
+    return end == buf ? -1 : 0;
+}
+
+int cpu_open(struct cpu_probes *c)
+{
+    char buf[16384], path[256];
+    const char *line;
+    int i, k;
+
+    memset(c, 0, sizeof(*c));
+    for (i = 0; i < CPU_CORES_MAX; i++) {
+        c->freq_fd[i] = -1;
+        for (k = 0; k < CPU_STATES_MAX; k++)
+            c->state_fd[i][k] = -1;
+    }
+
+    /* The cpuN lines come first, so a partial read still holds them all */
+    c->stat_fd = open_path("/proc/stat");
+    if (read_text(c->stat_fd, buf, sizeof(buf)) != 0) {
+        cpu_close(c);
+        return -1;
+    }
+    for (line = buf; strncmp(line, "cpu", 3) == 0; line = strchr(line, '\n') + 1) {
+        if (line[3] != ' ') {
+            int n = atoi(line + 3);
+
+            if (n < CPU_CORES_MAX && n + 1 > c->ncores)
+                c->ncores = n + 1;
+        }
+        if (strchr(line, '\n') == NULL)
+            break;
+    }
+    if (c->ncores == 0) {
+        cpu_close(c);
+        return -1;
+    }
+    c->util_probe = "/proc/stat";
+
+    for (i = 0; i < c->ncores; i++) {
+        snprintf(path, sizeof(path), CPU_SYSFS "/cpu%d/cpufreq/scaling_cur_freq", i);
+        c->freq_fd[i] = open_path(path);
+        if (c->freq_fd[i] >= 0)
+            c->freq_probe = "cpufreq/scaling_cur_freq";
+    }
+
+    /* Idle states are named after cpu0's; other cores have the same set */
+    for (k = 0; k < CPU_STATES_MAX; k++) {
+        char name[32];
+        int fd;
+
+        snprintf(path, sizeof(path), CPU_SYSFS "/cpu0/cpuidle/state%d/name", k);
+        fd = open_path(path);
+        if (fd < 0)
+            break;
+        if (read_text(fd, name, sizeof(name)) == 0) {
+            size_t j;
+
+            name[strcspn(name, "\n")] = '\0';
+            for (j = 0; name[j] != '\0'; j++)
+                if (name[j] == '"' || name[j] == '\\' || (unsigned char)name[j] < 0x20)
+                    name[j] = '?';
+            snprintf(c->state_name[k], sizeof(c->state_name[k]), "%.15s", name);
+        }
+        close(fd);
+        c->nstates = k + 1;
+    }
+    for (i = 0; i < c->ncores; i++) {
+        for (k = 0; k < c->nstates; k++) {
+            snprintf(path, sizeof(path), CPU_SYSFS "/cpu%d/cpuidle/state%d/time", i, k);
+            c->state_fd[i][k] = open_path(path);
+        }
+    }
+    if (c->nstates > 0)
+        c->cstate_probe = "cpuidle/stateN/time";
+    return 0;
+}
+
+static void read_times(struct cpu_probes *c)
+{
+    char buf[16384];
+    const char *line;
+
+    if (read_text(c->stat_fd, buf, sizeof(buf)) != 0)
+        return;
+
+    /* cpuN user nice system idle iowait irq softirq steal guest guest_nice;
+     * guest time is already counted in user */
+    for (line = buf; strncmp(line, "cpu", 3) == 0;) {
+        unsigned long long v[8] = { 0 }, total = 0;
+        const char *next = strchr(line, '\n');
+        char *p;
+        int idx, f;
+
+        if (line[3] == ' ') {
+            idx = c->ncores;
+            p = (char *)line + 3;
+        } else {
+            idx = (int)strtol(line + 3, &p, 10);
+        }
+        for (f = 0; f < 8; f++) {
+            v[f] = strtoull(p, &p, 10);
+            total += v[f];
+        }
+        /* Slot ncores holds the "cpu " total: only that line may use it */
+        if (line[3] == ' ' || (idx >= 0 && idx < c->ncores))
+            note_times(c, idx, total - v[3] - v[4], total);
+        if (next == NULL)
+            break;
+        line = next + 1;
+    }
+}
+
+static void read_freq(struct cpu_probes *c)
+{
+    int have[CPU_CORES_MAX] = { 0 };
+    unsigned long long khz;
+    int i;
+
+    for (i = 0; i < c->ncores; i++) {
+        if (read_ulong(c->freq_fd[i], &khz) == 0) {
+            c->mhz[i] = (int)(khz / 1000);
+            have[i] = 1;
+        }
+    }
+    fill_mhz(c, have);
+}
+
+static void read_states(struct cpu_probes *c, double dt_us)
+{
+    double us[CPU_STATES_MAX] = { 0 };
+    unsigned long long v;
+    int cores = 0, i, k;
+
+    for (i = 0; i < c->ncores; i++) {
+        int counted = 0;
+
+        for (k = 0; k < c->nstates; k++) {
+            if (read_ulong(c->state_fd[i][k], &v) == 0) {
+                us[k] += (double)v;
+                counted = 1;
+            }
+        }
+        cores += counted;
+    }
+    if (cores == 0)
+        return;
+    for (k = 0; k < c->nstates; k++) {
+        if (c->primed && dt_us > 0.0) {
+            double pct = 100.0 * (us[k] - c->state_us[k]) / (dt_us * cores);
+
+            c->state_pct[k] = pct < 0.0 ? 0.0 : pct > 100.0 ? 100.0 : pct;
+        }
+        c->state_us[k] = us[k];
+    }
+    c->have_states = c->primed;
+}
+
+void cpu_close(struct cpu_probes *c)
+{
+    int i, k;
+
+    if (c->stat_fd >= 0)
+        close(c->stat_fd);
+    c->stat_fd = -1;
+    for (i = 0; i < CPU_CORES_MAX; i++) {
+        if (c->freq_fd[i] >= 0)
+            close(c->freq_fd[i]);
+        c->freq_fd[i] = -1;
+        for (k = 0; k < CPU_STATES_MAX; k++) {
+            if (c->state_fd[i][k] >= 0)
+                close(c->state_fd[i][k]);
+            c->state_fd[i][k] = -1;
+        }
+    }
+}
+
+#elif defined(__FreeBSD__)
+
+int cpu_open(struct cpu_probes *c)
+{
+    size_t len = PROBE_MIB_MAX, size = 0;
+    int i;
+
+    memset(c, 0, sizeof(*c));
+    c->times_len = len;
+    if (sysctlnametomib("kern.cp_times", c->times_mib, &c->times_len) != 0 ||
+        sysctl(c->times_mib, (u_int)c->times_len, NULL, &size, NULL, 0) != 0 ||
+        size < CPUSTATES * sizeof(long))
+        return -1;
+    c->times = malloc(size);
+    if (c->times == NULL)
+        return -1;
+    c->ncores = (int)(size / (CPUSTATES * sizeof(long)));
+    if (c->ncores > CPU_CORES_MAX)
+        c->ncores = CPU_CORES_MAX;
+    c->util_probe = "kern.cp_times";
+
+    /* cpufreq attaches per frequency domain, often to cpu0 alone */
+    for (i = 0; i < c->ncores; i++) {
+        char name[32];
+
+        snprintf(name, sizeof(name), "dev.cpu.%d.freq", i);
+        c->freq_len[i] = PROBE_MIB_MAX;
+        if (sysctlnametomib(name, c->freq_mib[i], &c->freq_len[i]) != 0)
+            c->freq_len[i] = 0;
+        else
+            c->freq_probe = "dev.cpu.N.freq";
+    }
+    /* acpi_cpu counts C-state entries but not time in them: no residency */
+    return 0;
+}
+
+static void read_times(struct cpu_probes *c)
+{
+    size_t size = (size_t)c->ncores * CPUSTATES * sizeof(long);
+    size_t got = size;
+    unsigned long long all_busy = 0, all_total = 0;
+    int i, s;
+
+    /* ENOMEM only means more CPUs than were kept: the first ones fit */
+    if (sysctl(c->times_mib, (u_int)c->times_len, c->times, &got, NULL, 0) != 0 && got < size)
+        return;
+    for (i = 0; i < c->ncores; i++) {
+        unsigned long long total = 0;
+        const long *t = c->times + (size_t)i * CPUSTATES;
+
+        for (s = 0; s < CPUSTATES; s++)
+            total += (unsigned long)t[s];
+        note_times(c, i, total - (unsigned long)t[CP_IDLE], total);
+        all_busy += total - (unsigned long)t[CP_IDLE];
+        all_total += total;
+    }
+    note_times(c, c->ncores, all_busy, all_total);
+}
+
+static void read_freq(struct cpu_probes *c)
+{
+    int have[CPU_CORES_MAX] = { 0 };
+    int i;
+
+    for (i = 0; i < c->ncores; i++) {
+        size_t size = sizeof(int);
+        int mhz;
+
+        if (c->freq_len[i] > 0 &&
+            sysctl(c->freq_mib[i], (u_int)c->freq_len[i], &mhz, &size, NULL, 0) == 0) {
+            c->mhz[i] = mhz;
+            have[i] = 1;
+        }
+    }
+    fill_mhz(c, have);
+}
+
+static void read_states(struct cpu_probes *c, double dt_us)
+{
+    (void)c;
+    (void)dt_us;
+}
+
+void cpu_close(struct cpu_probes *c)
+{
+    free(c->times);
+    c->times = NULL;
+}
+
+#else
+
+int cpu_open(struct cpu_probes *c)
+{
+    memset(c, 0, sizeof(*c));
+    return -1;
+}
+
+static void read_times(struct cpu_probes *c)
+{
+    (void)c;
+}
+
+static void read_freq(struct cpu_probes *c)
+{
+    (void)c;
+}
+
+static void read_states(struct cpu_probes *c, double dt_us)
+{
+    (void)c;
+    (void)dt_us;
+}
+
+void cpu_close(struct cpu_probes *c)
+{
+    (void)c;
+}
+
+#endif
+
+void cpu_read(struct cpu_probes *c, struct sample *s, int64_t mono_ns)
+{
+    double dt_us = c->primed ? (double)(mono_ns - c->last_ns) / 1e3 : 0.0;
+
+    read_times(c);
+    read_freq(c);
+    if (c->nstates > 0)
+        read_states(c, dt_us);
+    c->valid = c->primed;
+    c->primed = 1;
+    c->last_ns = mono_ns;
+    if (c->valid)
+        s->cpu_pct = c->cpu_pct;
+}
+
+#define APPEND(...)                                                     \
+    do {                                                                \
+        if (n >= 0 && (size_t)n < len)                                  \
+            n += snprintf(buf + n, len - (size_t)n, __VA_ARGS__);       \
+    } while (0)
+
+int cpu_format(const struct cpu_probes *c, char *buf, size_t len)
+{
+    int n = 0, i;
+
+    if (c->valid) {
+        APPEND(", \"cpu_pct\": %.1f, \"core_pct\": [", c->cpu_pct);
+        for (i = 0; i < c->ncores; i++)
+            APPEND("%s%.0f", i > 0 ? "," : "", c->core_pct[i]);
+        APPEND("]");
+    }
+    if (c->have_mhz) {
+        APPEND(", \"core_mhz\": [");
+        for (i = 0; i < c->ncores; i++)
+            APPEND("%s%d", i > 0 ? "," : "", c->mhz[i]);
+        APPEND("]");
+    }
+    if (c->valid && c->have_states) {
+        APPEND(", \"cstate_pct\": {");
+        for (i = 0; i < c->nstates; i++)
+            APPEND("%s\"%s\": %.1f", i > 0 ? ", " : "", c->state_name[i], c->state_pct[i]);
+        APPEND("}");
+    }
+    return n;
+}
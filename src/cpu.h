@@ -0,0 +1,76 @@
+/*
+ * cpu.h - Per-core utilization, frequency and C-state residency
+ *
+ * The load average the shell collectors report lags a minute behind
+ * the power draw. These probes measure each interval instead, from
+ * counter deltas between samples:
+ *
+ *   utilization  /proc/stat (Linux) or kern.cp_times (FreeBSD), busy
+ *                time over total time, per core and overall
+ *   frequency    cpufreq scaling_cur_freq (Linux) or dev.cpu.N.freq
+ *                (FreeBSD); cores sharing a frequency domain with no
+ *                reading of their own repeat the domain's value
+ *   C-states     cpuidle stateK/time (Linux): the share of the cores'
+ *                time spent in each idle state
+ *
+ * Like the other probes, every file and MIB is resolved once and kept
+ * open, so a sample costs one read of /proc/stat or one sysctl, plus one
+ * pread per core for frequency and per core and state for C-states.
+ */
+
+#ifndef BATLAB_CPU_H
+#define BATLAB_CPU_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "probe.h"
+
+#define CPU_CORES_MAX   64
+#define CPU_STATES_MAX  8
+
+struct cpu_probes {
+    int ncores;
+#if defined(__linux__)
+    int stat_fd;
+    int freq_fd[CPU_CORES_MAX];
+    int state_fd[CPU_CORES_MAX][CPU_STATES_MAX];
+#elif defined(__FreeBSD__)
+    int times_mib[PROBE_MIB_MAX];
+    size_t times_len;
+    long *times;
+    int freq_mib[CPU_CORES_MAX][PROBE_MIB_MAX];
+    size_t freq_len[CPU_CORES_MAX];
+#endif
+    int nstates;
+    char state_name[CPU_STATES_MAX][16];
+
+    /* Counters as of the previous sample; index ncores is the total */
+    unsigned long long busy[CPU_CORES_MAX + 1];
+    unsigned long long total[CPU_CORES_MAX + 1];
+    double state_us[CPU_STATES_MAX];
+    int64_t last_ns;
+    int primed;
+
+    /* Latest interval */
+    int valid;                  /* utilization needs two samples */
+    double cpu_pct;
+    double core_pct[CPU_CORES_MAX];
+    int mhz[CPU_CORES_MAX];
+    int have_mhz;
+    double state_pct[CPU_STATES_MAX];
+    int have_states;
+
+    const char *util_probe;
+    const char *freq_probe;
+    const char *cstate_probe;
+};
+
+int cpu_open(struct cpu_probes *c);
+/* Read the counters and set s->cpu_pct once an interval has passed */
+void cpu_read(struct cpu_probes *c, struct sample *s, int64_t mono_ns);
+/* Append ", \"core_pct\": [...], \"core_mhz\": [...], ..." to a record */
+int cpu_format(const struct cpu_probes *c, char *buf, size_t len);
+void cpu_close(struct cpu_probes *c);
+
+#endif /* BATLAB_CPU_H */
@@ -0,0 +1,523 @@
+/*
+ * batlab-data - Native run data tools for batlab
+ *
+ * Converts JSONL runs to the compact columnar .batc format (see batc.h)
+ * and reads either format back for the report pipeline:
+ *
+ *   batlab-data convert RUN.jsonl     write RUN.batc next to it
+ *   batlab-data table RUN             hours pct watts cpu temp rows,
+ *                                     as lib/batlab-table.awk prints
+ *   batlab-data stats RUN             key:value summary, as
+ *                                     lib/batlab-stats.awk prints
+ *   batlab-data info RUN.batc         header, columns and metadata
+ *   batlab-data index RUN.jsonl       write the RUN.idx time index
+ *   batlab-data query Q RUN.batc...   aggregate across runs (see query.h)
+ *
+ * table and stats take --from/--to windows; JSONL runs with a .idx
+ * sidecar (see tindex.h) are read from the indexed sample just before
+ * the window instead of from the top.
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "batc.h"
+#include "jsonl.h"
+#include "query.h"
+#include "stats.h"
+#include "tindex.h"
+
+#define PROGRAM_NAME "batlab-data"
+#define VERSION "2.0.0"
+
+typedef void (*row_fn)(const struct stats_row *r, void *ctx);
+
+/* A --from/--to time window, resolved against the run start */
+struct window {
+    const char *from;       /* ISO 8601 or +N[smh] from the run start */
+    const char *to;
+    int64_t from_ns;
+    int64_t to_ns;
+};
+
+static void usage(FILE *out)
+{
+    fprintf(out,
+        "%s %s - Native run data tools for batlab\n"
+        "\n"
+        "USAGE:\n"
+        "    %s convert [--output FILE] RUN.jsonl\n"
+        "    %s table [--from T] [--to T] RUN.jsonl|RUN.batc\n"
+        "    %s stats [--from T] [--to T] RUN.jsonl|RUN.batc\n"
+        "    %s info RUN.batc\n"
+        "    %s index [--every N] RUN.jsonl\n"
+        "    %s query [--explain] QUERY RUN.batc...\n"
+        "\n"
+        "COMMANDS:\n"
+        "    convert   Write the run as a columnar .batc file (default: RUN.batc)\n"
+        "    table     Print the report table (hours pct watts cpu temp)\n"
+        "    stats     Print run statistics as key:value lines\n"
+        "    info      Describe a .batc file\n"
+        "    index     Write the RUN.idx time index for an existing run\n"
+        "    query     Aggregate samples across runs, e.g.\n"
+        "              \"avg(watts) where cpu_load > 2 and os like '%%freebsd%%' group by config\"\n"
+        "\n"
+        "Times are ISO 8601 (2025-09-12T06:00:00Z) or offsets from the run\n"
+        "start (+90s, +30m, +2h). Hours in the output count from the first\n"
+        "sample of the window.\n",
+        PROGRAM_NAME, VERSION, PROGRAM_NAME, PROGRAM_NAME, PROGRAM_NAME, PROGRAM_NAME,
+        PROGRAM_NAME, PROGRAM_NAME);
+}
+
+static void log_error(const char *msg, const char *arg)
+{
+    fprintf(stderr, "[ERROR] %s%s\n", msg, arg ? arg : "");
+}
+
+static int has_suffix(const char *s, const char *suffix)
+{
+    size_t n = strlen(s), m = strlen(suffix);
+
+    return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+/* Read a whole small file (the .meta.json) into memory */
+static char *slurp(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    char *buf = NULL;
+    size_t cap = 0;
+    size_t n;
+
+    *len = 0;
+    if (f == NULL)
+        return NULL;
+    do {
+        char *grown;
+
+        cap = cap ? cap * 2 : 4096;
+        grown = realloc(buf, cap);
+        if (grown == NULL) {
+            free(buf);
+            fclose(f);
+            return NULL;
+        }
+        buf = grown;
+        n = fread(buf + *len, 1, cap - *len, f);
+        *len += n;
+    } while (*len == cap);
+    fclose(f);
+    return buf;
+}
+
+/* Path of a run's sidecar: RUN.jsonl -> RUN<suffix> */
+static int sidecar(char *buf, size_t len, const char *path, const char *suffix)
+{
+    size_t base = has_suffix(path, ".jsonl") ? strlen(path) - 6 : strlen(path);
+
+    return snprintf(buf, len, "%.*s%s", (int)base, path, suffix) < (int)len ? 0 : -1;
+}
+
+/* Window bound: ISO 8601, or +N with an s, m or h suffix (default s) */
+static int parse_bound(const char *s, int64_t start_ns, int64_t *ns)
+{
+    char *end;
+    double n;
+
+    if (s[0] != '+')
+        return jsonl_parse_time(s, strlen(s), ns);
+    n = strtod(s + 1, &end);
+    if (end == s + 1 || n < 0)
+        return -1;
+    if (*end == 'm')
+        n *= 60;
+    else if (*end == 'h')
+        n *= 3600;
+    else if (*end != 's' && *end != '\0')
+        return -1;
+    if (*end != '\0' && end[1] != '\0')
+        return -1;
+    *ns = start_ns + (int64_t)(n * 1e9);
+    return 0;
+}
+
+static int resolve_window(struct window *w, int64_t start_ns)
+{
+    w->from_ns = INT64_MIN;
+    w->to_ns = INT64_MAX;
+    if (w->from != NULL && parse_bound(w->from, start_ns, &w->from_ns) != 0) {
+        log_error("Invalid --from time: ", w->from);
+        return -1;
+    }
+    if (w->to != NULL && parse_bound(w->to, start_ns, &w->to_ns) != 0) {
+        log_error("Invalid --to time: ", w->to);
+        return -1;
+    }
+    return 0;
+}
+
+struct jsonl_scan {
+    row_fn fn;
+    void *ctx;
+    const struct window *w;
+    int64_t t0;
+    int first;
+};
+
+static int jsonl_to_row(const struct jsonl_row *jr, void *ctx)
+{
+    struct jsonl_scan *js = ctx;
+    struct stats_row r;
+
+    if (jr->t_ns < js->w->from_ns)
+        return 0;
+    if (jr->t_ns > js->w->to_ns)
+        return 1;
+    if (js->first) {
+        js->t0 = jr->t_ns;
+        js->first = 0;
+    }
+    stats_row_from_jsonl(&r, jr, js->t0);
+    js->fn(&r, js->ctx);
+    return 0;
+}
+
+static int first_row(const struct jsonl_row *jr, void *ctx)
+{
+    *(int64_t *)ctx = jr->t_ns;
+    return 1;
+}
+
+static int scan_jsonl(const char *path, struct window *w, row_fn fn, void *ctx)
+{
+    struct jsonl_scan js;
+    uint64_t offset = 0;
+
+    if (w->from != NULL || w->to != NULL) {
+        int64_t start = 0;
+        char idx_path[4096];
+        struct stat st;
+
+        if (jsonl_scan_range(path, 0, first_row, &start) < 0)
+            return -1;
+        if (resolve_window(w, start) != 0)
+            return -1;
+        if (w->from != NULL && stat(path, &st) == 0 &&
+            sidecar(idx_path, sizeof(idx_path), path, ".idx") == 0)
+            offset = tindex_seek(idx_path, w->from_ns, (uint64_t)st.st_size);
+    } else {
+        resolve_window(w, 0);
+    }
+
+    js.fn = fn;
+    js.ctx = ctx;
+    js.w = w;
+    js.t0 = 0;
+    js.first = 1;
+    return jsonl_scan_range(path, offset, jsonl_to_row, &js) < 0 ? -1 : 0;
+}
+
+static int scan_batc(const char *path, struct window *w, row_fn fn, void *ctx)
+{
+    struct batc b;
+    int64_t ms = 0;
+    int64_t ms0 = -1;
+    uint64_t i;
+
+    if (batc_open(&b, path) != 0)
+        return -1;
+    if (resolve_window(w, b.t0_ns) != 0) {
+        batc_close(&b);
+        return -1;
+    }
+    for (i = 0; i < b.nrows; i++) {
+        struct stats_row r;
+        int64_t t_ns;
+
+        ms += batc_raw(&b, BATC_COL_T, i);
+        t_ns = b.t0_ns + ms * 1000000;
+        if (t_ns < w->from_ns)
+            continue;
+        if (t_ns > w->to_ns)
+            break;
+        if (ms0 < 0)
+            ms0 = ms;
+        r.hours = (double)(ms - ms0) / 3.6e6;
+        r.pct = batc_value(&b, BATC_COL_PCT, i);
+        r.watts = batc_value(&b, BATC_COL_WATTS, i);
+        r.cpu = batc_has(&b, BATC_COL_CPU_PCT) && batc_raw(&b, BATC_COL_CPU_PCT, i) != BATC_U16_NULL
+                ? batc_value(&b, BATC_COL_CPU_PCT, i)
+                : batc_value(&b, BATC_COL_CPU_LOAD, i) * 100;
+        r.temp = batc_raw(&b, BATC_COL_TEMP_C, i) == BATC_TEMP_NULL ? 0.0
+                 : batc_value(&b, BATC_COL_TEMP_C, i);
+        fn(&r, ctx);
+    }
+    batc_close(&b);
+    return 0;
+}
+
+static int scan(const char *path, struct window *w, row_fn fn, void *ctx)
+{
+    return has_suffix(path, ".batc") ? scan_batc(path, w, fn, ctx)
+                                     : scan_jsonl(path, w, fn, ctx);
+}
+
+static void print_row(const struct stats_row *r, void *ctx)
+{
+    char a[32], b[32], c[32], d[32];
+
+    (void)ctx;
+    printf("%.6f %s %s %s %s\n", r->hours, stats_num(a, sizeof(a), r->pct),
+           stats_num(b, sizeof(b), r->watts), stats_num(c, sizeof(c), r->cpu),
+           stats_num(d, sizeof(d), r->temp));
+}
+
+static void add_stats(const struct stats_row *r, void *ctx)
+{
+    stats_add(ctx, r);
+}
+
+static int cmd_stats(const char *path, struct window *w)
+{
+    static struct stats s;
+
+    stats_init(&s);
+    if (scan(path, w, add_stats, &s) != 0) {
+        log_error("Cannot read run: ", path);
+        return 1;
+    }
+    if (s.count == 0)
+        return 1;
+    stats_print(&s, stdout);
+    return 0;
+}
+
+static int cmd_table(const char *path, struct window *w)
+{
+    static char buf[1 << 16];
+
+    setvbuf(stdout, buf, _IOFBF, sizeof(buf));
+    printf("# hours pct watts cpu temp\n");
+    if (scan(path, w, print_row, NULL) != 0) {
+        log_error("Cannot read run: ", path);
+        return 1;
+    }
+    return fflush(stdout) == 0 ? 0 : 1;
+}
+
+static int add_to_builder(const struct jsonl_row *jr, void *ctx)
+{
+    return batc_builder_add(ctx, jr);
+}
+
+static int cmd_convert(const char *path, const char *output)
+{
+    struct batc_builder bb;
+    struct stat in_st, out_st;
+    char out_path[4096], tmp_path[4096], meta_path[4096];
+    size_t base = has_suffix(path, ".jsonl") ? strlen(path) - 6 : strlen(path);
+    char *meta;
+    size_t meta_len;
+    long long rows;
+    int fd, rc = 1;
+
+    if ((output == NULL &&
+         snprintf(out_path, sizeof(out_path), "%.*s.batc", (int)base, path) >= (int)sizeof(out_path)) ||
+        (output != NULL &&
+         snprintf(out_path, sizeof(out_path), "%s", output) >= (int)sizeof(out_path)) ||
+        snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", out_path) >= (int)sizeof(tmp_path) ||
+        snprintf(meta_path, sizeof(meta_path), "%.*s.meta.json", (int)base, path) >= (int)sizeof(meta_path)) {
+        log_error("Path too long: ", path);
+        return 1;
+    }
+
+    batc_builder_init(&bb);
+    errno = 0;
+    rows = jsonl_scan_file(path, add_to_builder, &bb);
+    if (rows < 0) {
+        log_error("Cannot open run: ", path);
+        goto out;
+    }
+    if ((uint64_t)rows != bb.nrows) {
+        log_error("Cannot encode sample: ", strerror(errno));
+        goto out;
+    }
+
+    meta = slurp(meta_path, &meta_len);
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        log_error("Cannot create output file: ", tmp_path);
+        free(meta);
+        goto out;
+    }
+    if (batc_builder_write(&bb, meta ? meta : "", meta_len, fd) != 0 || close(fd) != 0 ||
+        rename(tmp_path, out_path) != 0) {
+        log_error("Cannot write output file: ", out_path);
+        unlink(tmp_path);
+        free(meta);
+        goto out;
+    }
+    free(meta);
+
+    if (stat(path, &in_st) == 0 && stat(out_path, &out_st) == 0 && out_st.st_size > 0)
+        printf("%s: %llu samples, %lld -> %lld bytes (%.1fx smaller)\n", out_path,
+               (unsigned long long)bb.nrows, (long long)in_st.st_size,
+               (long long)out_st.st_size, (double)in_st.st_size / (double)out_st.st_size);
+    rc = 0;
+
+out:
+    batc_builder_free(&bb);
+    return rc;
+}
+
+static int cmd_info(const char *path)
+{
+    static const char *type_names[] = { "?", "i32", "u16", "i16", "u8" };
+    struct batc b;
+    int64_t ms = 0;
+    uint64_t i;
+    unsigned c;
+
+    if (batc_open(&b, path) != 0) {
+        log_error("Not a readable .batc file: ", path);
+        return 1;
+    }
+    for (i = 0; i < b.nrows; i++)
+        ms += batc_raw(&b, BATC_COL_T, i);
+
+    printf("format: batc %d\n", BATC_VERSION);
+    printf("samples: %llu\n", (unsigned long long)b.nrows);
+    printf("t0_ns: %lld\n", (long long)b.t0_ns);
+    printf("duration_s: %.3f\n", (double)ms / 1e3);
+    printf("sources:");
+    for (c = 0; c < b.nsrc; c++)
+        printf(" %s", b.src[c]);
+    printf("\n");
+    for (c = 0; c < BATC_NCOLS; c++)
+        if (batc_has(&b, (enum batc_col)c))
+            printf("column: %-9s %-4s scale 1e%d, %llu bytes\n", b.col[c].name,
+                   type_names[b.col[c].type], b.col[c].scale,
+                   (unsigned long long)b.col[c].length);
+    if (b.zones != NULL)
+        printf("zones: %llu blocks of %u rows\n", (unsigned long long)b.nzones, b.zone_rows);
+    printf("meta: %.*s\n", (int)b.meta_len, b.meta);
+    batc_close(&b);
+    return 0;
+}
+
+static int add_to_index(const struct jsonl_row *jr, void *ctx)
+{
+    tindex_note(ctx, jr->t_ns, jr->offset);
+    return 0;
+}
+
+static int cmd_index(const char *path, unsigned every)
+{
+    struct tindex_writer ix;
+    char idx_path[4096], tmp_path[4096];
+
+    if (sidecar(idx_path, sizeof(idx_path), path, ".idx") != 0 ||
+        sidecar(tmp_path, sizeof(tmp_path), path, ".idx.tmp") != 0) {
+        log_error("Path too long: ", path);
+        return 1;
+    }
+    unlink(tmp_path);
+    if (tindex_open(&ix, tmp_path, every) != 0) {
+        log_error("Cannot create output file: ", tmp_path);
+        return 1;
+    }
+    if (jsonl_scan_file(path, add_to_index, &ix) < 0) {
+        log_error("Cannot open run: ", path);
+        tindex_close(&ix);
+        unlink(tmp_path);
+        return 1;
+    }
+    if (tindex_close(&ix) != 0 || rename(tmp_path, idx_path) != 0) {
+        log_error("Cannot write output file: ", idx_path);
+        unlink(tmp_path);
+        return 1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    const char *cmd;
+    const char *output = NULL;
+    struct window w;
+    unsigned every = TINDEX_DEFAULT_EVERY;
+    int i = 2;
+
+    if (argc < 2) {
+        usage(stderr);
+        return 1;
+    }
+    cmd = argv[1];
+    if (strcmp(cmd, "--help") == 0 || strcmp(cmd, "-h") == 0) {
+        usage(stdout);
+        return 0;
+    }
+    if (strcmp(cmd, "--version") == 0 || strcmp(cmd, "-v") == 0) {
+        printf("%s %s\n", PROGRAM_NAME, VERSION);
+        return 0;
+    }
+
+    if (strcmp(cmd, "query") == 0) {
+        int explain = argc > 2 && strcmp(argv[2], "--explain") == 0;
+
+        if (argc < 3 + explain) {
+            usage(stderr);
+            return 1;
+        }
+        return query_run(argv[2 + explain], argv + 3 + explain, argc - 3 - explain, explain);
+    }
+
+    memset(&w, 0, sizeof(w));
+    for (; i + 1 < argc; i += 2) {
+        if (strcmp(cmd, "convert") == 0 && strcmp(argv[i], "--output") == 0) {
+            output = argv[i + 1];
+        } else if (strcmp(argv[i], "--from") == 0) {
+            w.from = argv[i + 1];
+        } else if (strcmp(argv[i], "--to") == 0) {
+            w.to = argv[i + 1];
+        } else if (strcmp(cmd, "index") == 0 && strcmp(argv[i], "--every") == 0) {
+            long n = strtol(argv[i + 1], NULL, 10);
+
+            if (n <= 0) {
+                log_error("Invalid --every value: ", argv[i + 1]);
+                return 1;
+            }
+            every = (unsigned)n;
+        } else {
+            break;
+        }
+    }
+    if (i + 1 != argc) {
+        usage(stderr);
+        return 1;
+    }
+
+    if (strcmp(cmd, "convert") == 0)
+        return cmd_convert(argv[i], output);
+    if (strcmp(cmd, "table") == 0)
+        return cmd_table(argv[i], &w);
+    if (strcmp(cmd, "stats") == 0)
+        return cmd_stats(argv[i], &w);
+    if (strcmp(cmd, "info") == 0)
+        return cmd_info(argv[i]);
+    if (strcmp(cmd, "index") == 0)
+        return cmd_index(argv[i], every);
+
+    log_error("Unknown command: ", cmd);
+    usage(stderr);
+    return 1;
+}
@@ -0,0 +1,44 @@
+/*
+ * energy.c - Energy accounting for batlab-sampler
+ */
+
+#include "energy.h"
+
+void energy_init(struct energy *e)
+{
+    e->count = 0;
+    e->last_ns = 0;
+    e->last_watts = 0.0;
+    e->integrated_j = 0.0;
+    e->battery_wh_first = e->battery_wh_last = -1.0;
+    e->battery_full_wh = -1.0;
+    e->rapl_j_first = e->rapl_j_last = -1.0;
+}
+
+void energy_add(struct energy *e, const struct sample *s, int64_t mono_ns)
+{
+    if (e->count > 0 && mono_ns > e->last_ns)
+        e->integrated_j += (e->last_watts + s->watts) / 2.0 *
+                           (double)(mono_ns - e->last_ns) / 1e9;
+    e->last_ns = mono_ns;
+    e->last_watts = s->watts;
+    e->count++;
+
+    if (s->battery_wh >= 0.0) {
+        if (e->battery_wh_first < 0.0)
+            e->battery_wh_first = s->battery_wh;
+        e->battery_wh_last = s->battery_wh;
+    }
+    if (s->battery_full_wh > 0.0)
+        e->battery_full_wh = s->battery_full_wh;
+    if (s->rapl_j >= 0.0) {
+        if (e->rapl_j_first < 0.0)
+            e->rapl_j_first = s->rapl_j;
+        e->rapl_j_last = s->rapl_j;
+    }
+}
+
+double energy_integrated_wh(const struct energy *e)
+{
+    return e->integrated_j / 3600.0;
+}
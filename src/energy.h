@@ -0,0 +1,35 @@
+/*
+ * energy.h - Energy accounting for batlab-sampler
+ *
+ * Integrates power over the real time between samples with the
+ * trapezoidal rule, on CLOCK_MONOTONIC, so a late or skipped sample
+ * weighs exactly as long as it lasted instead of counting as one
+ * average interval. Where the hardware keeps its own energy counters
+ * (the battery's remaining energy, RAPL), their first and last readings
+ * are kept too, so a run's energy can be checked against the meter.
+ */
+
+#ifndef BATLAB_ENERGY_H
+#define BATLAB_ENERGY_H
+
+#include <stdint.h>
+
+#include "probe.h"
+
+struct energy {
+    uint64_t count;
+    int64_t last_ns;
+    double last_watts;
+    double integrated_j;        /* trapezoidal sum of the sampled watts */
+    double battery_wh_first;    /* remaining battery energy, < 0 if unknown */
+    double battery_wh_last;
+    double battery_full_wh;
+    double rapl_j_first;        /* cumulative RAPL package energy, < 0 if none */
+    double rapl_j_last;
+};
+
+void energy_init(struct energy *e);
+void energy_add(struct energy *e, const struct sample *s, int64_t mono_ns);
+double energy_integrated_wh(const struct energy *e);
+
+#endif /* BATLAB_ENERGY_H */
@@ -0,0 +1,186 @@
+/*
+ * health.c - Self-instrumentation for batlab-sampler
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "health.h"
+
+static const char *const stage_names[HEALTH_STAGES] = {
+    "battery", "rapl", "load", "memory", "thermal", "cpu", "attrib", "write", "sample"
+};
+
+static const char *const fallback_names[PROBE_FALLBACKS] = {
+    "charge", "power", "load", "memory", "thermal"
+};
+
+void health_init(struct health *h, const struct sched *sc)
+{
+    unsigned i;
+
+    memset(h, 0, sizeof(*h));
+    h->start_ns = sched_now_ns();
+    h->published_ns = h->start_ns;
+    h->late_ns = (int64_t)((double)sc->period_ns * HEALTH_LATE_SHARE);
+    for (i = 0; i < HEALTH_STAGES; i++)
+        hist_init(&h->ns[i]);
+}
+
+void health_time(struct health *h, enum health_stage stage, int64_t ns)
+{
+    if (ns < 0)
+        ns = 0;
+    hist_add(&h->ns[stage], (uint64_t)ns);
+    if (stage == HEALTH_WRITE && ns > h->late_ns)
+        h->stalls++;
+}
+
+void health_probed(struct health *h, const struct probes *p, const struct sample *s,
+                   int64_t late_ns)
+{
+    unsigned i;
+
+    h->samples++;
+    if (late_ns > h->late_ns)
+        h->late++;
+    for (i = 0; i < PROBE_FALLBACKS; i++)
+        if (s->fallback & (1u << i))
+            h->fallbacks[i]++;
+    for (i = 0; i < PROBE_KINDS; i++)
+        if (p->read_ns[i] >= 0)
+            hist_add(&h->ns[i], (uint64_t)p->read_ns[i]);
+}
+
+int health_due(struct health *h, int64_t now_ns)
+{
+    if (now_ns - h->published_ns < HEALTH_EVERY_NS)
+        return 0;
+    h->published_ns = now_ns;
+    return 1;
+}
+
+/* snprintf onto the end of buf; *n goes past len once it overflows */
+static void put(char *buf, size_t len, int *n, const char *fmt, ...)
+{
+    va_list ap;
+    int w;
+
+    if (*n < 0 || (size_t)*n >= len)
+        return;
+    va_start(ap, fmt);
+    w = vsnprintf(buf + *n, len - (size_t)*n, fmt, ap);
+    va_end(ap);
+    *n = w < 0 ? -1 : *n + w;
+}
+
+int health_format(const struct health *h, const struct sched *sc, char *buf, size_t len,
+                  int pretty)
+{
+    const char *sep = pretty ? ",\n  " : ", ";
+    uint64_t deadlines = sc->fired + sc->skipped;
+    uint64_t fell = 0;
+    int slipped = sc->skipped + h->late > 0 &&
+                  (double)(sc->skipped + h->late) > HEALTH_MISS_SHARE * (double)deadlines;
+    const char *issue = "";
+    struct timespec ts;
+    struct tm tm;
+    char stamp[32];
+    unsigned i;
+    int n = 0;
+
+    for (i = 0; i < PROBE_FALLBACKS; i++)
+        fell += h->fallbacks[i];
+    clock_gettime(CLOCK_REALTIME, &ts);
+    gmtime_r(&ts.tv_sec, &tm);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%SZ", &tm);
+
+    put(buf, len, &n, "{%s\"updated\": \"%s\"%s\"uptime_s\": %.1f%s\"samples\": %llu%s",
+        pretty ? "\n  " : "", stamp, sep,
+        (double)(sched_now_ns() - h->start_ns) / 1e9, sep,
+        (unsigned long long)h->samples, sep);
+
+    put(buf, len, &n, "\"ok\": %s%s\"issues\": [",
+        slipped || fell > 0 || h->stalls > 0 ? "false" : "true", sep);
+    if (slipped) {
+        put(buf, len, &n, "\"deadline_misses\"");
+        issue = ", ";
+    }
+    if (fell > 0) {
+        put(buf, len, &n, "%s\"fallbacks\"", issue);
+        issue = ", ";
+    }
+    if (h->stalls > 0)
+        put(buf, len, &n, "%s\"write_stalls\"", issue);
+    put(buf, len, &n, "]%s", sep);
+
+    put(buf, len, &n,
+        "\"deadlines\": {\"fired\": %llu, \"missed\": %llu, \"late\": %llu, "
+        "\"late_after_us\": %.1f}%s",
+        (unsigned long long)sc->fired, (unsigned long long)sc->skipped,
+        (unsigned long long)h->late, (double)h->late_ns / 1e3, sep);
+
+    put(buf, len, &n, "\"fallbacks\": {");
+    for (i = 0; i < PROBE_FALLBACKS; i++)
+        put(buf, len, &n, "%s\"%s\": %llu", i > 0 ? ", " : "", fallback_names[i],
+            (unsigned long long)h->fallbacks[i]);
+    put(buf, len, &n, "}%s", sep);
+
+    put(buf, len, &n, "\"writes\": {\"stalls\": %llu, \"stall_after_us\": %.1f}%s",
+        (unsigned long long)h->stalls, (double)h->late_ns / 1e3, sep);
+
+    /* Stages that never ran (no RAPL, no --attribute) are left out */
+    put(buf, len, &n, "\"latency_us\": {");
+    issue = pretty ? "\n    " : "";
+    for (i = 0; i < HEALTH_STAGES; i++) {
+        const struct hist *t = &h->ns[i];
+
+        if (t->count == 0)
+            continue;
+        put(buf, len, &n, "%s\"%s\": {\"mean\": %.1f, \"p50\": %.1f, \"p99\": %.1f, \"max\": %.1f}",
+            issue, stage_names[i], hist_mean(t) / 1e3,
+            (double)hist_quantile(t, 0.50) / 1e3, (double)hist_quantile(t, 0.99) / 1e3,
+            (double)t->max / 1e3);
+        issue = pretty ? ",\n    " : ", ";
+    }
+    put(buf, len, &n, pretty ? "\n  }\n}\n" : "}}");
+
+    return n;
+}
+
+int health_publish(const char *path, const char *buf, size_t len)
+{
+    char tmp[1024];
+    FILE *f;
+
+    if (snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= (int)sizeof(tmp))
+        return -1;
+    f = fopen(tmp, "w");
+    if (f == NULL)
+        return -1;
+    if (fwrite(buf, 1, len, f) != len) {
+        fclose(f);
+        remove(tmp);
+        return -1;
+    }
+    if (fclose(f) != 0 || rename(tmp, path) != 0) {
+        remove(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+void health_write_stats(const struct health *h, const struct sched *sc, FILE *f)
+{
+    char buf[HEALTH_SNAPSHOT_MAX];
+    int n = health_format(h, sc, buf, sizeof(buf), 0);
+
+    if (n > 0 && (size_t)n < sizeof(buf))
+        fprintf(f, "health %s\n", buf);
+}
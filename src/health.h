@@ -0,0 +1,75 @@
+/*
+ * health.h - Self-instrumentation for batlab-sampler
+ *
+ * Counts what the harness itself did while logging: how long each probe
+ * took to read, each sample to write and the whole sample to take; how
+ * many deadlines were missed outright or woken for late; and how many
+ * readings fell back to the dummy values of probe.h. The sampler is a
+ * single thread that owns these counters, so they need no locks. Other
+ * processes see a snapshot the sampling loop rewrites about once a
+ * second, off the deadline: a file renamed into place, so a reader never
+ * sees half of one (batlab status reads it), and GET /health with
+ * --serve.
+ *
+ * The final counters go into the run's .meta.json as "health", with a
+ * verdict: a run whose deadlines slipped, whose probes fell back or
+ * whose writes stalled the loop is flagged, so it can be set aside
+ * rather than compared with runs the harness did not perturb.
+ */
+
+#ifndef BATLAB_HEALTH_H
+#define BATLAB_HEALTH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "hist.h"
+#include "probe.h"
+#include "sched.h"
+
+#define HEALTH_EVERY_NS     1000000000LL
+#define HEALTH_SNAPSHOT_MAX 4096
+
+/* A wake-up or a write more than this share of the period late stalls it */
+#define HEALTH_LATE_SHARE   0.10
+/* More missed or late deadlines than this share flags the run */
+#define HEALTH_MISS_SHARE   0.01
+
+/* Timed stages: the probes of probe.h, then the sampler's own */
+enum health_stage {
+    HEALTH_CPU = PROBE_KINDS,   /* cpu_read: utilization, frequency, C-states */
+    HEALTH_ATTRIB,              /* attrib_read: RAPL domains and processes */
+    HEALTH_WRITE,               /* one sample line appended, flushed or not */
+    HEALTH_SAMPLE,              /* wake-up to the sample written and served */
+    HEALTH_STAGES
+};
+
+struct health {
+    int64_t start_ns;
+    int64_t published_ns;
+    int64_t late_ns;            /* HEALTH_LATE_SHARE of the period */
+    uint64_t samples;
+    uint64_t late;
+    uint64_t stalls;
+    uint64_t fallbacks[PROBE_FALLBACKS];
+    struct hist ns[HEALTH_STAGES];
+};
+
+void health_init(struct health *h, const struct sched *sc);
+/* Note a sample woken late_ns after its deadline, and what its probes did */
+void health_probed(struct health *h, const struct probes *p, const struct sample *s,
+                   int64_t late_ns);
+void health_time(struct health *h, enum health_stage stage, int64_t ns);
+/* Whether a snapshot is due at now_ns; starts the next interval if so */
+int health_due(struct health *h, int64_t now_ns);
+
+/* Format the counters as JSON, one member per line if pretty; returns the length */
+int health_format(const struct health *h, const struct sched *sc, char *buf, size_t len,
+                  int pretty);
+/* Replace the snapshot at path with buf, atomically */
+int health_publish(const char *path, const char *buf, size_t len);
+/* Write the counters as a "health {json}" stats line */
+void health_write_stats(const struct health *h, const struct sched *sc, FILE *f);
+
+#endif /* BATLAB_HEALTH_H */
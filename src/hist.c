@@ -0,0 +1,77 @@
+/*
+ * hist.c - Fixed-size log-linear histogram for latency measurements
+ */
+
+#include <string.h>
+
+#include "hist.h"
+
+static int msb(uint64_t v)
+{
+    int n = 0;
+
+    while (v >>= 1)
+        n++;
+    return n;
+}
+
+static unsigned bucket_of(uint64_t v)
+{
+    int top;
+
+    if (v < HIST_SUB)
+        return (unsigned)v;
+    top = msb(v);
+    return (unsigned)((top - HIST_SUB_BITS + 1) * HIST_SUB +
+                      (int)((v >> (top - HIST_SUB_BITS)) & (HIST_SUB - 1)));
+}
+
+static uint64_t bucket_upper(unsigned idx)
+{
+    int top;
+    uint64_t sub, width;
+
+    if (idx < HIST_SUB)
+        return idx;
+    top = (int)(idx / HIST_SUB) + HIST_SUB_BITS - 1;
+    sub = idx % HIST_SUB;
+    width = (uint64_t)1 << (top - HIST_SUB_BITS);
+    return ((HIST_SUB + sub) << (top - HIST_SUB_BITS)) + width - 1;
+}
+
+void hist_init(struct hist *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+void hist_add(struct hist *h, uint64_t value)
+{
+    h->buckets[bucket_of(value)]++;
+    h->count++;
+    h->sum += (double)value;
+    if (value > h->max)
+        h->max = value;
+}
+
+double hist_mean(const struct hist *h)
+{
+    return h->count > 0 ? h->sum / (double)h->count : 0.0;
+}
+
+uint64_t hist_quantile(const struct hist *h, double q)
+{
+    uint64_t rank, seen = 0;
+    unsigned i;
+
+    if (h->count == 0)
+        return 0;
+    rank = (uint64_t)(q * (double)(h->count - 1)) + 1;
+    for (i = 0; i < HIST_BUCKETS; i++) {
+        seen += h->buckets[i];
+        if (seen >= rank) {
+            uint64_t upper = bucket_upper(i);
+            return upper < h->max ? upper : h->max;
+        }
+    }
+    return h->max;
+}
@@ -0,0 +1,30 @@
+/*
+ * hist.h - Fixed-size log-linear histogram for latency measurements
+ *
+ * Values are bucketed with 8 sub-buckets per power of two, so quantiles
+ * are exact below 8 and within 12.5% above it, in constant memory.
+ */
+
+#ifndef BATLAB_HIST_H
+#define BATLAB_HIST_H
+
+#include <stdint.h>
+
+#define HIST_SUB_BITS   3
+#define HIST_SUB        (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS    512
+
+struct hist {
+    uint64_t count;
+    uint64_t max;
+    double sum;
+    uint64_t buckets[HIST_BUCKETS];
+};
+
+void hist_init(struct hist *h);
+void hist_add(struct hist *h, uint64_t value);
+double hist_mean(const struct hist *h);
+/* Upper bound of the bucket holding quantile q (0.0 - 1.0) */
+uint64_t hist_quantile(const struct hist *h, double q);
+
+#endif /* BATLAB_HIST_H */
@@ -0,0 +1,331 @@
+/*
+ * jsonl.c - batlab JSONL record parser
+ *
+ * Delimiters are found with memchr(3), which the C libraries on our
+ * platforms implement with word-at-a-time or SIMD scanning, so lines
+ * and fields are located without a byte-by-byte loop in this file.
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "jsonl.h"
+
+/* Exact powers of ten; dividing an exact mantissa by one rounds correctly */
+static const double pow10_table[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+static int digits(const char *s, int n)
+{
+    int v = 0;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        if (s[i] < '0' || s[i] > '9')
+            return -1;
+        v = v * 10 + (s[i] - '0');
+    }
+    return v;
+}
+
+/* Days since 1970-01-01 for a proleptic Gregorian date */
+static int64_t days_from_civil(int64_t y, int m, int d)
+{
+    int64_t era;
+    int yoe, doy, doe;
+
+    y -= m <= 2;
+    era = (y >= 0 ? y : y - 399) / 400;
+    yoe = (int)(y - era * 400);
+    doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+int jsonl_parse_time(const char *s, size_t len, int64_t *ns)
+{
+    int y, mo, d, h, mi, sec;
+    int64_t frac = 0;
+    int64_t scale = 1000000000;
+    size_t i = 19;
+
+    if (len < 19 || s[4] != '-' || s[7] != '-' || s[10] != 'T' ||
+        s[13] != ':' || s[16] != ':')
+        return -1;
+
+    y = digits(s, 4);
+    mo = digits(s + 5, 2);
+    d = digits(s + 8, 2);
+    h = digits(s + 11, 2);
+    mi = digits(s + 14, 2);
+    sec = digits(s + 17, 2);
+    if (y < 0 || mo < 1 || mo > 12 || d < 1 || h < 0 || mi < 0 || sec < 0)
+        return -1;
+
+    if (i < len && s[i] == '.') {
+        for (i++; i < len && s[i] >= '0' && s[i] <= '9'; i++) {
+            if (scale > 1) {
+                scale /= 10;
+                frac += (s[i] - '0') * scale;
+            }
+        }
+    }
+
+    *ns = ((days_from_civil(y, mo, d) * 86400 + h * 3600 + mi * 60 + sec)
+           * 1000000000) + frac;
+
+    /* Numeric UTC offset, "+HH:MM" or "+HHMM" */
+    if (i + 5 <= len && (s[i] == '+' || s[i] == '-')) {
+        int oh = digits(s + i + 1, 2);
+        int om = digits(s + i + (s[i + 3] == ':' ? 4 : 3), 2);
+        int64_t off;
+
+        if (oh < 0 || om < 0)
+            return -1;
+        off = (int64_t)(oh * 3600 + om * 60) * 1000000000;
+        *ns += s[i] == '+' ? -off : off;
+    }
+    return 0;
+}
+
+/*
+ * Decimal number in [p, end). Returns -1 for an empty or null value.
+ * Up to 19 significant digits are accumulated exactly and scaled once,
+ * which agrees with strtod for every value the collectors write.
+ */
+static int parse_number(const char *p, const char *end, double *out)
+{
+    uint64_t mant = 0;
+    int exp10 = 0;
+    int ndig = 0;
+    int neg = 0;
+    double v;
+
+    if (p < end && (*p == '-' || *p == '+'))
+        neg = *p++ == '-';
+    for (; p < end && *p >= '0' && *p <= '9'; p++, ndig++) {
+        if (ndig < 19)
+            mant = mant * 10 + (uint64_t)(*p - '0');
+        else
+            exp10++;
+    }
+    if (p < end && *p == '.') {
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++, ndig++) {
+            if (ndig < 19) {
+                mant = mant * 10 + (uint64_t)(*p - '0');
+                exp10--;
+            }
+        }
+    }
+    if (ndig == 0)
+        return -1;
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        int eneg = 0;
+        int e = 0;
+
+        p++;
+        if (p < end && (*p == '-' || *p == '+'))
+            eneg = *p++ == '-';
+        for (; p < end && *p >= '0' && *p <= '9'; p++)
+            if (e < 1000)
+                e = e * 10 + (*p - '0');
+        exp10 += eneg ? -e : e;
+    }
+
+    v = (double)mant;
+    while (exp10 < -22) {
+        v /= 1e22;
+        exp10 += 22;
+    }
+    while (exp10 > 22) {
+        v *= 1e22;
+        exp10 -= 22;
+    }
+    v = exp10 < 0 ? v / pow10_table[-exp10] : v * pow10_table[exp10];
+    *out = neg ? -v : v;
+    return 0;
+}
+
+static int key_is(const char *k, size_t klen, const char *name)
+{
+    return strlen(name) == klen && memcmp(k, name, klen) == 0;
+}
+
+int jsonl_parse_row(const char *line, size_t len, struct jsonl_row *row)
+{
+    const char *p = line;
+    const char *end = line + len;
+    int have_t = 0;
+
+    memset(row, 0, sizeof(*row));
+
+    /* Walk "key": value pairs in order, so string values are never
+     * mistaken for keys */
+    while ((p = memchr(p, '"', (size_t)(end - p))) != NULL) {
+        const char *key = p + 1;
+        const char *kend = memchr(key, '"', (size_t)(end - key));
+        const char *v, *vend;
+        size_t klen;
+        double num;
+
+        if (kend == NULL)
+            break;
+        klen = (size_t)(kend - key);
+        p = kend + 1;
+        while (p < end && (*p == ' ' || *p == '\t'))
+            p++;
+        if (p >= end || *p != ':')
+            continue;
+        p++;
+        while (p < end && (*p == ' ' || *p == '\t'))
+            p++;
+
+        if (p < end && *p == '"') {
+            v = p + 1;
+            vend = memchr(v, '"', (size_t)(end - v));
+            if (vend == NULL)
+                break;
+            p = vend + 1;
+            if (key_is(key, klen, "t")) {
+                have_t = jsonl_parse_time(v, (size_t)(vend - v), &row->t_ns) == 0;
+            } else if (key_is(key, klen, "src")) {
+                size_t n = (size_t)(vend - v);
+
+                if (n >= JSONL_SRC_MAX)
+                    n = JSONL_SRC_MAX - 1;
+                memcpy(row->src, v, n);
+                row->src[n] = '\0';
+            }
+            continue;
+        }
+
+        v = p;
+        while (p < end && *p != ',' && *p != '}')
+            p++;
+        vend = p;
+        if (parse_number(v, vend, &num) != 0)
+            continue;  /* empty ("temp_c": ,) or null */
+
+        if (key_is(key, klen, "pct"))
+            row->pct = num;
+        else if (key_is(key, klen, "watts"))
+            row->watts = num;
+        else if (key_is(key, klen, "cpu_load"))
+            row->cpu_load = num;
+        else if (key_is(key, klen, "cpu_pct")) {
+            row->cpu_pct = num;
+            row->has_cpu_pct = 1;
+        }
+        else if (key_is(key, klen, "ram_pct"))
+            row->ram_pct = num;
+        else if (key_is(key, klen, "temp_c")) {
+            row->temp_c = num;
+            row->has_temp = 1;
+        }
+    }
+
+    return have_t ? 0 : -1;
+}
+
+long long jsonl_scan_file(const char *path, jsonl_row_fn fn, void *ctx)
+{
+    return jsonl_scan_range(path, 0, fn, ctx);
+}
+
+long long jsonl_scan_range(const char *path, uint64_t offset,
+                           jsonl_row_fn fn, void *ctx)
+{
+    struct stat st;
+    const char *map, *p, *end;
+    long long rows = 0;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return -1;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return -1;
+    if (offset >= (uint64_t)st.st_size || (offset > 0 && map[offset - 1] != '\n'))
+        offset = 0;
+    posix_madvise((void *)(map + (offset & ~(uint64_t)4095)),
+                  (size_t)(st.st_size - (offset & ~(uint64_t)4095)),
+                  POSIX_MADV_SEQUENTIAL);
+
+    p = map + offset;
+    end = map + st.st_size;
+    while (p < end) {
+        const char *nl = memchr(p, '\n', (size_t)(end - p));
+        const char *eol = nl ? nl : end;
+        struct jsonl_row row;
+
+        if (jsonl_parse_row(p, (size_t)(eol - p), &row) == 0) {
+            row.offset = (uint64_t)(p - map);
+            rows++;
+            if (fn(&row, ctx) != 0)
+                break;
+        }
+        p = eol + 1;
+    }
+
+    munmap((void *)map, (size_t)st.st_size);
+    return rows;
+}
+
+int jsonl_object_string(const char *js, size_t len, const char *key, char *out, size_t out_len)
+{
+    size_t klen = strlen(key);
+    size_t i, j, start;
+    int depth = 0;
+
+    for (i = 0; i < len; i++) {
+        if (js[i] == '{' || js[i] == '[') {
+            depth++;
+        } else if (js[i] == '}' || js[i] == ']') {
+            depth--;
+        } else if (js[i] == '"') {
+            for (start = ++i; i < len && js[i] != '"'; i += js[i] == '\\' ? 2 : 1)
+                ;
+            if (i >= len)
+                return -1;
+            if (depth != 1 || i - start != klen || memcmp(js + start, key, klen) != 0)
+                continue;
+            for (j = i + 1; j < len && isspace((unsigned char)js[j]); j++)
+                ;
+            if (j >= len || js[j] != ':')
+                continue;       /* a value that reads like the key */
+            for (j++; j < len && isspace((unsigned char)js[j]); j++)
+                ;
+            if (j >= len || js[j] != '"')
+                return -1;
+            for (start = ++j; j < len && js[j] != '"'; j += js[j] == '\\' ? 2 : 1)
+                ;
+            if (j >= len || j - start >= out_len)
+                return -1;
+            memcpy(out, js + start, j - start);
+            out[j - start] = '\0';
+            return 0;
+        }
+    }
+    return -1;
+}
@@ -0,0 +1,67 @@
+/*
+ * jsonl.h - batlab JSONL record parser
+ *
+ * Decodes one sample line of the batlab schema without allocating or
+ * requiring NUL termination, so records can be parsed in place from a
+ * mapped file. Both the spaced and compact key layouts are accepted, as
+ * are the malformed rows with an empty value ("temp_c": ,) written by
+ * older collectors, so no repair pass is needed.
+ */
+
+#ifndef BATLAB_JSONL_H
+#define BATLAB_JSONL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define JSONL_SRC_MAX 32
+
+struct jsonl_row {
+    int64_t t_ns;           /* nanoseconds since the epoch */
+    double pct;
+    double watts;
+    double cpu_load;
+    double cpu_pct;         /* measured utilization, from newer samplers */
+    int has_cpu_pct;
+    double ram_pct;
+    double temp_c;
+    int has_temp;           /* 0 when temp_c is empty or null */
+    char src[JSONL_SRC_MAX];
+    uint64_t offset;        /* byte offset of the line, set by the scanners */
+};
+
+/* Parse an ISO 8601 timestamp ("...T05:43:15.6196Z", "+00:00" offsets) */
+int jsonl_parse_time(const char *s, size_t len, int64_t *ns);
+
+/*
+ * Parse one record of len bytes. Missing numeric fields read as 0.
+ * Returns -1 when the line has no parseable "t" field.
+ */
+int jsonl_parse_row(const char *line, size_t len, struct jsonl_row *row);
+
+/* Called for every parsed row; a non-zero return stops the scan */
+typedef int (*jsonl_row_fn)(const struct jsonl_row *row, void *ctx);
+
+/*
+ * mmap a JSONL file and parse each line in place, skipping lines that
+ * are not samples. Returns the number of rows passed to fn, or -1 if
+ * the file cannot be read.
+ */
+long long jsonl_scan_file(const char *path, jsonl_row_fn fn, void *ctx);
+
+/*
+ * As jsonl_scan_file, starting at byte offset (from a .idx time index).
+ * An offset that is past the end or not at the start of a line is
+ * ignored and the whole file is scanned.
+ */
+long long jsonl_scan_range(const char *path, uint64_t offset,
+                           jsonl_row_fn fn, void *ctx);
+
+/*
+ * Copy the top-level string member key of a JSON object (a .meta.json)
+ * to out, still JSON-escaped. Returns -1 when it is missing, not a
+ * string or longer than out_len - 1.
+ */
+int jsonl_object_string(const char *js, size_t len, const char *key, char *out, size_t out_len);
+
+#endif /* BATLAB_JSONL_H */
@@ -0,0 +1,233 @@
+/*
+ * kernel.c - Work kernels for batlab-stress
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "kernel.h"
+
+#define INT_ROUNDS 1024         /* mixing rounds per int unit */
+#define FP_LEN 1024             /* doubles per fp vector, 8 KB: stays in L1 */
+#define STREAM_CHUNK 4096       /* triad elements per stream unit */
+
+#if defined(__GNUC__) || defined(__clang__)
+#define FP_VECTOR 1
+typedef double v4d __attribute__((vector_size(32), may_alias));
+#else
+#define FP_VECTOR 0
+#endif
+
+/* x = x * m + y converges to y / (1 - m), so values stay normal forever */
+#define FP_SCALE 0.999999
+
+#if FP_VECTOR
+#define FP_BODY                                                         \
+    {                                                                   \
+        v4d *vx = (v4d *)x;                                             \
+        const v4d *vy = (const v4d *)y;                                 \
+        const v4d m = { FP_SCALE, FP_SCALE, FP_SCALE, FP_SCALE };       \
+        unsigned r;                                                     \
+        size_t i;                                                       \
+                                                                        \
+        for (r = 0; r < n; r++)                                         \
+            for (i = 0; i < FP_LEN / 4; i++)                            \
+                vx[i] = vx[i] * m + vy[i];                              \
+    }
+#else
+#define FP_BODY                                                         \
+    {                                                                   \
+        unsigned r;                                                     \
+        size_t i;                                                       \
+                                                                        \
+        for (r = 0; r < n; r++)                                         \
+            for (i = 0; i < FP_LEN; i++)                                \
+                x[i] = x[i] * FP_SCALE + y[i];                          \
+    }
+#endif
+
+static void fp_generic(double *x, const double *y, unsigned n)
+FP_BODY
+
+#if FP_VECTOR && defined(__x86_64__)
+#define FP_HAVE_AVX2 1
+/* Same loop, compiled for 256-bit registers and picked at run time */
+__attribute__((target("avx2,fma")))
+static void fp_avx2(double *x, const double *y, unsigned n)
+FP_BODY
+#else
+#define FP_HAVE_AVX2 0
+#endif
+
+static void (*fp_run)(double *, const double *, unsigned) = fp_generic;
+
+int kernel_parse(const char *name, enum kernel_kind *kind)
+{
+    if (strcmp(name, "int") == 0)
+        *kind = KERNEL_INT;
+    else if (strcmp(name, "fp") == 0)
+        *kind = KERNEL_FP;
+    else if (strcmp(name, "stream") == 0)
+        *kind = KERNEL_STREAM;
+    else
+        return -1;
+    return 0;
+}
+
+const char *kernel_name(enum kernel_kind kind)
+{
+    switch (kind) {
+    case KERNEL_FP:
+        return "fp";
+    case KERNEL_STREAM:
+        return "stream";
+    default:
+        return "int";
+    }
+}
+
+static double *alloc_doubles(size_t n)
+{
+    void *p = NULL;
+
+    if (posix_memalign(&p, 64, n * sizeof(double)) != 0)
+        return NULL;
+    return p;
+}
+
+int kernel_init(struct kernel *k, enum kernel_kind kind, size_t stream_bytes, unsigned seed)
+{
+    size_t i;
+
+    memset(k, 0, sizeof(*k));
+    k->kind = kind;
+    k->variant = "generic";
+    k->state = 0x9e3779b97f4a7c15ULL ^ seed;
+
+    if (kind == KERNEL_FP) {
+        k->len = FP_LEN;
+        k->a = alloc_doubles(FP_LEN);
+        k->b = alloc_doubles(FP_LEN);
+        if (k->a == NULL || k->b == NULL) {
+            kernel_free(k);
+            return -1;
+        }
+        for (i = 0; i < FP_LEN; i++) {
+            k->a[i] = (double)(i + seed);
+            k->b[i] = 1e-3 * (double)((i % 7) + 1);
+        }
+#if FP_HAVE_AVX2
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+            fp_run = fp_avx2;
+            k->variant = "avx2";
+        }
+#elif FP_VECTOR
+        k->variant = "vector";
+#endif
+    } else if (kind == KERNEL_STREAM) {
+        k->len = stream_bytes / (3 * sizeof(double));
+        k->len -= k->len % STREAM_CHUNK;
+        if (k->len < STREAM_CHUNK)
+            k->len = STREAM_CHUNK;
+        k->a = alloc_doubles(k->len);
+        k->b = alloc_doubles(k->len);
+        k->c = alloc_doubles(k->len);
+        if (k->a == NULL || k->b == NULL || k->c == NULL) {
+            kernel_free(k);
+            return -1;
+        }
+        /* Touch every page now, so the first periods are not page faults */
+        for (i = 0; i < k->len; i++) {
+            k->a[i] = 0.0;
+            k->b[i] = 1.0;
+            k->c[i] = 2.0;
+        }
+    }
+    return 0;
+}
+
+static void int_run(struct kernel *k, unsigned n)
+{
+    uint64_t x = k->state;
+    unsigned long i, rounds = (unsigned long)n * INT_ROUNDS;
+
+    for (i = 0; i < rounds; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        x *= 0x2545f4914f6cdd1dULL;
+    }
+    k->state = x;
+}
+
+static void stream_run(struct kernel *k, unsigned n)
+{
+    const double s = 3.0;
+    unsigned u;
+
+    for (u = 0; u < n; u++) {
+        double *restrict a = k->a + k->pos;
+        const double *restrict b = k->b + k->pos;
+        const double *restrict c = k->c + k->pos;
+        size_t i;
+
+        for (i = 0; i < STREAM_CHUNK; i++)
+            a[i] = b[i] + s * c[i];
+        k->pos += STREAM_CHUNK;
+        if (k->pos == k->len)
+            k->pos = 0;
+    }
+    k->sink += k->a[k->pos];
+}
+
+void kernel_run(struct kernel *k, unsigned n)
+{
+    switch (k->kind) {
+    case KERNEL_FP:
+        fp_run(k->a, k->b, n);
+        k->sink += k->a[0];
+        break;
+    case KERNEL_STREAM:
+        stream_run(k, n);
+        break;
+    default:
+        int_run(k, n);
+        break;
+    }
+}
+
+double kernel_unit_amount(const struct kernel *k)
+{
+    switch (k->kind) {
+    case KERNEL_FP:
+        return 2.0 * FP_LEN;                            /* flops */
+    case KERNEL_STREAM:
+        return 3.0 * sizeof(double) * STREAM_CHUNK;     /* bytes moved */
+    default:
+        return INT_ROUNDS;                              /* mixing rounds */
+    }
+}
+
+const char *kernel_rate_unit(const struct kernel *k)
+{
+    switch (k->kind) {
+    case KERNEL_FP:
+        return "MFLOP/s";
+    case KERNEL_STREAM:
+        return "MB/s";
+    default:
+        return "Mops/s";
+    }
+}
+
+void kernel_free(struct kernel *k)
+{
+    free(k->a);
+    free(k->b);
+    free(k->c);
+    k->a = k->b = k->c = NULL;
+}
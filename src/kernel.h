@@ -0,0 +1,51 @@
+/*
+ * kernel.h - Work kernels for batlab-stress
+ *
+ * Each kernel does its work in small fixed units, so a worker can check
+ * the clock between units and stop within a few microseconds of the end
+ * of its duty cycle:
+ *
+ *   int     integer multiply/xor/shift mixing in registers
+ *   fp      double-precision multiply-add over an L1-resident vector,
+ *           written with SIMD vector types; AVX2 where the CPU has it
+ *   stream  STREAM-style triad a = b + s * c over arrays sized well
+ *           past the last-level cache, so it runs at memory bandwidth
+ */
+
+#ifndef BATLAB_KERNEL_H
+#define BATLAB_KERNEL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+enum kernel_kind {
+    KERNEL_INT,
+    KERNEL_FP,
+    KERNEL_STREAM
+};
+
+#define KERNEL_STREAM_DEFAULT_MB 24     /* per worker, all three arrays */
+
+struct kernel {
+    enum kernel_kind kind;
+    const char *variant;        /* "generic", "avx2", ... */
+    double *a;
+    double *b;
+    double *c;
+    size_t len;                 /* elements per stream array */
+    size_t pos;
+    uint64_t state;
+    double sink;                /* keeps results observable */
+};
+
+int kernel_parse(const char *name, enum kernel_kind *kind);
+const char *kernel_name(enum kernel_kind kind);
+int kernel_init(struct kernel *k, enum kernel_kind kind, size_t stream_bytes, unsigned seed);
+/* Do n units of work */
+void kernel_run(struct kernel *k, unsigned n);
+/* Work done by one unit, and the unit its rate is reported in per 1e6 */
+double kernel_unit_amount(const struct kernel *k);
+const char *kernel_rate_unit(const struct kernel *k);
+void kernel_free(struct kernel *k);
+
+#endif /* BATLAB_KERNEL_H */
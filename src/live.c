@@ -0,0 +1,75 @@
+/*
+ * live.c - Rolling run aggregates for the batlab-sampler live view
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "live.h"
+
+void live_init(struct live *l, double hz)
+{
+    double per_minute = hz * 60.0;
+
+    memset(l, 0, sizeof(*l));
+    l->window_len = per_minute < 1.0 ? 1
+                  : per_minute > LIVE_WINDOW_MAX ? LIVE_WINDOW_MAX
+                  : (unsigned)per_minute;
+}
+
+void live_add(struct live *l, const struct sample *s, int64_t t_ns)
+{
+    if (l->count == 0) {
+        l->t0_ns = t_ns;
+        l->first_pct = s->pct;
+        l->min_watts = l->max_watts = s->watts;
+    }
+    l->count++;
+    l->last_ns = t_ns;
+    l->last_pct = s->pct;
+    l->sum_watts += s->watts;
+    l->sum_cpu += s->cpu_pct >= 0.0 ? s->cpu_pct : s->cpu_load * 100;
+    l->sum_temp += s->temp_c;
+    if (s->watts < l->min_watts)
+        l->min_watts = s->watts;
+    if (s->watts > l->max_watts)
+        l->max_watts = s->watts;
+
+    if (l->window_fill == l->window_len)
+        l->window_sum -= l->window[l->window_pos];
+    else
+        l->window_fill++;
+    l->window[l->window_pos] = s->watts;
+    l->window_sum += s->watts;
+    if (++l->window_pos == l->window_len) {
+        unsigned i;
+
+        l->window_pos = 0;
+        l->window_sum = 0;
+        for (i = 0; i < l->window_fill; i++)
+            l->window_sum += l->window[i];
+    }
+}
+
+int live_format(const struct live *l, char *buf, size_t len,
+                const char *record, size_t record_len)
+{
+    double n = l->count > 0 ? (double)l->count : 1.0;
+    double hours = (double)(l->last_ns - l->t0_ns) / 3.6e12;
+    double drain = l->first_pct - l->last_pct;
+    double rate = hours > 0 ? drain / hours : 0.0;
+
+    while (record_len > 0 && (record[record_len - 1] == '\n' || record[record_len - 1] == '\r'))
+        record_len--;
+
+    return snprintf(buf, len,
+        "{\"sample\": %.*s, \"samples\": %llu, \"elapsed_h\": %.6f, "
+        "\"avg_watts\": %.3f, \"min_watts\": %.3f, \"max_watts\": %.3f, "
+        "\"watts_1m\": %.3f, \"avg_cpu\": %.2f, \"avg_temp\": %.2f, "
+        "\"battery_drain\": %.2f, \"drain_rate\": %.3f, \"remaining_h\": %.3f}",
+        (int)record_len, record, (unsigned long long)l->count, hours,
+        l->sum_watts / n, l->min_watts, l->max_watts,
+        l->window_fill > 0 ? l->window_sum / (double)l->window_fill : 0.0,
+        l->sum_cpu / n, l->sum_temp / n, drain, rate,
+        rate > 0 ? l->last_pct / rate : 0.0);
+}
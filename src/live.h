@@ -0,0 +1,48 @@
+/*
+ * live.h - Rolling run aggregates for the batlab-sampler live view
+ *
+ * Every sample updates the aggregates in amortised constant time: sums,
+ * extremes and a one-minute moving average over a ring buffer whose
+ * sum is kept incrementally (and recomputed once per lap, so rounding
+ * error cannot build up over a multi-hour run).
+ */
+
+#ifndef BATLAB_LIVE_H
+#define BATLAB_LIVE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "probe.h"
+
+#define LIVE_WINDOW_MAX 6000    /* one minute at SCHED_MAX_HZ */
+
+struct live {
+    uint64_t count;
+    int64_t t0_ns;
+    int64_t last_ns;
+    double first_pct;
+    double last_pct;
+    double sum_watts;
+    double min_watts;
+    double max_watts;
+    double sum_cpu;
+    double sum_temp;
+    double window[LIVE_WINDOW_MAX];
+    unsigned window_len;        /* samples per minute at the sampling rate */
+    unsigned window_pos;
+    unsigned window_fill;
+    double window_sum;
+};
+
+void live_init(struct live *l, double hz);
+void live_add(struct live *l, const struct sample *s, int64_t t_ns);
+
+/*
+ * Format the latest sample (a JSONL record, without its newline) and the
+ * aggregates as one JSON object; returns its length
+ */
+int live_format(const struct live *l, char *buf, size_t len,
+                const char *record, size_t record_len);
+
+#endif /* BATLAB_LIVE_H */
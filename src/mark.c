@@ -0,0 +1,217 @@
+/*
+ * mark.c - Workload phase markers for batlab-sampler
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mark.h"
+
+static int mark_address(struct sockaddr_un *sa, const char *path)
+{
+    memset(sa, 0, sizeof(*sa));
+    sa->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(sa->sun_path))
+        return -1;
+    strcpy(sa->sun_path, path);
+    return 0;
+}
+
+int mark_open(struct mark *m, const char *sock_path, const char *events_path)
+{
+    struct sockaddr_un sa;
+    struct stat st;
+    int on = 1;
+
+    memset(m, 0, sizeof(*m));
+    m->fd = -1;
+    m->out = -1;
+    if (mark_address(&sa, sock_path) != 0)
+        return -1;
+
+    /* A socket left by a logger that did not exit cleanly */
+    if (lstat(sock_path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(sock_path);
+
+    m->fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (m->fd < 0)
+        return -1;
+    fcntl(m->fd, F_SETFD, FD_CLOEXEC);
+    fcntl(m->fd, F_SETFL, fcntl(m->fd, F_GETFL) | O_NONBLOCK);
+#if defined(SO_TIMESTAMP)
+    setsockopt(m->fd, SOL_SOCKET, SO_TIMESTAMP, &on, sizeof(on));
+#else
+    (void)on;
+#endif
+    if (bind(m->fd, (struct sockaddr *)&sa, sizeof(sa)) != 0)
+        goto fail;
+
+    m->out = open(events_path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (m->out < 0) {
+        unlink(sock_path);
+        goto fail;
+    }
+    m->path = strdup(sock_path);
+    return 0;
+
+fail:
+    close(m->fd);
+    m->fd = -1;
+    return -1;
+}
+
+/* Append s to buf as the body of a JSON string */
+static size_t json_escape(char *buf, size_t len, const char *s)
+{
+    size_t n = 0;
+
+    for (; *s != '\0' && n + 7 < len; s++) {
+        unsigned char c = (unsigned char)*s;
+
+        if (c == '"' || c == '\\') {
+            buf[n++] = '\\';
+            buf[n++] = (char)c;
+        } else if (c < 0x20) {
+            n += (size_t)snprintf(buf + n, len - n, "\\u%04x", c);
+        } else {
+            buf[n++] = (char)c;
+        }
+    }
+    buf[n] = '\0';
+    return n;
+}
+
+/* Write one marker received at tv; unknown events are dropped */
+static void mark_record(struct mark *m, const struct timeval *tv, char *text)
+{
+    char line[MARK_TEXT_MAX * 6 + 128];
+    char label[MARK_TEXT_MAX * 6 + 1];
+    char stamp[32];
+    struct tm tm;
+    time_t sec = tv->tv_sec;
+    char *event = text, *rest;
+    int len;
+
+    text[strcspn(text, "\r\n")] = '\0';
+    rest = strchr(text, ' ');
+    if (rest != NULL) {
+        *rest++ = '\0';
+        rest += strspn(rest, " ");
+    }
+    if (strcmp(event, "start") != 0 && strcmp(event, "stop") != 0 &&
+        strcmp(event, "phase") != 0)
+        return;
+
+    json_escape(label, sizeof(label), rest != NULL ? rest : "");
+    gmtime_r(&sec, &tm);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+    len = snprintf(line, sizeof(line),
+        "{\"t\": \"%s.%06ldZ\", \"event\": \"%s\", \"label\": \"%s\"}\n",
+        stamp, (long)tv->tv_usec, event, label);
+    if (len > 0 && (size_t)len < sizeof(line) && write(m->out, line, (size_t)len) == len)
+        m->received++;
+}
+
+int mark_drain(struct mark *m)
+{
+    int count = 0;
+
+    if (m->fd < 0)
+        return 0;
+    for (;;) {
+        char text[MARK_TEXT_MAX + 1];
+        union {
+            struct cmsghdr hdr;
+            char buf[CMSG_SPACE(sizeof(struct timeval))];
+        } control;
+        struct iovec iov;
+        struct msghdr msg;
+        struct cmsghdr *c;
+        struct timeval tv;
+        int stamped = 0;
+        ssize_t n;
+
+        iov.iov_base = text;
+        iov.iov_len = MARK_TEXT_MAX;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control.buf;
+        msg.msg_controllen = sizeof(control.buf);
+
+        n = recvmsg(m->fd, &msg, 0);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        text[n] = '\0';
+
+#if defined(SO_TIMESTAMP)
+        for (c = CMSG_FIRSTHDR(&msg); c != NULL; c = CMSG_NXTHDR(&msg, c)) {
+            if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMP) {
+                memcpy(&tv, CMSG_DATA(c), sizeof(tv));
+                stamped = 1;
+            }
+        }
+#else
+        (void)c;
+#endif
+        if (!stamped) {
+            struct timespec ts;
+
+            clock_gettime(CLOCK_REALTIME, &ts);
+            tv.tv_sec = ts.tv_sec;
+            tv.tv_usec = ts.tv_nsec / 1000;
+        }
+        mark_record(m, &tv, text);
+        count++;
+    }
+    return count;
+}
+
+void mark_close(struct mark *m)
+{
+    if (m->fd >= 0) {
+        mark_drain(m);
+        close(m->fd);
+        if (m->path != NULL)
+            unlink(m->path);
+    }
+    if (m->out >= 0)
+        close(m->out);
+    free(m->path);
+    m->fd = -1;
+    m->out = -1;
+    m->path = NULL;
+}
+
+int mark_send(const char *sock_path, const char *text)
+{
+    struct sockaddr_un sa;
+    size_t len = strlen(text);
+    ssize_t n;
+    int fd;
+
+    if (len > MARK_TEXT_MAX || mark_address(&sa, sock_path) != 0)
+        return -1;
+    fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+    if (fd < 0)
+        return -1;
+    n = sendto(fd, text, len, 0, (struct sockaddr *)&sa, sizeof(sa));
+    close(fd);
+    return n == (ssize_t)len ? 0 : -1;
+}
@@ -0,0 +1,36 @@
+/*
+ * mark.h - Workload phase markers for batlab-sampler
+ *
+ * Workloads run in another terminal from the logger, so they announce
+ * their phases as datagrams on a local socket ("start stress", "phase
+ * warmup", "stop stress"). The sampler drains the socket once per sample
+ * and appends each marker to the run's .events file, timestamped on the
+ * sampler's clock: by the kernel on arrival (SO_TIMESTAMP) where it can,
+ * otherwise when drained. A marker costs the sender one sendto(2) and the
+ * sampler nothing between markers.
+ */
+
+#ifndef BATLAB_MARK_H
+#define BATLAB_MARK_H
+
+#include <stdint.h>
+
+#define MARK_TEXT_MAX 256
+
+struct mark {
+    int fd;                     /* -1 when not listening */
+    int out;                    /* the run's .events, opened O_APPEND */
+    char *path;
+    uint64_t received;
+};
+
+/* Listen on the socket at sock_path, replacing a stale one, appending to events_path */
+int mark_open(struct mark *m, const char *sock_path, const char *events_path);
+/* Record every marker waiting on the socket; returns how many */
+int mark_drain(struct mark *m);
+void mark_close(struct mark *m);
+
+/* Send one "EVENT [LABEL]" marker; -1 when no sampler is listening */
+int mark_send(const char *sock_path, const char *text);
+
+#endif /* BATLAB_MARK_H */
@@ -0,0 +1,702 @@
+/*
+ * probe.c - Platform telemetry probes for batlab-sampler
+ *
+ * Mirrors the collectors in bin/batlab (get_battery_*, get_cpu_load,
+ * get_memory_usage, get_temperature) but reads the kernel interfaces
+ * directly instead of forking acpiconf/upower/uptime/grep/awk.
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cpu.h"
+#include "probe.h"
+
+#if defined(__FreeBSD__)
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <sys/sysctl.h>
+#include <dev/acpica/acpiio.h>
+#elif defined(__OpenBSD__)
+#include <sys/types.h>
+#include <sys/ioctl.h>
+#include <machine/apmvar.h>
+#endif
+
+#if defined(__linux__)
+#define PROBE_PLATFORM "linux"
+#elif defined(__FreeBSD__)
+#define PROBE_PLATFORM "freebsd"
+#elif defined(__OpenBSD__)
+#define PROBE_PLATFORM "openbsd"
+#elif defined(__NetBSD__)
+#define PROBE_PLATFORM "netbsd"
+#elif defined(__APPLE__)
+#define PROBE_PLATFORM "macos"
+#else
+#define PROBE_PLATFORM "unknown"
+#endif
+
+#if defined(__linux__)
+
+#define POWER_SUPPLY_DIR "/sys/class/power_supply"
+#define RAPL_PACKAGE_DIR "/sys/class/powercap/intel-rapl:0"
+
+/* Read a small sysfs/procfs file from offset 0 into buf */
+static ssize_t read_fd(int fd, char *buf, size_t len)
+{
+    ssize_t n;
+
+    if (fd < 0 || len == 0)
+        return -1;
+    n = pread(fd, buf, len - 1, 0);
+    if (n < 0)
+        return -1;
+    buf[n] = '\0';
+    return n;
+}
+
+static int read_long(int fd, long *value)
+{
+    char buf[64];
+    char *end;
+
+    if (read_fd(fd, buf, sizeof(buf)) <= 0)
+        return -1;
+    *value = strtol(buf, &end, 10);
+    return end == buf ? -1 : 0;
+}
+
+static int read_llong(int fd, long long *value)
+{
+    char buf[64];
+    char *end;
+
+    if (read_fd(fd, buf, sizeof(buf)) <= 0)
+        return -1;
+    *value = strtoll(buf, &end, 10);
+    return end == buf ? -1 : 0;
+}
+
+static int open_attr(const char *dir, const char *name)
+{
+    char path[512];
+
+    if (snprintf(path, sizeof(path), "%s/%s", dir, name) >= (int)sizeof(path))
+        return -1;
+    return open(path, O_RDONLY | O_CLOEXEC);
+}
+
+/* Find the first power supply whose type is "Battery" */
+static int find_battery(char *dir, size_t len)
+{
+    DIR *d;
+    struct dirent *ent;
+    int found = -1;
+
+    d = opendir(POWER_SUPPLY_DIR);
+    if (d == NULL)
+        return -1;
+
+    while (found < 0 && (ent = readdir(d)) != NULL) {
+        char type[32];
+        int fd;
+
+        if (ent->d_name[0] == '.')
+            continue;
+        if (snprintf(dir, len, "%s/%s", POWER_SUPPLY_DIR, ent->d_name) >= (int)len)
+            continue;
+        fd = open_attr(dir, "type");
+        if (fd < 0)
+            continue;
+        if (read_fd(fd, type, sizeof(type)) > 0 && strncmp(type, "Battery", 7) == 0)
+            found = 0;
+        close(fd);
+    }
+
+    closedir(d);
+    if (found < 0)
+        dir[0] = '\0';
+    return found;
+}
+
+static long meminfo_field(const char *buf, const char *name);
+
+static int probes_open_platform(struct probes *p)
+{
+    char *bat = p->battery_dev;
+    char buf[4096];
+
+    p->bat_energy_now_fd = -1;
+    p->bat_energy_full_fd = -1;
+    p->bat_capacity_fd = -1;
+    p->bat_power_fd = -1;
+    p->bat_current_fd = -1;
+    p->bat_voltage_fd = -1;
+    p->bat_is_energy = 0;
+    p->rapl_fd = -1;
+
+    if (find_battery(bat, sizeof(p->battery_dev)) == 0) {
+        p->charge_probe = "energy_now/energy_full";
+        p->bat_energy_now_fd = open_attr(bat, "energy_now");
+        p->bat_energy_full_fd = open_attr(bat, "energy_full");
+        if (p->bat_energy_now_fd < 0 || p->bat_energy_full_fd < 0) {
+            if (p->bat_energy_now_fd >= 0)
+                close(p->bat_energy_now_fd);
+            if (p->bat_energy_full_fd >= 0)
+                close(p->bat_energy_full_fd);
+            /* Coulomb-counting batteries expose charge_* instead */
+            p->charge_probe = "charge_now/charge_full";
+            p->bat_energy_now_fd = open_attr(bat, "charge_now");
+            p->bat_energy_full_fd = open_attr(bat, "charge_full");
+        } else {
+            p->bat_is_energy = 1;
+            p->energy_probe = "energy_now";
+        }
+        p->bat_capacity_fd = open_attr(bat, "capacity");
+        if (p->bat_energy_now_fd < 0 || p->bat_energy_full_fd < 0)
+            p->charge_probe = p->bat_capacity_fd >= 0 ? "capacity" : NULL;
+
+        p->bat_power_fd = open_attr(bat, "power_now");
+        p->bat_current_fd = open_attr(bat, "current_now");
+        p->bat_voltage_fd = open_attr(bat, "voltage_now");
+        if (p->bat_power_fd >= 0)
+            p->power_probe = "power_now";
+        else if (p->bat_current_fd >= 0 && p->bat_voltage_fd >= 0)
+            p->power_probe = "current_now*voltage_now";
+
+        if (p->charge_probe != NULL)
+            p->battery_src = "sysfs";
+    }
+
+    p->loadavg_fd = open("/proc/loadavg", O_RDONLY | O_CLOEXEC);
+    if (p->loadavg_fd >= 0)
+        p->load_probe = "/proc/loadavg";
+
+    /* MemTotal never changes during a run: read it once here */
+    p->meminfo_fd = open("/proc/meminfo", O_RDONLY | O_CLOEXEC);
+    if (read_fd(p->meminfo_fd, buf, sizeof(buf)) > 0) {
+        p->mem_total_kb = meminfo_field(buf, "MemTotal:");
+        if (meminfo_field(buf, "MemAvailable:") >= 0) {
+            p->mem_avail_key = "MemAvailable:";
+            p->memory_probe = "MemTotal/MemAvailable";
+        } else {
+            p->mem_avail_key = "MemFree:";
+            p->memory_probe = "MemTotal/MemFree";
+        }
+    }
+
+    p->thermal_fd = open("/sys/class/thermal/thermal_zone0/temp", O_RDONLY | O_CLOEXEC);
+    if (p->thermal_fd >= 0)
+        p->thermal_probe = "/sys/class/thermal/thermal_zone0/temp";
+
+    /* energy_uj is root-only on kernels since 5.10; skip it quietly */
+    p->rapl_fd = open_attr(RAPL_PACKAGE_DIR, "energy_uj");
+    if (read_llong(p->rapl_fd, &p->rapl_last_uj) == 0) {
+        long long range = 0;
+        int fd = open_attr(RAPL_PACKAGE_DIR, "max_energy_range_uj");
+
+        if (read_llong(fd, &range) != 0)
+            range = 0;
+        if (fd >= 0)
+            close(fd);
+        p->rapl_range_j = (double)range / 1e6;
+        p->rapl_total_j = 0.0;
+        p->rapl_probe = RAPL_PACKAGE_DIR "/energy_uj";
+    } else if (p->rapl_fd >= 0) {
+        close(p->rapl_fd);
+        p->rapl_fd = -1;
+    }
+
+    return 0;
+}
+
+static void read_battery(struct probes *p, struct sample *s)
+{
+    long now, full, power, current, voltage;
+
+    s->pct = PROBE_DUMMY_PCT;
+    s->watts = PROBE_DUMMY_WATTS;
+    s->src = p->battery_src;
+
+    if (read_long(p->bat_energy_now_fd, &now) == 0 &&
+        read_long(p->bat_energy_full_fd, &full) == 0 && full > 0) {
+        s->pct = 100.0 * (double)now / (double)full;
+        if (p->bat_is_energy) {
+            s->battery_wh = (double)now / 1e6;
+            s->battery_full_wh = (double)full / 1e6;
+        }
+    } else if (read_long(p->bat_capacity_fd, &now) == 0)
+        s->pct = (double)now;
+    else
+        s->fallback |= PROBE_FALLBACK_CHARGE;
+
+    /* power_now is in uW; otherwise derive it from uA * uV */
+    if (read_long(p->bat_power_fd, &power) == 0)
+        s->watts = (double)labs(power) / 1e6;
+    else if (read_long(p->bat_current_fd, &current) == 0 &&
+             read_long(p->bat_voltage_fd, &voltage) == 0)
+        s->watts = ((double)labs(current) / 1e6) * ((double)voltage / 1e6);
+    else
+        s->fallback |= PROBE_FALLBACK_POWER;
+}
+
+/* Joules since the sampler started; the counter wraps at max_energy_range_uj */
+static void read_rapl(struct probes *p, struct sample *s)
+{
+    long long uj;
+
+    if (read_llong(p->rapl_fd, &uj) != 0)
+        return;
+    if (uj >= p->rapl_last_uj)
+        p->rapl_total_j += (double)(uj - p->rapl_last_uj) / 1e6;
+    else
+        p->rapl_total_j += p->rapl_range_j - (double)(p->rapl_last_uj - uj) / 1e6;
+    p->rapl_last_uj = uj;
+    s->rapl_j = p->rapl_total_j;
+}
+
+static void read_load(struct probes *p, struct sample *s)
+{
+    char buf[128];
+
+    s->cpu_load = PROBE_DUMMY_LOAD;
+    if (read_fd(p->loadavg_fd, buf, sizeof(buf)) > 0)
+        s->cpu_load = strtod(buf, NULL);
+    else
+        s->fallback |= PROBE_FALLBACK_LOAD;
+}
+
+static long meminfo_field(const char *buf, const char *name)
+{
+    const char *line = strstr(buf, name);
+
+    if (line == NULL)
+        return -1;
+    return strtol(line + strlen(name), NULL, 10);
+}
+
+static void read_memory(struct probes *p, struct sample *s)
+{
+    char buf[4096];
+    long total = p->mem_total_kb;
+    long avail;
+
+    s->ram_pct = PROBE_DUMMY_RAM;
+    s->fallback |= PROBE_FALLBACK_MEMORY;
+    if (p->memory_probe == NULL || read_fd(p->meminfo_fd, buf, sizeof(buf)) <= 0)
+        return;
+
+    avail = meminfo_field(buf, p->mem_avail_key);
+    if (total > 0 && avail >= 0) {
+        s->ram_pct = 100.0 * (double)(total - avail) / (double)total;
+        s->fallback &= ~PROBE_FALLBACK_MEMORY;
+    }
+}
+
+static void read_temperature(struct probes *p, struct sample *s)
+{
+    long millic;
+
+    s->temp_c = PROBE_DUMMY_TEMP;
+    if (read_long(p->thermal_fd, &millic) == 0)
+        s->temp_c = (double)millic / 1000.0;
+    else
+        s->fallback |= PROBE_FALLBACK_THERMAL;
+}
+
+void probes_close(struct probes *p)
+{
+    int *fds[] = {
+        &p->bat_energy_now_fd, &p->bat_energy_full_fd, &p->bat_capacity_fd,
+        &p->bat_power_fd, &p->bat_current_fd, &p->bat_voltage_fd,
+        &p->loadavg_fd, &p->meminfo_fd, &p->thermal_fd, &p->rapl_fd
+    };
+    size_t i;
+
+    for (i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+        if (*fds[i] >= 0)
+            close(*fds[i]);
+        *fds[i] = -1;
+    }
+}
+
+#elif defined(__FreeBSD__)
+
+static int resolve_mib(const char *name, int *mib, size_t *len)
+{
+    *len = PROBE_MIB_MAX;
+    if (sysctlnametomib(name, mib, len) != 0) {
+        *len = 0;
+        return -1;
+    }
+    return 0;
+}
+
+static int read_mib_int(const int *mib, size_t len, int *value)
+{
+    size_t size = sizeof(*value);
+
+    if (len == 0)
+        return -1;
+    return sysctl(mib, (u_int)len, value, &size, NULL, 0);
+}
+
+static int read_mib_uint(const int *mib, size_t len, u_int *value)
+{
+    size_t size = sizeof(*value);
+
+    if (len == 0)
+        return -1;
+    return sysctl(mib, (u_int)len, value, &size, NULL, 0);
+}
+
+static int probes_open_platform(struct probes *p)
+{
+    p->acpi_fd = open("/dev/acpi", O_RDONLY | O_CLOEXEC);
+    p->battery_src = p->acpi_fd >= 0 ? "acpiconf" : "sysctl";
+
+    resolve_mib("hw.acpi.battery.life", p->life_mib, &p->life_len);
+    resolve_mib("hw.acpi.battery.rate", p->rate_mib, &p->rate_len);
+    p->acpi_mwh = 0;
+    p->acpi_full_wh = -1.0;
+    if (p->acpi_fd >= 0) {
+        union acpi_battery_ioctl_arg arg;
+
+        snprintf(p->battery_dev, sizeof(p->battery_dev), "/dev/acpi");
+        p->charge_probe = "ACPIIO_BATT_GET_BATTINFO";
+        p->power_probe = "ACPIIO_BATT_GET_BATTINFO";
+
+        /* Remaining energy comes from _BST, in mWh only if _BIF says so */
+        memset(&arg, 0, sizeof(arg));
+        arg.unit = 0;
+        if (ioctl(p->acpi_fd, ACPIIO_BATT_GET_BIF, &arg) == 0 && arg.bif.units == 0) {
+            p->acpi_mwh = 1;
+            if (arg.bif.lfcap > 0 && arg.bif.lfcap != ACPI_BATT_UNKNOWN)
+                p->acpi_full_wh = (double)arg.bif.lfcap / 1000.0;
+            p->energy_probe = "ACPIIO_BATT_GET_BST";
+        }
+    } else if (p->life_len > 0) {
+        p->charge_probe = "hw.acpi.battery.life";
+        p->power_probe = p->rate_len > 0 ? "hw.acpi.battery.rate" : NULL;
+    } else {
+        p->battery_src = "dummy";
+    }
+
+    if (resolve_mib("dev.cpu.0.temperature", p->temp_mib, &p->temp_len) == 0)
+        p->thermal_probe = "dev.cpu.0.temperature";
+    else if (resolve_mib("hw.acpi.thermal.tz0.temperature", p->temp_mib, &p->temp_len) == 0)
+        p->thermal_probe = "hw.acpi.thermal.tz0.temperature";
+
+    resolve_mib("vm.stats.vm.v_page_count", p->pages_mib, &p->pages_len);
+    resolve_mib("vm.stats.vm.v_free_count", p->free_mib, &p->free_len);
+    resolve_mib("vm.stats.vm.v_inactive_count", p->inactive_mib, &p->inactive_len);
+    if (p->pages_len > 0 && p->free_len > 0 && p->inactive_len > 0)
+        p->memory_probe = "vm.stats.vm.v_{page,free,inactive}_count";
+
+    p->load_probe = "getloadavg";
+    return 0;
+}
+
+static void read_battery(struct probes *p, struct sample *s)
+{
+    union acpi_battery_ioctl_arg arg;
+    int value;
+
+    s->pct = PROBE_DUMMY_PCT;
+    s->watts = PROBE_DUMMY_WATTS;
+    s->src = p->battery_src;
+
+    if (p->acpi_fd >= 0) {
+        memset(&arg, 0, sizeof(arg));
+        arg.unit = 0;
+        if (ioctl(p->acpi_fd, ACPIIO_BATT_GET_BATTINFO, &arg) == 0 && arg.battinfo.cap >= 0) {
+            s->pct = (double)arg.battinfo.cap;
+            s->watts = arg.battinfo.rate > 0 ? (double)arg.battinfo.rate / 1000.0 : 0.0;
+            s->src = "acpiconf";
+            memset(&arg, 0, sizeof(arg));
+            arg.unit = 0;
+            if (p->acpi_mwh && ioctl(p->acpi_fd, ACPIIO_BATT_GET_BST, &arg) == 0 &&
+                arg.bst.cap != ACPI_BATT_UNKNOWN) {
+                s->battery_wh = (double)arg.bst.cap / 1000.0;
+                s->battery_full_wh = p->acpi_full_wh;
+            }
+            return;
+        }
+    }
+
+    /* Same fallback as get_battery_freebsd: hw.acpi.battery.* */
+    s->src = "sysctl";
+    if (read_mib_int(p->life_mib, p->life_len, &value) == 0)
+        s->pct = (double)value;
+    else
+        s->fallback |= PROBE_FALLBACK_CHARGE;
+    if (read_mib_int(p->rate_mib, p->rate_len, &value) == 0)
+        s->watts = (double)value / 1000.0;
+    else
+        s->fallback |= PROBE_FALLBACK_POWER;
+}
+
+static void read_load(struct probes *p, struct sample *s)
+{
+    double load[1];
+
+    (void)p;
+    if (getloadavg(load, 1) == 1) {
+        s->cpu_load = load[0];
+    } else {
+        s->cpu_load = PROBE_DUMMY_LOAD;
+        s->fallback |= PROBE_FALLBACK_LOAD;
+    }
+}
+
+static void read_memory(struct probes *p, struct sample *s)
+{
+    u_int pages, freep, inactive;
+
+    s->ram_pct = PROBE_DUMMY_RAM;
+    if (read_mib_uint(p->pages_mib, p->pages_len, &pages) == 0 && pages > 0 &&
+        read_mib_uint(p->free_mib, p->free_len, &freep) == 0 &&
+        read_mib_uint(p->inactive_mib, p->inactive_len, &inactive) == 0)
+        s->ram_pct = 100.0 * (double)(pages - freep - inactive) / (double)pages;
+    else
+        s->fallback |= PROBE_FALLBACK_MEMORY;
+}
+
+static void read_temperature(struct probes *p, struct sample *s)
+{
+    int decikelvin;
+
+    s->temp_c = PROBE_DUMMY_TEMP;
+    if (read_mib_int(p->temp_mib, p->temp_len, &decikelvin) == 0)
+        s->temp_c = (double)decikelvin / 10.0 - 273.15;
+    else
+        s->fallback |= PROBE_FALLBACK_THERMAL;
+}
+
+void probes_close(struct probes *p)
+{
+    if (p->acpi_fd >= 0)
+        close(p->acpi_fd);
+    p->acpi_fd = -1;
+}
+
+#elif defined(__OpenBSD__)
+
+static int probes_open_platform(struct probes *p)
+{
+    p->apm_fd = open("/dev/apm", O_RDONLY | O_CLOEXEC);
+    p->battery_src = p->apm_fd >= 0 ? "apm" : "dummy";
+    if (p->apm_fd >= 0) {
+        snprintf(p->battery_dev, sizeof(p->battery_dev), "/dev/apm");
+        p->charge_probe = "APM_IOC_GETPOWER";
+    }
+    p->load_probe = "getloadavg";
+    return 0;
+}
+
+static void read_battery(struct probes *p, struct sample *s)
+{
+    struct apm_power_info info;
+
+    s->pct = PROBE_DUMMY_PCT;
+    s->watts = PROBE_DUMMY_WATTS;   /* apm does not report power draw */
+    s->src = p->battery_src;
+    s->fallback |= PROBE_FALLBACK_POWER;
+
+    if (p->apm_fd >= 0 && ioctl(p->apm_fd, APM_IOC_GETPOWER, &info) == 0)
+        s->pct = (double)info.battery_life;
+    else
+        s->fallback |= PROBE_FALLBACK_CHARGE;
+}
+
+static void read_load(struct probes *p, struct sample *s)
+{
+    double load[1];
+
+    (void)p;
+    if (getloadavg(load, 1) == 1) {
+        s->cpu_load = load[0];
+    } else {
+        s->cpu_load = PROBE_DUMMY_LOAD;
+        s->fallback |= PROBE_FALLBACK_LOAD;
+    }
+}
+
+static void read_memory(struct probes *p, struct sample *s)
+{
+    (void)p;
+    s->ram_pct = PROBE_DUMMY_RAM;
+    s->fallback |= PROBE_FALLBACK_MEMORY;
+}
+
+static void read_temperature(struct probes *p, struct sample *s)
+{
+    (void)p;
+    s->temp_c = PROBE_DUMMY_TEMP;
+    s->fallback |= PROBE_FALLBACK_THERMAL;
+}
+
+void probes_close(struct probes *p)
+{
+    if (p->apm_fd >= 0)
+        close(p->apm_fd);
+    p->apm_fd = -1;
+}
+
+#else
+
+/*
+ * NetBSD (envsys proplib) and macOS (IOKit) have no fork-free probe yet;
+ * report dummy battery data like the shell collectors do without tools.
+ */
+static int probes_open_platform(struct probes *p)
+{
+    p->battery_src = "dummy";
+    p->load_probe = "getloadavg";
+    return 0;
+}
+
+static void read_battery(struct probes *p, struct sample *s)
+{
+    s->pct = PROBE_DUMMY_PCT;
+    s->watts = PROBE_DUMMY_WATTS;
+    s->src = p->battery_src;
+    s->fallback |= PROBE_FALLBACK_CHARGE | PROBE_FALLBACK_POWER;
+}
+
+static void read_load(struct probes *p, struct sample *s)
+{
+    double load[1];
+
+    (void)p;
+    if (getloadavg(load, 1) == 1) {
+        s->cpu_load = load[0];
+    } else {
+        s->cpu_load = PROBE_DUMMY_LOAD;
+        s->fallback |= PROBE_FALLBACK_LOAD;
+    }
+}
+
+static void read_memory(struct probes *p, struct sample *s)
+{
+    (void)p;
+    s->ram_pct = PROBE_DUMMY_RAM;
+    s->fallback |= PROBE_FALLBACK_MEMORY;
+}
+
+static void read_temperature(struct probes *p, struct sample *s)
+{
+    (void)p;
+    s->temp_c = PROBE_DUMMY_TEMP;
+    s->fallback |= PROBE_FALLBACK_THERMAL;
+}
+
+void probes_close(struct probes *p)
+{
+    (void)p;
+}
+
+#endif
+
+static void init_table(struct probes *p)
+{
+    int i;
+
+    p->battery_src = "dummy";
+    p->battery_dev[0] = '\0';
+    p->charge_probe = NULL;
+    p->power_probe = NULL;
+    p->load_probe = NULL;
+    p->memory_probe = NULL;
+    p->thermal_probe = NULL;
+    p->energy_probe = NULL;
+    p->rapl_probe = NULL;
+    p->mem_total_kb = 0;
+    for (i = 0; i < PROBE_KINDS; i++)
+        p->read_ns[i] = -1;
+}
+
+int probes_open(struct probes *p)
+{
+    init_table(p);
+    return probes_open_platform(p);
+}
+
+static void describe_field(FILE *out, const char *key, const char *value, int last)
+{
+    if (value != NULL && value[0] != '\0')
+        fprintf(out, "\"%s\": \"%s\"%s", key, value, last ? "" : ", ");
+    else
+        fprintf(out, "\"%s\": null%s", key, last ? "" : ", ");
+}
+
+void probes_describe(const struct probes *p, const struct cpu_probes *cpu, FILE *out)
+{
+    fprintf(out, "{\"collector\": \"native\", ");
+    describe_field(out, "platform", PROBE_PLATFORM, 0);
+    describe_field(out, "battery_source", p->battery_src, 0);
+    describe_field(out, "battery_device", p->battery_dev, 0);
+    describe_field(out, "charge", p->charge_probe, 0);
+    describe_field(out, "power", p->power_probe, 0);
+    describe_field(out, "load", p->load_probe, 0);
+    describe_field(out, "memory", p->memory_probe, 0);
+    describe_field(out, "thermal", p->thermal_probe, 0);
+    describe_field(out, "energy", p->energy_probe, 0);
+    describe_field(out, "cpu_util", cpu ? cpu->util_probe : NULL, 0);
+    describe_field(out, "cpu_freq", cpu ? cpu->freq_probe : NULL, 0);
+    describe_field(out, "cpu_cstate", cpu ? cpu->cstate_probe : NULL, 0);
+    describe_field(out, "rapl", p->rapl_probe, 1);
+    fprintf(out, "}\n");
+}
+
+static int64_t mono_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Charge the time since *t to probe kind and restart the clock */
+static void lap(struct probes *p, enum probe_kind kind, int64_t *t)
+{
+    int64_t now = mono_ns();
+
+    p->read_ns[kind] = now - *t;
+    *t = now;
+}
+
+void probes_read(struct probes *p, struct sample *s)
+{
+    int64_t t = mono_ns();
+
+    s->battery_wh = -1.0;
+    s->battery_full_wh = -1.0;
+    s->rapl_j = -1.0;
+    s->cpu_pct = -1.0;
+    s->fallback = 0;
+    read_battery(p, s);
+    lap(p, PROBE_BATTERY, &t);
+#if defined(__linux__)
+    if (p->rapl_probe != NULL) {
+        read_rapl(p, s);
+        lap(p, PROBE_RAPL, &t);
+    }
+#endif
+    read_load(p, s);
+    lap(p, PROBE_LOAD, &t);
+    read_memory(p, s);
+    lap(p, PROBE_MEMORY, &t);
+    read_temperature(p, s);
+    lap(p, PROBE_THERMAL, &t);
+}
@@ -0,0 +1,121 @@
+/*
+ * probe.h - Platform telemetry probes for batlab-sampler
+ *
+ * All device handles (sysfs file descriptors, sysctl MIBs, ioctl
+ * devices) are resolved once by probes_open() and kept open for the
+ * lifetime of the sampler, so probes_read() never forks and only
+ * performs the reads themselves.
+ */
+
+#ifndef BATLAB_PROBE_H
+#define BATLAB_PROBE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* Fallback values, identical to the shell collectors in bin/batlab */
+#define PROBE_DUMMY_PCT     50.0
+#define PROBE_DUMMY_WATTS   5.0
+#define PROBE_DUMMY_LOAD    0.10
+#define PROBE_DUMMY_RAM     50.0
+#define PROBE_DUMMY_TEMP    40.0
+
+#define PROBE_MIB_MAX       24
+
+/* Readings that fell back to the values above, in struct sample.fallback */
+#define PROBE_FALLBACK_CHARGE   0x01
+#define PROBE_FALLBACK_POWER    0x02
+#define PROBE_FALLBACK_LOAD     0x04
+#define PROBE_FALLBACK_MEMORY   0x08
+#define PROBE_FALLBACK_THERMAL  0x10
+#define PROBE_FALLBACKS         5
+
+/* Probes probes_read() times, in struct probes.read_ns */
+enum probe_kind {
+    PROBE_BATTERY,
+    PROBE_RAPL,
+    PROBE_LOAD,
+    PROBE_MEMORY,
+    PROBE_THERMAL,
+    PROBE_KINDS
+};
+
+struct sample {
+    double pct;
+    double watts;
+    double cpu_load;
+    double cpu_pct;             /* measured utilization, < 0 until known */
+    double ram_pct;
+    double temp_c;
+    const char *src;
+    /* Hardware energy counters, < 0 where the platform has none */
+    double battery_wh;          /* energy left in the battery */
+    double battery_full_wh;
+    double rapl_j;              /* cumulative RAPL package energy */
+    unsigned fallback;          /* PROBE_FALLBACK_* bits */
+};
+
+struct probes {
+#if defined(__linux__)
+    int bat_energy_now_fd;
+    int bat_energy_full_fd;
+    int bat_capacity_fd;
+    int bat_power_fd;
+    int bat_current_fd;
+    int bat_voltage_fd;
+    int bat_is_energy;          /* energy_* in uWh rather than charge_* in uAh */
+    int rapl_fd;
+    double rapl_range_j;        /* counter wraps after this many joules */
+    long long rapl_last_uj;
+    double rapl_total_j;
+    int loadavg_fd;
+    int meminfo_fd;
+    const char *mem_avail_key;
+    int thermal_fd;
+#elif defined(__FreeBSD__)
+    int acpi_fd;
+    int acpi_mwh;               /* battery reports capacity in mWh, not mAh */
+    double acpi_full_wh;
+    int life_mib[PROBE_MIB_MAX];
+    size_t life_len;
+    int rate_mib[PROBE_MIB_MAX];
+    size_t rate_len;
+    int temp_mib[PROBE_MIB_MAX];
+    size_t temp_len;
+    int pages_mib[PROBE_MIB_MAX];
+    size_t pages_len;
+    int free_mib[PROBE_MIB_MAX];
+    size_t free_len;
+    int inactive_mib[PROBE_MIB_MAX];
+    size_t inactive_len;
+#elif defined(__OpenBSD__)
+    int apm_fd;
+#endif
+    /* Capability table resolved at startup, see probes_describe() */
+    const char *battery_src;
+    char battery_dev[256];
+    const char *charge_probe;
+    const char *power_probe;
+    const char *load_probe;
+    const char *memory_probe;
+    const char *thermal_probe;
+    const char *energy_probe;
+    const char *rapl_probe;
+    long mem_total_kb;
+    /* Time the last probes_read() spent in each probe, < 0 if not read */
+    int64_t read_ns[PROBE_KINDS];
+};
+
+struct cpu_probes;
+
+int probes_open(struct probes *p);
+/*
+ * Write the resolved capability table as a single JSON object, with the
+ * per-core sources of cpu when it is not NULL (see cpu.h)
+ */
+void probes_describe(const struct probes *p, const struct cpu_probes *cpu, FILE *out);
+void probes_read(struct probes *p, struct sample *s);
+void probes_close(struct probes *p);
+
+#endif /* BATLAB_PROBE_H */
@@ -0,0 +1,459 @@
+/*
+ * push.c - Stream samples from batlab-sampler to batlab-aggregator
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(BATLAB_ZLIB)
+#include <zlib.h>
+#endif
+
+#include "push.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0          /* SIGPIPE is ignored in push_open */
+#endif
+
+#define PUSH_BACKOFF_MIN_NS 1000000000LL
+#define PUSH_BACKOFF_MAX_NS 60000000000LL
+
+enum {
+    PUSH_IDLE,
+    PUSH_CONNECTING,
+    PUSH_SENDING,
+    PUSH_RECEIVING
+};
+
+static int64_t now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+int push_open(struct push *p, const char *url, const char *run)
+{
+    struct addrinfo hints, *res;
+    char host[256];
+    const char *port = PUSH_DEFAULT_PORT;
+    const char *hp = url;
+    const char *token = getenv("BATLAB_TOKEN");
+    const char *end, *colon;
+    size_t n;
+
+    memset(p, 0, sizeof(*p));
+    p->fd = -1;
+    p->kind = "samples";
+    p->url = url;
+#if defined(BATLAB_ZLIB)
+    p->gzip = 1;
+#endif
+
+    if (strncmp(hp, "http://", 7) == 0)
+        hp += 7;
+    else if (strstr(hp, "://") != NULL)
+        return -1;              /* plain HTTP only */
+    end = strchr(hp, '/');
+    n = end != NULL ? (size_t)(end - hp) : strlen(hp);
+    if (n == 0 || n >= sizeof(p->host) || strlen(run) == 0 || strlen(run) >= sizeof(p->run))
+        return -1;
+    memcpy(p->host, hp, n);
+    p->host[n] = '\0';
+    strcpy(p->run, run);
+    if (token != NULL && *token != '\0') {
+        if (strlen(token) >= sizeof(p->token) || strpbrk(token, "\r\n") != NULL)
+            return -1;
+        strcpy(p->token, token);
+    }
+
+    /* [v6]:port, host:port or a bare host */
+    memcpy(host, p->host, n + 1);
+    if (host[0] == '[' && (end = strchr(host, ']')) != NULL) {
+        colon = end[1] == ':' ? end + 1 : NULL;
+        host[end - host] = '\0';
+        memmove(host, host + 1, strlen(host));
+        if (colon != NULL)
+            port = p->host + (colon - host) + 1;
+    } else if ((colon = strrchr(host, ':')) != NULL) {
+        host[colon - host] = '\0';
+        port = colon + 1;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &res) != 0)
+        return -1;
+    memcpy(&p->addr, res->ai_addr, res->ai_addrlen);
+    p->addr_len = res->ai_addrlen;
+    freeaddrinfo(res);
+
+    /* An aggregator closing the connection must not kill the sampler */
+    signal(SIGPIPE, SIG_IGN);
+    return 0;
+}
+
+void push_add(struct push *p, const char *line, size_t len)
+{
+    if (p->len + len > PUSH_QUEUE_MAX) {
+        p->dropped_bytes += len;
+        return;
+    }
+    if (p->len + len > p->cap) {
+        size_t cap = p->cap ? p->cap : 65536;
+        char *grown;
+
+        while (cap < p->len + len)
+            cap *= 2;
+        grown = realloc(p->queue, cap);
+        if (grown == NULL) {
+            p->dropped_bytes += len;
+            return;
+        }
+        p->queue = grown;
+        p->cap = cap;
+    }
+    memcpy(p->queue + p->len, line, len);
+    p->len += len;
+}
+
+void push_release(struct push *p)
+{
+    p->ready = p->len;
+}
+
+int push_active(const struct push *p)
+{
+    return p->fd >= 0 || (p->ready > 0 && now_ns() >= p->retry_ns);
+}
+
+static void finish(struct push *p)
+{
+    if (p->fd >= 0)
+        close(p->fd);
+    p->fd = -1;
+    p->state = PUSH_IDLE;
+}
+
+static void fail(struct push *p)
+{
+    finish(p);
+    p->failures++;
+    p->backoff_ns = p->backoff_ns == 0 ? PUSH_BACKOFF_MIN_NS : p->backoff_ns * 2;
+    if (p->backoff_ns > PUSH_BACKOFF_MAX_NS)
+        p->backoff_ns = PUSH_BACKOFF_MAX_NS;
+    p->retry_ns = now_ns() + p->backoff_ns;
+}
+
+static void succeed(struct push *p)
+{
+    finish(p);
+    memmove(p->queue, p->queue + p->batch, p->len - p->batch);
+    p->len -= p->batch;
+    p->ready -= p->batch;
+    p->offset += p->batch;
+    p->batches++;
+    p->raw_bytes += p->batch;
+    p->sent_bytes += p->body != NULL && p->body_len > 0 ? p->body_len : p->batch;
+    p->batch = 0;
+    p->backoff_ns = 0;
+    p->retry_ns = 0;
+}
+
+#if defined(BATLAB_ZLIB)
+/* gzip the batch at the fastest level: samples compress well even then,
+ * and the CPU time is taken from the laptop being measured */
+static int deflate_batch(struct push *p)
+{
+    z_stream z;
+    uLong bound;
+    int rc;
+
+    memset(&z, 0, sizeof(z));
+    if (deflateInit2(&z, 1, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return -1;
+    bound = deflateBound(&z, (uLong)p->batch);
+    if (bound > p->body_cap) {
+        unsigned char *grown = realloc(p->body, bound);
+
+        if (grown == NULL) {
+            deflateEnd(&z);
+            return -1;
+        }
+        p->body = grown;
+        p->body_cap = bound;
+    }
+    z.next_in = (Bytef *)p->queue;
+    z.avail_in = (uInt)p->batch;
+    z.next_out = p->body;
+    z.avail_out = (uInt)bound;
+    rc = deflate(&z, Z_FINISH);
+    p->body_len = (size_t)z.total_out;
+    deflateEnd(&z);
+    return rc == Z_STREAM_END ? 0 : -1;
+}
+#endif
+
+/* Take the next batch off the queue and begin a request for it */
+static void start(struct push *p)
+{
+    int samples = strcmp(p->kind, "samples") == 0;
+    int gzip = 0;
+    int n;
+
+    p->batch = p->ready;
+    if (samples && p->batch > PUSH_BATCH_MAX) {
+        /* Whole lines only, so every request stands on its own */
+        p->batch = PUSH_BATCH_MAX;
+        while (p->batch > 0 && p->queue[p->batch - 1] != '\n')
+            p->batch--;
+        if (p->batch == 0)
+            p->batch = PUSH_BATCH_MAX;
+    }
+    p->body_len = 0;
+#if defined(BATLAB_ZLIB)
+    gzip = p->gzip && deflate_batch(p) == 0;
+#endif
+    if (!gzip)
+        p->body_len = 0;
+
+    n = snprintf(p->head, sizeof(p->head),
+        "%s /runs/%s/%s HTTP/1.1\r\n"
+        "Host: %s\r\n"
+        "Content-Type: %s\r\n"
+        "%s"
+        "%s%s%s"
+        "X-Batlab-Offset: %llu\r\n"
+        "Content-Length: %lu\r\n"
+        "Connection: close\r\n"
+        "\r\n",
+        samples ? "POST" : "PUT", p->run, p->kind, p->host,
+        strcmp(p->kind, "meta") == 0 ? "application/json" : "application/x-ndjson",
+        gzip ? "Content-Encoding: gzip\r\n" : "",
+        p->token[0] ? "X-Batlab-Token: " : "", p->token, p->token[0] ? "\r\n" : "",
+        (unsigned long long)p->offset,
+        (unsigned long)(gzip ? p->body_len : p->batch));
+    if (n < 0 || (size_t)n >= sizeof(p->head)) {
+        fail(p);
+        return;
+    }
+    p->head_len = (size_t)n;
+    p->sent = 0;
+    p->resp_len = 0;
+    p->started_ns = now_ns();
+
+    p->fd = socket(p->addr.ss_family, SOCK_STREAM, 0);
+    if (p->fd < 0) {
+        fail(p);
+        return;
+    }
+    fcntl(p->fd, F_SETFL, fcntl(p->fd, F_GETFL) | O_NONBLOCK);
+    fcntl(p->fd, F_SETFD, FD_CLOEXEC);
+    if (connect(p->fd, (struct sockaddr *)&p->addr, p->addr_len) == 0)
+        p->state = PUSH_SENDING;
+    else if (errno == EINPROGRESS)
+        p->state = PUSH_CONNECTING;
+    else
+        fail(p);
+}
+
+/* Send as much of the request as the socket takes; 1 once it is all out */
+static int send_some(struct push *p)
+{
+    size_t body_len = p->body_len > 0 ? p->body_len : p->batch;
+
+    while (p->sent < p->head_len + body_len) {
+        const char *src;
+        size_t left;
+        ssize_t n;
+
+        if (p->sent < p->head_len) {
+            src = p->head + p->sent;
+            left = p->head_len - p->sent;
+        } else {
+            /* An uncompressed body is sent straight from the queue */
+            src = p->body_len > 0 ? (const char *)p->body : p->queue;
+            src += p->sent - p->head_len;
+            left = p->head_len + body_len - p->sent;
+        }
+        n = send(p->fd, src, left, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+        p->sent += (size_t)n;
+    }
+    return 1;
+}
+
+/* Read the answer, which ends when the aggregator closes the connection;
+ * -1 on error, 0 until it is complete, else the status */
+static int read_status(struct push *p)
+{
+    ssize_t n = recv(p->fd, p->resp + p->resp_len, sizeof(p->resp) - 1 - p->resp_len, MSG_DONTWAIT);
+    int status;
+
+    if (n < 0)
+        return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR ? 0 : -1;
+    p->resp_len += (size_t)n;
+    p->resp[p->resp_len] = '\0';
+    if (n > 0 && p->resp_len < sizeof(p->resp) - 1)
+        return 0;
+    if (sscanf(p->resp, "HTTP/%*d.%*d %d", &status) != 1)
+        return -1;
+    return status;
+}
+
+/* The stream offset a 409 answer says the aggregator holds; -1 if none */
+static int64_t conflict_offset(const struct push *p)
+{
+    const char *o = strstr(p->resp, "\"offset\":");
+    char *end;
+    unsigned long long off;
+
+    if (o == NULL)
+        return -1;
+    off = strtoull(o + 9, &end, 10);
+    return end == o + 9 ? -1 : (int64_t)off;
+}
+
+void push_poll(struct push *p, int timeout_ms)
+{
+    struct pollfd pfd;
+    int64_t off;
+    int status;
+
+    if (p->fd < 0) {
+        if (p->ready == 0 || now_ns() < p->retry_ns)
+            return;
+        start(p);
+        if (p->fd < 0)
+            return;
+    }
+    if (now_ns() - p->started_ns > (int64_t)PUSH_TIMEOUT_MS * 1000000) {
+        fail(p);
+        return;
+    }
+
+    pfd.fd = p->fd;
+    pfd.events = p->state == PUSH_RECEIVING ? POLLIN : POLLOUT;
+    pfd.revents = 0;
+    if (poll(&pfd, 1, timeout_ms) <= 0)
+        return;
+
+    if (p->state == PUSH_CONNECTING) {
+        int err = 0;
+        socklen_t len = sizeof(err);
+
+        if (getsockopt(p->fd, SOL_SOCKET, SO_ERROR, &err, &len) != 0 || err != 0) {
+            fail(p);
+            return;
+        }
+        p->state = PUSH_SENDING;
+    }
+    if (p->state == PUSH_SENDING) {
+        int rc = send_some(p);
+
+        if (rc < 0)
+            fail(p);
+        else if (rc > 0)
+            p->state = PUSH_RECEIVING;
+        return;
+    }
+
+    status = read_status(p);
+    if (status == 0)
+        return;
+    if (status >= 200 && status < 300) {
+        succeed(p);
+    } else if (status == 415 && p->gzip) {
+        /* An aggregator built without zlib: resend uncompressed at once */
+        p->gzip = 0;
+        finish(p);
+    } else if (status == 409 && (off = conflict_offset(p)) >= 0 && (uint64_t)off < p->offset) {
+        /* The aggregator lost what it acknowledged; the queue goes on
+         * from its end of the stream, the lost part stays local only */
+        p->offset = (uint64_t)off;
+        p->failures++;
+        finish(p);
+    } else {
+        fail(p);
+    }
+}
+
+int push_drain(struct push *p, int timeout_ms)
+{
+    int64_t deadline = now_ns() + (int64_t)timeout_ms * 1000000;
+    uint64_t failures = p->failures;
+
+    push_release(p);
+    p->retry_ns = 0;            /* one more attempt, whatever the backoff */
+    while ((p->ready > 0 || p->fd >= 0) && p->failures == failures) {
+        int64_t left = deadline - now_ns();
+
+        if (left <= 0)
+            break;
+        push_poll(p, left > 100000000 ? 100 : (int)(left / 1000000) + 1);
+    }
+    finish(p);
+    return p->len == 0 ? 0 : -1;
+}
+
+void push_write_stats(const struct push *p, FILE *f)
+{
+    fprintf(f,
+        "push {\"url\": \"%s\", \"batches\": %llu, \"raw_bytes\": %llu, \"sent_bytes\": %llu, "
+        "\"failures\": %llu, \"dropped_bytes\": %llu, \"unsent_bytes\": %llu}\n",
+        p->url, (unsigned long long)p->batches, (unsigned long long)p->raw_bytes,
+        (unsigned long long)p->sent_bytes, (unsigned long long)p->failures,
+        (unsigned long long)p->dropped_bytes, (unsigned long long)p->len);
+}
+
+void push_close(struct push *p)
+{
+    finish(p);
+    free(p->queue);
+    free(p->body);
+    p->queue = NULL;
+    p->body = NULL;
+    p->len = p->cap = p->ready = 0;
+}
+
+int push_file(const char *url, const char *run, const char *kind, const char *path)
+{
+    static struct push p;
+    FILE *f;
+    char buf[8192];
+    size_t n;
+    int rc;
+
+    if (push_open(&p, url, run) != 0)
+        return -1;
+    f = fopen(path, "rb");
+    if (f == NULL)
+        return -1;
+    while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+        push_add(&p, buf, n);
+    fclose(f);
+    if (p.dropped_bytes > 0) {
+        push_close(&p);
+        return -1;
+    }
+
+    /* A file goes as one request, however large */
+    p.kind = kind;
+    rc = p.len > 0 ? push_drain(&p, PUSH_TIMEOUT_MS) : 0;
+    push_close(&p);
+    return rc;
+}
@@ -0,0 +1,102 @@
+/*
+ * push.h - Stream samples from batlab-sampler to batlab-aggregator
+ *
+ * With --push, every sample is also queued for a central aggregator.
+ * A writer flush releases the queued samples as one batch, which is
+ * gzip-compressed and sent as a single HTTP request:
+ *
+ *   POST /runs/RUN_ID/samples
+ *   X-Batlab-Offset: N          stream offset of the batch's first byte
+ *
+ * The connection is non-blocking and polled from the sampling loop
+ * between deadlines, like the live view, so a slow or unreachable
+ * aggregator never delays a sample. A batch leaves the queue only once
+ * the aggregator answers 2xx, which it does after the batch is on disk;
+ * failures are retried with exponential backoff, and the offset lets the
+ * aggregator drop the part of a retried batch it already holds. An
+ * aggregator that holds less than it acknowledged, its store lost,
+ * answers 409 with its own offset, and the queue resumes from there. The
+ * local JSONL file is written as before and stays the primary copy: a
+ * queue that outgrows PUSH_QUEUE_MAX drops new samples for the
+ * aggregator, never for the file.
+ *
+ * Run metadata and workload markers are pushed whole, with PUT
+ * /runs/RUN_ID/meta and /runs/RUN_ID/events (push_file).
+ *
+ * When BATLAB_TOKEN is set, every request carries it as an
+ * X-Batlab-Token header, for an aggregator started with the same token.
+ */
+
+#ifndef BATLAB_PUSH_H
+#define BATLAB_PUSH_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/socket.h>
+
+#define PUSH_DEFAULT_PORT "9107"    /* batlab-aggregator's default */
+#define PUSH_RUN_MAX    128
+#define PUSH_TOKEN_MAX  128
+#define PUSH_QUEUE_MAX  (8u << 20)  /* about 8 hours of samples at 1 Hz */
+#define PUSH_BATCH_MAX  (1u << 20)  /* raw bytes per request */
+#define PUSH_TIMEOUT_MS 30000       /* connect, send and answer */
+#define PUSH_DRAIN_MS   5000        /* on exit, for the last batches */
+
+struct push {
+    int fd;                         /* request in flight, -1 when idle */
+    int state;
+    struct sockaddr_storage addr;
+    socklen_t addr_len;
+    char host[256];                 /* Host header */
+    char run[PUSH_RUN_MAX];
+    char token[PUSH_TOKEN_MAX];     /* BATLAB_TOKEN, "" when unset */
+    const char *kind;               /* "samples", or the file push_file sends */
+    char *queue;                    /* samples not yet acknowledged */
+    size_t len;
+    size_t cap;
+    size_t ready;                   /* queued bytes released by a flush */
+    size_t batch;                   /* queued bytes in the request in flight */
+    uint64_t offset;                /* stream offset of queue[0] */
+    char head[768];
+    size_t head_len;
+    unsigned char *body;
+    size_t body_len;
+    size_t body_cap;
+    size_t sent;                    /* of head_len + body_len */
+    char resp[256];                 /* the answer, until the aggregator closes */
+    size_t resp_len;
+    int gzip;                       /* cleared when the aggregator refuses it */
+    int64_t started_ns;
+    int64_t retry_ns;
+    int64_t backoff_ns;
+
+    uint64_t batches;
+    uint64_t raw_bytes;
+    uint64_t sent_bytes;
+    uint64_t failures;
+    uint64_t dropped_bytes;
+    const char *url;
+};
+
+/* Resolve url, "http://HOST:PORT" or "HOST:PORT", for run; -1 if it does not
+ * or BATLAB_TOKEN is not a valid header value */
+int push_open(struct push *p, const char *url, const char *run);
+/* Queue one JSONL line */
+void push_add(struct push *p, const char *line, size_t len);
+/* Release everything queued so far; called after each writer flush */
+void push_release(struct push *p);
+/* Whether push_poll has work now: a request in flight or one to start */
+int push_active(const struct push *p);
+/* Start, advance or finish a request, waiting up to timeout_ms */
+void push_poll(struct push *p, int timeout_ms);
+/* Release and send the rest of the queue, for at most timeout_ms */
+int push_drain(struct push *p, int timeout_ms);
+/* Write the counters as a "push {json}" stats line */
+void push_write_stats(const struct push *p, FILE *f);
+void push_close(struct push *p);
+
+/* PUT a whole file (kind "meta" or "events") for run; blocks, 0 on 2xx */
+int push_file(const char *url, const char *run, const char *kind, const char *path);
+
+#endif /* BATLAB_PUSH_H */
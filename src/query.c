@@ -0,0 +1,645 @@
+/*
+ * query.c - SQL-ish queries across the .batc run store
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+
+#include "batc.h"
+#include "jsonl.h"
+#include "query.h"
+#include "stats.h"
+
+#define QUERY_AGGS_MAX   8
+#define QUERY_CONDS_MAX  16
+#define QUERY_GROUPS_MAX 1024
+#define QUERY_STR_MAX    128
+
+enum { FN_COUNT, FN_SUM, FN_AVG, FN_MIN, FN_MAX };
+enum { OP_EQ, OP_NE, OP_LT, OP_LE, OP_GT, OP_GE, OP_LIKE };
+enum { FIELD_COLUMN, FIELD_TIME, FIELD_RUN };
+enum { ZONE_NONE, ZONE_SOME, ZONE_ALL };
+enum { TOK_END, TOK_WORD, TOK_NUM, TOK_STR, TOK_PUNCT, TOK_BAD };
+
+static const char *const fn_names[] = { "count", "sum", "avg", "min", "max" };
+static const char *const op_names[] = { "=", "!=", "<", "<=", ">", ">=", "like" };
+
+/* Run fields, read from each run's metadata */
+static const char *const run_fields[] = { "host", "os", "config", "run_id" };
+#define RUN_FIELDS 4
+
+static const struct {
+    const char *name;
+    enum batc_col col;
+} columns[] = {
+    { "pct",      BATC_COL_PCT },
+    { "watts",    BATC_COL_WATTS },
+    { "cpu_load", BATC_COL_CPU_LOAD },
+    { "cpu_pct",  BATC_COL_CPU_PCT },
+    { "ram_pct",  BATC_COL_RAM_PCT },
+    { "temp_c",   BATC_COL_TEMP_C }
+};
+#define NCOLUMNS ((int)(sizeof(columns) / sizeof(columns[0])))
+
+struct agg {
+    int fn;
+    int col;                    /* batc column, -1 for count(*) */
+    char label[32];
+};
+
+struct cond {
+    int field;
+    int col;                    /* batc column, or run field index */
+    int op;
+    double num;
+    int64_t t_ns;
+    char str[QUERY_STR_MAX];
+};
+
+struct group {
+    char key[QUERY_STR_MAX];
+    unsigned runs;
+    uint64_t rows;
+    uint64_t n[QUERY_AGGS_MAX];
+    double sum[QUERY_AGGS_MAX];
+    double min[QUERY_AGGS_MAX];
+    double max[QUERY_AGGS_MAX];
+};
+
+struct query {
+    struct agg aggs[QUERY_AGGS_MAX];
+    int naggs;
+    struct cond conds[QUERY_CONDS_MAX];
+    int nconds;
+    int group_by;               /* run field index, -1 for none */
+    int count_only;             /* every aggregate is count(*) */
+    struct group *groups;
+    int ngroups;
+
+    unsigned runs_scanned;
+    unsigned runs_pruned;
+    uint64_t blocks_read;
+    uint64_t blocks_whole;
+    uint64_t blocks_skipped;
+    uint64_t rows_read;
+};
+
+struct lexer {
+    const char *p;
+    int kind;
+    char tok[QUERY_STR_MAX];
+    double num;
+};
+
+static void log_error(const char *msg, const char *arg)
+{
+    fprintf(stderr, "[ERROR] %s%s\n", msg, arg ? arg : "");
+}
+
+static void next(struct lexer *lx)
+{
+    const char *p = lx->p;
+    size_t n = 0;
+
+    while (isspace((unsigned char)*p))
+        p++;
+    lx->tok[0] = '\0';
+    if (*p == '\0') {
+        lx->kind = TOK_END;
+    } else if (isalpha((unsigned char)*p) || *p == '_') {
+        while ((isalnum((unsigned char)*p) || *p == '_') && n + 1 < sizeof(lx->tok))
+            lx->tok[n++] = *p++;
+        lx->tok[n] = '\0';
+        lx->kind = TOK_WORD;
+    } else if (isdigit((unsigned char)*p) || *p == '.' ||
+               (*p == '-' && (isdigit((unsigned char)p[1]) || p[1] == '.'))) {
+        char *end;
+
+        lx->num = strtod(p, &end);
+        snprintf(lx->tok, sizeof(lx->tok), "%.*s", (int)(end - p), p);
+        p = end;
+        lx->kind = TOK_NUM;
+    } else if (*p == '\'' || *p == '"') {
+        char quote = *p++;
+
+        while (*p != '\0' && *p != quote && n + 1 < sizeof(lx->tok))
+            lx->tok[n++] = *p++;
+        lx->tok[n] = '\0';
+        lx->kind = *p == quote ? TOK_STR : TOK_BAD;
+        if (*p == quote)
+            p++;
+    } else {
+        if ((p[0] == '!' || p[0] == '<' || p[0] == '>') && p[1] == '=')
+            n = 2;
+        else if (p[0] == '<' && p[1] == '>')
+            n = 2;
+        else
+            n = strchr("=<>(),*", *p) != NULL ? 1 : 0;
+        lx->kind = n > 0 ? TOK_PUNCT : TOK_BAD;
+        snprintf(lx->tok, sizeof(lx->tok), "%.*s", n > 0 ? (int)n : 1, p);
+        p += n > 0 ? n : 1;
+    }
+    lx->p = p;
+}
+
+static int is_word(const struct lexer *lx, const char *w)
+{
+    return lx->kind == TOK_WORD && strcasecmp(lx->tok, w) == 0;
+}
+
+static int is_punct(const struct lexer *lx, const char *s)
+{
+    return lx->kind == TOK_PUNCT && strcmp(lx->tok, s) == 0;
+}
+
+static int syntax(const char *msg, const struct lexer *lx)
+{
+    char near[QUERY_STR_MAX + 64];
+
+    snprintf(near, sizeof(near), "%s near '%s'", msg, lx->kind == TOK_END ? "end" : lx->tok);
+    log_error("Invalid query: ", near);
+    return -1;
+}
+
+static int column_index(const char *name)
+{
+    int i;
+
+    for (i = 0; i < NCOLUMNS; i++)
+        if (strcasecmp(columns[i].name, name) == 0)
+            return i;
+    return -1;
+}
+
+static int run_field_index(const char *name)
+{
+    int i;
+
+    for (i = 0; i < RUN_FIELDS; i++)
+        if (strcasecmp(run_fields[i], name) == 0)
+            return i;
+    return -1;
+}
+
+static int parse_agg(struct lexer *lx, struct agg *a)
+{
+    int c = -1;
+
+    if (lx->kind != TOK_WORD)
+        return syntax("expected an aggregate", lx);
+    for (a->fn = 0; a->fn <= FN_MAX && strcasecmp(lx->tok, fn_names[a->fn]) != 0; a->fn++)
+        ;
+    if (is_word(lx, "mean"))
+        a->fn = FN_AVG;
+    if (a->fn > FN_MAX)
+        return syntax("unknown aggregate", lx);
+    next(lx);
+    a->col = -1;
+    if (a->fn == FN_COUNT && !is_punct(lx, "(")) {
+        snprintf(a->label, sizeof(a->label), "count");
+        return 0;
+    }
+    if (!is_punct(lx, "("))
+        return syntax("expected '('", lx);
+    next(lx);
+    if (a->fn == FN_COUNT && is_punct(lx, "*")) {
+        snprintf(a->label, sizeof(a->label), "count");
+    } else {
+        if (lx->kind != TOK_WORD || (c = column_index(lx->tok)) < 0)
+            return syntax("unknown column", lx);
+        a->col = (int)columns[c].col;
+        snprintf(a->label, sizeof(a->label), "%s(%s)", fn_names[a->fn], columns[c].name);
+    }
+    next(lx);
+    if (!is_punct(lx, ")"))
+        return syntax("expected ')'", lx);
+    next(lx);
+    return 0;
+}
+
+static int parse_cond(struct lexer *lx, struct cond *c)
+{
+    int i;
+
+    if (lx->kind != TOK_WORD)
+        return syntax("expected a column or run field", lx);
+    if (strcasecmp(lx->tok, "t") == 0) {
+        c->field = FIELD_TIME;
+    } else if ((i = column_index(lx->tok)) >= 0) {
+        c->field = FIELD_COLUMN;
+        c->col = (int)columns[i].col;
+    } else if ((i = run_field_index(lx->tok)) >= 0) {
+        c->field = FIELD_RUN;
+        c->col = i;
+    } else {
+        return syntax("unknown column or run field", lx);
+    }
+    next(lx);
+
+    for (c->op = 0; c->op <= OP_LIKE; c->op++)
+        if ((lx->kind == TOK_PUNCT && strcmp(lx->tok, op_names[c->op]) == 0) ||
+            (c->op == OP_LIKE && is_word(lx, "like")))
+            break;
+    if (is_punct(lx, "<>"))
+        c->op = OP_NE;
+    if (c->op > OP_LIKE)
+        return syntax("expected a comparison", lx);
+    if (c->op == OP_LIKE && c->field != FIELD_RUN)
+        return syntax("like compares run fields only", lx);
+    next(lx);
+
+    if (c->field == FIELD_COLUMN) {
+        if (lx->kind != TOK_NUM)
+            return syntax("expected a number", lx);
+        c->num = lx->num;
+    } else if (c->field == FIELD_TIME) {
+        if (lx->kind != TOK_STR || jsonl_parse_time(lx->tok, strlen(lx->tok), &c->t_ns) != 0)
+            return syntax("expected an ISO 8601 time", lx);
+    } else {
+        if (lx->kind != TOK_STR && lx->kind != TOK_WORD && lx->kind != TOK_NUM)
+            return syntax("expected a string", lx);
+        snprintf(c->str, sizeof(c->str), "%s", lx->tok);
+    }
+    next(lx);
+    return 0;
+}
+
+static int parse(const char *text, struct query *q)
+{
+    struct lexer lx;
+    int i;
+
+    lx.p = text;
+    next(&lx);
+    if (is_word(&lx, "select"))
+        next(&lx);
+    do {
+        if (q->naggs > 0)
+            next(&lx);
+        if (q->naggs == QUERY_AGGS_MAX)
+            return syntax("too many aggregates", &lx);
+        if (parse_agg(&lx, &q->aggs[q->naggs++]) != 0)
+            return -1;
+    } while (is_punct(&lx, ","));
+
+    if (is_word(&lx, "where")) {
+        do {
+            next(&lx);
+            if (q->nconds == QUERY_CONDS_MAX)
+                return syntax("too many conditions", &lx);
+            if (parse_cond(&lx, &q->conds[q->nconds++]) != 0)
+                return -1;
+        } while (is_word(&lx, "and"));
+    }
+
+    q->group_by = -1;
+    if (is_word(&lx, "group")) {
+        next(&lx);
+        if (!is_word(&lx, "by"))
+            return syntax("expected 'by'", &lx);
+        next(&lx);
+        if (lx.kind != TOK_WORD || (q->group_by = run_field_index(lx.tok)) < 0)
+            return syntax("can only group by host, os, config or run_id", &lx);
+        next(&lx);
+    }
+    if (lx.kind != TOK_END)
+        return syntax("unexpected", &lx);
+
+    q->count_only = 1;
+    for (i = 0; i < q->naggs; i++)
+        if (q->aggs[i].col >= 0)
+            q->count_only = 0;
+    return 0;
+}
+
+/* SQL LIKE, case-insensitive: % any run of characters, _ any one */
+static int like(const char *s, const char *pat)
+{
+    for (; *pat != '\0'; pat++, s++) {
+        if (*pat == '%') {
+            while (pat[1] == '%')
+                pat++;
+            if (pat[1] == '\0')
+                return 1;
+            for (; *s != '\0'; s++)
+                if (like(s, pat + 1))
+                    return 1;
+            return 0;
+        }
+        if (*s == '\0' || (*pat != '_' && tolower((unsigned char)*pat) != tolower((unsigned char)*s)))
+            return 0;
+    }
+    return *s == '\0';
+}
+
+static int compare(int op, double a, double b)
+{
+    switch (op) {
+    case OP_EQ: return a == b;
+    case OP_NE: return a != b;
+    case OP_LT: return a < b;
+    case OP_LE: return a <= b;
+    case OP_GT: return a > b;
+    case OP_GE: return a >= b;
+    }
+    return 0;
+}
+
+static int run_matches(const struct cond *c, const char *value)
+{
+    return c->op == OP_LIKE ? like(value, c->str) : compare(c->op, strcmp(value, c->str), 0);
+}
+
+/* Whether any, or every, value in [lo, hi] satisfies op v */
+static int zone_test(int op, double v, double lo, double hi)
+{
+    switch (op) {
+    case OP_EQ: return v < lo || v > hi ? ZONE_NONE : lo == hi ? ZONE_ALL : ZONE_SOME;
+    case OP_NE: return lo == v && hi == v ? ZONE_NONE : v < lo || v > hi ? ZONE_ALL : ZONE_SOME;
+    case OP_LT: return lo >= v ? ZONE_NONE : hi < v ? ZONE_ALL : ZONE_SOME;
+    case OP_LE: return lo > v ? ZONE_NONE : hi <= v ? ZONE_ALL : ZONE_SOME;
+    case OP_GT: return hi <= v ? ZONE_NONE : lo > v ? ZONE_ALL : ZONE_SOME;
+    case OP_GE: return hi < v ? ZONE_NONE : lo >= v ? ZONE_ALL : ZONE_SOME;
+    }
+    return ZONE_SOME;
+}
+
+static int nullable(int col)
+{
+    return col == BATC_COL_TEMP_C || col == BATC_COL_CPU_PCT;
+}
+
+/* A cell's value; 0 when it is missing */
+static int cell(const struct batc *b, int col, uint64_t row, double *v)
+{
+    int64_t raw;
+
+    if (!batc_has(b, (enum batc_col)col))
+        return 0;
+    raw = batc_raw(b, (enum batc_col)col, row);
+    if ((col == BATC_COL_TEMP_C && raw == BATC_TEMP_NULL) ||
+        (col == BATC_COL_CPU_PCT && raw == BATC_U16_NULL))
+        return 0;
+    *v = batc_decode(b, (enum batc_col)col, raw);
+    return 1;
+}
+
+/* The block's combined zone map verdict over the column and time conditions */
+static int zone_verdict(const struct query *q, const struct batc *b, uint64_t z, const double *t_ms)
+{
+    int verdict = ZONE_ALL;
+    int i;
+
+    for (i = 0; i < q->nconds; i++) {
+        const struct cond *c = &q->conds[i];
+        int64_t lo, hi;
+        int col = c->field == FIELD_TIME ? BATC_COL_T : c->col;
+        int v;
+
+        if (c->field == FIELD_RUN)
+            continue;
+        if (batc_zone(b, z, (enum batc_col)col, &lo, &hi) != 0)
+            return ZONE_NONE;   /* every value in the block is missing */
+        if (c->field == FIELD_TIME)
+            v = zone_test(c->op, t_ms[i], (double)lo, (double)hi);
+        else
+            v = zone_test(c->op, c->num, batc_decode(b, (enum batc_col)col, lo),
+                          batc_decode(b, (enum batc_col)col, hi));
+        if (v == ZONE_ALL && nullable(col))
+            v = ZONE_SOME;      /* the range says nothing of missing values */
+        if (v == ZONE_NONE)
+            return ZONE_NONE;
+        if (v == ZONE_SOME)
+            verdict = ZONE_SOME;
+    }
+    return verdict;
+}
+
+static int row_matches(const struct query *q, const struct batc *b, uint64_t row, int64_t ms,
+                       const double *t_ms)
+{
+    int i;
+
+    for (i = 0; i < q->nconds; i++) {
+        const struct cond *c = &q->conds[i];
+        double v;
+
+        if (c->field == FIELD_TIME) {
+            if (!compare(c->op, (double)ms, t_ms[i]))
+                return 0;
+        } else if (c->field == FIELD_COLUMN) {
+            if (!cell(b, c->col, row, &v) || !compare(c->op, v, c->num))
+                return 0;
+        }
+    }
+    return 1;
+}
+
+static void add_row(const struct query *q, struct group *g, const struct batc *b, uint64_t row)
+{
+    int i;
+
+    g->rows++;
+    for (i = 0; i < q->naggs; i++) {
+        double v;
+
+        if (q->aggs[i].col < 0) {
+            g->n[i]++;
+            continue;
+        }
+        if (!cell(b, q->aggs[i].col, row, &v))
+            continue;
+        if (g->n[i] == 0 || v < g->min[i])
+            g->min[i] = v;
+        if (g->n[i] == 0 || v > g->max[i])
+            g->max[i] = v;
+        g->sum[i] += v;
+        g->n[i]++;
+    }
+}
+
+static struct group *group_for(struct query *q, const char *key)
+{
+    int i;
+
+    for (i = 0; i < q->ngroups; i++)
+        if (strcmp(q->groups[i].key, key) == 0)
+            return &q->groups[i];
+    if (q->ngroups == QUERY_GROUPS_MAX)
+        return NULL;
+    memset(&q->groups[q->ngroups], 0, sizeof(q->groups[0]));
+    snprintf(q->groups[q->ngroups].key, sizeof(q->groups[0].key), "%s", key);
+    return &q->groups[q->ngroups++];
+}
+
+static void scan_file(struct query *q, const char *path)
+{
+    char fields[RUN_FIELDS][QUERY_STR_MAX];
+    double t_ms[QUERY_CONDS_MAX];
+    struct batc b;
+    struct group *g;
+    uint64_t nblocks, z, before;
+    int i;
+
+    if (batc_open(&b, path) != 0) {
+        log_error("Not a readable .batc file: ", path);
+        return;
+    }
+
+    /* Partition pruning, on the metadata in the header */
+    for (i = 0; i < RUN_FIELDS; i++) {
+        if (jsonl_object_string(b.meta, b.meta_len, run_fields[i], fields[i], QUERY_STR_MAX) != 0) {
+            const char *base = strrchr(path, '/');
+
+            base = base != NULL ? base + 1 : path;
+            if (i == 3)
+                snprintf(fields[i], QUERY_STR_MAX, "%.*s", (int)strcspn(base, "."), base);
+            else
+                snprintf(fields[i], QUERY_STR_MAX, "Unknown");
+        }
+    }
+    for (i = 0; i < q->nconds; i++) {
+        const struct cond *c = &q->conds[i];
+
+        if ((c->field == FIELD_RUN && !run_matches(c, fields[c->col])) ||
+            (c->field == FIELD_COLUMN && !batc_has(&b, (enum batc_col)c->col))) {
+            q->runs_pruned++;
+            batc_close(&b);
+            return;
+        }
+        t_ms[i] = c->field == FIELD_TIME ? (double)(c->t_ns - b.t0_ns) / 1e6 : 0.0;
+    }
+    q->runs_scanned++;
+    g = group_for(q, q->group_by >= 0 ? fields[q->group_by] : "");
+    if (g == NULL) {
+        log_error("Too many groups, skipping run: ", path);
+        batc_close(&b);
+        return;
+    }
+    before = g->rows;
+
+    /* Without a zone map the run is one block, tested row by row */
+    nblocks = b.zones != NULL ? b.nzones : b.nrows > 0;
+    for (z = 0; z < nblocks; z++) {
+        uint64_t row = b.zones != NULL ? z * b.zone_rows : 0;
+        uint64_t end = b.zones != NULL && row + b.zone_rows < b.nrows ? row + b.zone_rows : b.nrows;
+        int verdict = b.zones != NULL ? zone_verdict(q, &b, z, t_ms) : ZONE_SOME;
+        int64_t ms = b.zones != NULL ? batc_zone_base(&b, z) : 0;
+
+        if (verdict == ZONE_NONE) {
+            q->blocks_skipped++;
+            continue;
+        }
+        q->blocks_read++;
+        if (verdict == ZONE_ALL) {
+            q->blocks_whole++;
+            if (q->count_only) {
+                g->rows += end - row;
+                for (i = 0; i < q->naggs; i++)
+                    g->n[i] += end - row;
+                continue;
+            }
+        }
+        for (; row < end; row++) {
+            ms += batc_raw(&b, BATC_COL_T, row);
+            q->rows_read++;
+            if (verdict == ZONE_ALL || row_matches(q, &b, row, ms, t_ms))
+                add_row(q, g, &b, row);
+        }
+    }
+    if (g->rows > before)
+        g->runs++;
+    batc_close(&b);
+}
+
+static int by_key(const void *a, const void *b)
+{
+    return strcmp(((const struct group *)a)->key, ((const struct group *)b)->key);
+}
+
+static void print_results(const struct query *q)
+{
+    char buf[32];
+    int i, j;
+
+    if (q->group_by >= 0)
+        printf("%s\t", run_fields[q->group_by]);
+    printf("runs\trows");
+    for (i = 0; i < q->naggs; i++)
+        printf("\t%s", q->aggs[i].label);
+    printf("\n");
+
+    for (j = 0; j < q->ngroups; j++) {
+        const struct group *g = &q->groups[j];
+
+        if (q->group_by >= 0 && g->rows == 0)
+            continue;
+        if (q->group_by >= 0)
+            printf("%s\t", g->key);
+        printf("%u\t%llu", g->runs, (unsigned long long)g->rows);
+        for (i = 0; i < q->naggs; i++) {
+            double v = 0.0;
+
+            if (q->aggs[i].fn != FN_COUNT && g->n[i] == 0) {
+                printf("\tN/A");
+                continue;
+            }
+            switch (q->aggs[i].fn) {
+            case FN_COUNT: v = (double)g->n[i]; break;
+            case FN_SUM:   v = g->sum[i]; break;
+            case FN_AVG:   v = g->sum[i] / (double)g->n[i]; break;
+            case FN_MIN:   v = g->min[i]; break;
+            case FN_MAX:   v = g->max[i]; break;
+            }
+            printf("\t%s", stats_num(buf, sizeof(buf), v));
+        }
+        printf("\n");
+    }
+}
+
+int query_run(const char *text, char **paths, int npaths, int explain)
+{
+    static struct query q;
+    struct timespec t0, t1;
+    int i;
+
+    memset(&q, 0, sizeof(q));
+    if (parse(text, &q) != 0)
+        return 1;
+    q.groups = malloc(sizeof(*q.groups) * QUERY_GROUPS_MAX);
+    if (q.groups == NULL) {
+        log_error("Cannot allocate query groups", NULL);
+        return 1;
+    }
+    if (q.group_by < 0)
+        group_for(&q, "");
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    for (i = 0; i < npaths; i++)
+        scan_file(&q, paths[i]);
+    if (q.ngroups > 1)
+        qsort(q.groups, (size_t)q.ngroups, sizeof(*q.groups), by_key);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    print_results(&q);
+    if (explain)
+        fprintf(stderr,
+            "runs: %u scanned, %u pruned by run fields\n"
+            "blocks: %llu read (%llu matched whole), %llu skipped by zone maps\n"
+            "rows: %llu read\n"
+            "time: %.2f ms\n",
+            q.runs_scanned, q.runs_pruned,
+            (unsigned long long)q.blocks_read, (unsigned long long)q.blocks_whole,
+            (unsigned long long)q.blocks_skipped, (unsigned long long)q.rows_read,
+            (double)(t1.tv_sec - t0.tv_sec) * 1e3 + (double)(t1.tv_nsec - t0.tv_nsec) / 1e6);
+    free(q.groups);
+    return 0;
+}
@@ -0,0 +1,34 @@
+/*
+ * query.h - SQL-ish queries across the .batc run store
+ *
+ *   [select] AGG[, AGG...] [where COND [and COND...]] [group by FIELD]
+ *
+ * AGG is count, count(*), or count, sum, avg (or mean), min or max of a
+ * column: pct, watts, cpu_load, cpu_pct, ram_pct or temp_c. COND is
+ * NAME OP VALUE, where NAME is a column, the sample time t (an ISO 8601
+ * string) or a run field from the run's metadata: host, os, config or
+ * run_id. OP is one of = != < <= > >=, or like for run fields, with %
+ * and _ wildcards, case-insensitively. Missing values (temp_c, cpu_pct)
+ * match no condition and are left out of aggregates.
+ *
+ * Evaluation reads as little as it can:
+ *
+ *   partitions  conditions on run fields are checked against the
+ *               metadata in each file's header, so a run that cannot
+ *               match is never scanned
+ *   zone maps   conditions on columns and time are checked against
+ *               each block's ranges (see batc.h): blocks that cannot
+ *               match are skipped unread, and blocks that match whole
+ *               are aggregated without testing rows, or counted from
+ *               the zone map alone when only counted
+ *
+ * Results are printed tab-separated, one line per group.
+ */
+
+#ifndef BATLAB_QUERY_H
+#define BATLAB_QUERY_H
+
+/* Run the query over the named .batc files; explain reports the pruning */
+int query_run(const char *text, char **paths, int npaths, int explain);
+
+#endif /* BATLAB_QUERY_H */
@@ -0,0 +1,637 @@
+/*
+ * batlab-sampler - Native telemetry sampler for batlab
+ *
+ * Replaces the fork-per-metric collect_sample loop in bin/batlab with a
+ * single long-running process. Emits the same JSONL schema:
+ *
+ *   {"t": "...", "pct": 85.0, "watts": 12.500, "cpu_load": 0.45,
+ *    "ram_pct": 32.1, "temp_c": 45.2, "src": "acpiconf", "energy_wh": 0.41250}
+ *
+ * energy_wh is the energy integrated since the first sample; battery_wh
+ * and rapl_wh follow it where the hardware keeps those counters. From the
+ * second sample on, cpu_pct is the measured utilization over the last
+ * interval, with per-core core_pct, core_mhz and cstate_pct. With
+ * --attribute, "rapl" (watts per RAPL domain) and "top" (the busiest
+ * processes and their share of the power) follow. With --push, each
+ * batch is also sent to a batlab-aggregator (see push.h). With
+ * --adaptive, only samples that changed are written (see adapt.h).
+ * With --health, the sampler's own latencies, missed deadlines and
+ * probe fallbacks are published while it runs (see health.h).
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "adapt.h"
+#include "attrib.h"
+#include "cpu.h"
+#include "energy.h"
+#include "health.h"
+#include "live.h"
+#include "mark.h"
+#include "probe.h"
+#include "push.h"
+#include "sched.h"
+#include "serve.h"
+#include "tindex.h"
+#include "writer.h"
+
+#define PROGRAM_NAME "batlab-sampler"
+#define VERSION "2.0.0"
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_stop(int sig)
+{
+    (void)sig;
+    stop_requested = 1;
+}
+
+static void usage(FILE *out)
+{
+    fprintf(out,
+        "%s %s - Native telemetry sampler for batlab\n"
+        "\n"
+        "USAGE:\n"
+        "    %s [--hz HZ] [--count N] [--output FILE] [--flush-every N|Ns]\n"
+        "        [--fsync never|flush] [--stats FILE] [--index FILE [--index-every N]]\n"
+        "        [--serve [HOST:]PORT [--serve-page FILE]]\n"
+        "        [--mark-socket PATH --events FILE] [--attribute N]\n"
+        "        [--push URL --run-id ID] [--adaptive MAX [--threshold SPEC]]\n"
+        "        [--health FILE]\n"
+        "    %s --mark PATH \"EVENT [LABEL]\"\n"
+        "    %s --push URL --run-id ID [--push-meta FILE] [--push-events FILE]\n"
+        "\n"
+        "OPTIONS:\n"
+        "    --hz HZ          Sampling frequency, up to 100 (default: 1.0)\n"
+        "    --count N        Stop after N samples (default: run until signalled)\n"
+        "    --adaptive MAX   Read the probes at HZ but write a sample only when it\n"
+        "                     changed, or MAX (e.g. 60s, 5m) after the last one\n"
+        "    --threshold SPEC Changes that count, as FIELD=DELTA[,...] over watts,\n"
+        "                     pct, cpu_load, cpu_pct and temp_c (default: watts=%g,\n"
+        "                     pct=%g,cpu_load=%g,cpu_pct=%g,temp_c=%g)\n"
+        "    --output FILE    Append JSONL samples to FILE (default: stdout)\n"
+        "    --flush-every N  Write samples in batches of N, or every N seconds\n"
+        "                     with an 's' suffix (default: 10s to a file, 1 to stdout)\n"
+        "    --fsync POLICY   'flush' to fsync after every batch (default), 'never'\n"
+        "    --stats FILE     Write run statistics (one 'key JSON' line each) on exit\n"
+        "    --health FILE    Rewrite the sampler's health counters (JSON) to FILE\n"
+        "                     once a second; --serve also answers GET /health\n"
+        "    --index FILE     Append a sparse time index (timestamp, byte offset)\n"
+        "    --index-every N  Index every Nth sample (default: 60)\n"
+        "    --serve ADDR     Stream samples and rolling aggregates as server-sent\n"
+        "                     events on http://ADDR/events (default host 127.0.0.1)\n"
+        "    --serve-page F   Dashboard page served at http://ADDR/\n"
+        "    --mark-socket P  Receive workload markers on the local socket P\n"
+        "    --events FILE    Append received markers to FILE (JSONL)\n"
+        "    --mark P TEXT    Send one marker (start, stop or phase, then a\n"
+        "                     label) to the sampler listening on P and exit\n"
+        "    --attribute N    Record RAPL domain power and the N (0-%d) busiest\n"
+        "                     processes with their share of the power\n"
+        "    --push URL       Also send each batch, gzip-compressed, to the\n"
+        "                     batlab-aggregator at URL (http://HOST[:PORT])\n"
+        "    --run-id ID      Run the pushed samples are stored under\n"
+        "    --push-meta F    Send the run's metadata file F and exit\n"
+        "    --push-events F  Send the run's marker file F and exit\n"
+        "    --probes         Print the resolved probe table (JSON) and exit\n"
+        "    --policy         Print the --adaptive policy (JSON) and exit\n"
+        "    --help           Show this help\n"
+        "    --version        Show version\n",
+        PROGRAM_NAME, VERSION, PROGRAM_NAME, PROGRAM_NAME, PROGRAM_NAME,
+        ADAPT_WATTS, ADAPT_PCT, ADAPT_CPU_LOAD, ADAPT_CPU_PCT, ADAPT_TEMP_C, ATTRIB_TOP_MAX);
+}
+
+static void log_error(const char *msg, const char *arg)
+{
+    fprintf(stderr, "[ERROR] %s%s\n", msg, arg ? arg : "");
+}
+
+/* Format one sample as a JSONL record; returns the line length */
+static int format_sample(char *buf, size_t len, const struct timespec *ts,
+                         const struct sample *s, const struct energy *e,
+                         const struct cpu_probes *c, const struct attrib *a)
+{
+    struct tm tm;
+    char stamp[32];
+    int n;
+
+    gmtime_r(&ts->tv_sec, &tm);
+    strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+
+    n = snprintf(buf, len,
+        "{\"t\": \"%s.%09ldZ\", \"pct\": %.1f, \"watts\": %.3f, \"cpu_load\": %.2f, "
+        "\"ram_pct\": %.1f, \"temp_c\": %.1f, \"src\": \"%s\", \"energy_wh\": %.5f",
+        stamp, (long)ts->tv_nsec, s->pct, s->watts, s->cpu_load,
+        s->ram_pct, s->temp_c, s->src, energy_integrated_wh(e));
+    if (n > 0 && (size_t)n < len && s->battery_wh >= 0.0)
+        n += snprintf(buf + n, len - (size_t)n, ", \"battery_wh\": %.4f", s->battery_wh);
+    if (n > 0 && (size_t)n < len && s->rapl_j >= 0.0)
+        n += snprintf(buf + n, len - (size_t)n, ", \"rapl_wh\": %.5f", s->rapl_j / 3600.0);
+    if (n > 0 && (size_t)n < len && c != NULL)
+        n += cpu_format(c, buf + n, len - (size_t)n);
+    if (n > 0 && (size_t)n < len && a != NULL)
+        n += attrib_format(a, buf + n, len - (size_t)n);
+    if (n > 0 && (size_t)n < len)
+        n += snprintf(buf + n, len - (size_t)n, "}\n");
+    return n;
+}
+
+/* Write one sample line, noting it in the time index and push queue */
+static int persist(struct writer *w, struct tindex_writer *ix, struct push *p,
+                   struct health *h, const char *line, size_t len, int64_t t_ns)
+{
+    uint64_t flushes = w->flushes;
+    uint64_t offset = writer_offset(w);
+    int64_t start = sched_now_ns();
+
+    if (writer_append(w, line, len, start) != 0) {
+        health_time(h, HEALTH_WRITE, sched_now_ns() - start);
+        return -1;
+    }
+    /* Index entries follow the samples they point at to disk, and pushed
+     * batches are the ones written. A full buffer is flushed to make room
+     * for the line, which then waits in memory for the next flush */
+    if (w->flushes != flushes && w->len > 0) {
+        tindex_flush(ix);
+        if (p != NULL)
+            push_release(p);
+    }
+    tindex_note(ix, t_ns, offset);
+    if (p != NULL)
+        push_add(p, line, len);
+    if (w->flushes != flushes && w->len == 0) {
+        tindex_flush(ix);
+        if (p != NULL)
+            push_release(p);
+    }
+    health_time(h, HEALTH_WRITE, sched_now_ns() - start);
+    return 0;
+}
+
+/* Publish the health counters to the snapshot file and the live view */
+static int publish_health(const struct health *h, const struct sched *sc, const char *path,
+                          struct serve *sv)
+{
+    char buf[HEALTH_SNAPSHOT_MAX];
+    int n;
+
+    if (path == NULL && sv->fd < 0)
+        return 0;
+    n = health_format(h, sc, buf, sizeof(buf), 1);
+    if (n <= 0 || (size_t)n >= sizeof(buf))
+        return -1;
+    if (sv->fd >= 0)
+        serve_health(sv, buf, (size_t)n);
+    return path != NULL ? health_publish(path, buf, (size_t)n) : 0;
+}
+
+/* A JSON number, or null when the counter was never read */
+static void json_wh(FILE *f, const char *key, double wh, int known, const char *sep)
+{
+    if (known)
+        fprintf(f, "\"%s\": %.5f%s", key, wh, sep);
+    else
+        fprintf(f, "\"%s\": null%s", key, sep);
+}
+
+/*
+ * Run statistics, one "key {json}" line per object, which batlab log
+ * merges into the run's .meta.json on shutdown
+ */
+static int write_stats(const char *path, const struct sched *sc, const struct writer *w,
+                       const struct energy *e, struct attrib *a, const struct push *p,
+                       const struct adapt *ad, const struct health *h,
+                       const char *flush_every)
+{
+    FILE *f = fopen(path, "w");
+
+    if (f == NULL)
+        return -1;
+
+    fprintf(f,
+        "timing {\"scheduler\": \"%s\", \"requested_hz\": %g, \"achieved_hz\": %.4f, "
+        "\"samples\": %llu, \"skipped_deadlines\": %llu, "
+        "\"jitter_us\": {\"mean\": %.1f, \"p50\": %.1f, \"p99\": %.1f, \"max\": %.1f}}\n",
+#if defined(__APPLE__)
+        "nanosleep",
+#else
+        "clock_nanosleep",
+#endif
+        sc->hz,
+        sched_achieved_hz(sc),
+        (unsigned long long)sc->fired, (unsigned long long)sc->skipped,
+        hist_mean(&sc->jitter_ns) / 1e3,
+        (double)hist_quantile(&sc->jitter_ns, 0.50) / 1e3,
+        (double)hist_quantile(&sc->jitter_ns, 0.99) / 1e3,
+        (double)sc->jitter_ns.max / 1e3);
+
+    fprintf(f,
+        "writer {\"flush_every\": \"%s\", \"fsync\": \"%s\", \"flushes\": %llu, \"bytes\": %llu}\n",
+        flush_every, w->fsync_policy == WRITER_FSYNC_FLUSH ? "flush" : "never",
+        (unsigned long long)w->flushes, (unsigned long long)w->bytes);
+
+    fprintf(f, "energy {\"method\": \"trapezoidal\", ");
+    json_wh(f, "integrated_wh", energy_integrated_wh(e), e->count > 0, ", ");
+    json_wh(f, "battery_used_wh", e->battery_wh_first - e->battery_wh_last,
+            e->battery_wh_first >= 0.0, ", ");
+    json_wh(f, "battery_full_wh", e->battery_full_wh, e->battery_full_wh > 0.0, ", ");
+    json_wh(f, "rapl_wh", (e->rapl_j_last - e->rapl_j_first) / 3600.0,
+            e->rapl_j_first >= 0.0, "}\n");
+
+    if (a != NULL)
+        attrib_write_stats(a, f);
+    if (p != NULL)
+        push_write_stats(p, f);
+    if (ad != NULL)
+        adapt_write_stats(ad, f);
+    health_write_stats(h, sc, f);
+
+    return fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+    struct probes probes;
+    struct sched sched;
+    struct writer writer;
+    struct tindex_writer tindex;
+    struct live live;
+    struct serve sv;
+    struct mark mk;
+    struct energy energy;
+    struct attrib attrib;
+    struct cpu_probes cpu;
+    struct push push;
+    struct adapt adapt;
+    struct health health;
+    int have_cpu;
+    struct sigaction sa;
+    enum writer_fsync fsync_policy = WRITER_FSYNC_FLUSH;
+    const char *output = NULL;
+    const char *stats = NULL;
+    const char *health_path = NULL;
+    const char *flush_every = NULL;
+    const char *index = NULL;
+    const char *serve_addr = NULL;
+    const char *serve_page = NULL;
+    const char *mark_socket = NULL;
+    const char *events = NULL;
+    const char *push_url = NULL;
+    const char *run_id = NULL;
+    const char *push_meta = NULL;
+    const char *push_events = NULL;
+    const char *adaptive = NULL;
+    const char *threshold = NULL;
+    unsigned index_every = TINDEX_DEFAULT_EVERY;
+    unsigned flush_count = 1;
+    double flush_seconds = 0.0;
+    double hz = 1.0;
+    long count = 0;
+    long taken = 0;
+    int attribute = -1;
+    int fd = STDOUT_FILENO;
+    int describe = 0;
+    int policy = 0;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--hz") == 0 && i + 1 < argc) {
+            hz = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--count") == 0 && i + 1 < argc) {
+            count = strtol(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--adaptive") == 0 && i + 1 < argc) {
+            adaptive = argv[++i];
+        } else if (strcmp(argv[i], "--threshold") == 0 && i + 1 < argc) {
+            threshold = argv[++i];
+        } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc) {
+            output = argv[++i];
+        } else if (strcmp(argv[i], "--flush-every") == 0 && i + 1 < argc) {
+            flush_every = argv[++i];
+            if (writer_parse_flush(flush_every, &flush_count, &flush_seconds) != 0) {
+                log_error("Invalid --flush-every value: ", flush_every);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--fsync") == 0 && i + 1 < argc) {
+            if (writer_parse_fsync(argv[++i], &fsync_policy) != 0) {
+                log_error("Invalid --fsync policy: ", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+            stats = argv[++i];
+        } else if (strcmp(argv[i], "--health") == 0 && i + 1 < argc) {
+            health_path = argv[++i];
+        } else if (strcmp(argv[i], "--index") == 0 && i + 1 < argc) {
+            index = argv[++i];
+        } else if (strcmp(argv[i], "--index-every") == 0 && i + 1 < argc) {
+            long n = strtol(argv[++i], NULL, 10);
+
+            if (n <= 0) {
+                log_error("Invalid --index-every value: ", argv[i]);
+                return 1;
+            }
+            index_every = (unsigned)n;
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serve_addr = argv[++i];
+        } else if (strcmp(argv[i], "--serve-page") == 0 && i + 1 < argc) {
+            serve_page = argv[++i];
+        } else if (strcmp(argv[i], "--mark-socket") == 0 && i + 1 < argc) {
+            mark_socket = argv[++i];
+        } else if (strcmp(argv[i], "--events") == 0 && i + 1 < argc) {
+            events = argv[++i];
+        } else if (strcmp(argv[i], "--mark") == 0 && i + 2 < argc) {
+            if (mark_send(argv[i + 1], argv[i + 2]) != 0) {
+                log_error("No sampler is listening on: ", argv[i + 1]);
+                return 1;
+            }
+            return 0;
+        } else if (strcmp(argv[i], "--attribute") == 0 && i + 1 < argc) {
+            char *end;
+
+            attribute = (int)strtol(argv[++i], &end, 10);
+            if (*end != '\0' || attribute < 0 || attribute > ATTRIB_TOP_MAX) {
+                log_error("Invalid --attribute count: ", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--push") == 0 && i + 1 < argc) {
+            push_url = argv[++i];
+        } else if (strcmp(argv[i], "--run-id") == 0 && i + 1 < argc) {
+            run_id = argv[++i];
+        } else if (strcmp(argv[i], "--push-meta") == 0 && i + 1 < argc) {
+            push_meta = argv[++i];
+        } else if (strcmp(argv[i], "--push-events") == 0 && i + 1 < argc) {
+            push_events = argv[++i];
+        } else if (strcmp(argv[i], "--probes") == 0) {
+            describe = 1;
+        } else if (strcmp(argv[i], "--policy") == 0) {
+            policy = 1;
+        } else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            usage(stdout);
+            return 0;
+        } else if (strcmp(argv[i], "--version") == 0 || strcmp(argv[i], "-v") == 0) {
+            printf("%s %s\n", PROGRAM_NAME, VERSION);
+            return 0;
+        } else {
+            log_error("Unknown option: ", argv[i]);
+            usage(stderr);
+            return 1;
+        }
+    }
+
+    if (hz <= 0.0 || hz > SCHED_MAX_HZ) {
+        log_error("Sampling frequency must be between 0 and 100 Hz", NULL);
+        return 1;
+    }
+
+    if (adaptive != NULL && adapt_init(&adapt, adaptive) != 0) {
+        log_error("Invalid --adaptive interval: ", adaptive);
+        return 1;
+    }
+    if (threshold != NULL && (adaptive == NULL || adapt_parse_thresholds(&adapt, threshold) != 0)) {
+        log_error(adaptive == NULL ? "--threshold needs --adaptive MAX" : "Invalid --threshold: ",
+                  adaptive == NULL ? NULL : threshold);
+        return 1;
+    }
+    if (policy) {
+        if (adaptive == NULL) {
+            log_error("--policy needs --adaptive MAX", NULL);
+            return 1;
+        }
+        adapt_describe(&adapt, hz, stdout);
+        return 0;
+    }
+
+    if (push_url != NULL && run_id == NULL) {
+        log_error("--push needs a --run-id", NULL);
+        return 1;
+    }
+    if (push_meta != NULL || push_events != NULL) {
+        int rc = 0;
+
+        if (push_url == NULL) {
+            log_error("--push-meta and --push-events need --push URL --run-id ID", NULL);
+            return 1;
+        }
+        if (push_meta != NULL && push_file(push_url, run_id, "meta", push_meta) != 0) {
+            log_error("Cannot push run metadata to: ", push_url);
+            rc = 1;
+        }
+        if (push_events != NULL && push_file(push_url, run_id, "events", push_events) != 0) {
+            log_error("Cannot push workload markers to: ", push_url);
+            rc = 1;
+        }
+        return rc;
+    }
+
+    if (describe) {
+        probes_open(&probes);
+        have_cpu = cpu_open(&cpu) == 0;
+        probes_describe(&probes, have_cpu ? &cpu : NULL, stdout);
+        if (have_cpu)
+            cpu_close(&cpu);
+        probes_close(&probes);
+        return 0;
+    }
+
+    if (output != NULL) {
+        fd = open(output, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (fd < 0) {
+            log_error("Cannot open output file: ", output);
+            return 1;
+        }
+        /* Files default to 10 second batches so the disk can idle */
+        if (flush_every == NULL) {
+            flush_every = "10s";
+            writer_parse_flush(flush_every, &flush_count, &flush_seconds);
+        }
+    } else if (flush_every == NULL) {
+        flush_every = "1";
+    }
+
+    if (writer_init(&writer, fd, flush_count, flush_seconds, hz, fsync_policy) != 0) {
+        log_error("Cannot allocate sample buffer", NULL);
+        return 1;
+    }
+
+    memset(&tindex, 0, sizeof(tindex));
+    if (index != NULL && (output == NULL || tindex_open(&tindex, index, index_every) != 0))
+        log_error("Cannot write time index, continuing without: ", index);
+
+    memset(&sv, 0, sizeof(sv));
+    sv.fd = -1;
+    if (serve_addr != NULL && serve_open(&sv, serve_addr, serve_page) != 0) {
+        log_error("Cannot serve live view on: ", serve_addr);
+        return 1;
+    }
+
+    memset(&push, 0, sizeof(push));
+    push.fd = -1;
+    if (push_url != NULL && push_open(&push, push_url, run_id) != 0) {
+        log_error("Cannot resolve aggregator URL, or BATLAB_TOKEN is invalid: ", push_url);
+        return 1;
+    }
+
+    memset(&mk, 0, sizeof(mk));
+    mk.fd = -1;
+    mk.out = -1;
+    if (mark_socket != NULL && (events == NULL || mark_open(&mk, mark_socket, events) != 0))
+        log_error("Cannot receive workload markers, continuing without: ", mark_socket);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_stop;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    probes_open(&probes);
+    have_cpu = cpu_open(&cpu) == 0;
+    sched_init(&sched, hz);
+    live_init(&live, hz);
+    energy_init(&energy);
+    if (attribute >= 0 && attrib_open(&attrib, attribute) != 0) {
+        log_error("No RAPL or process counters to attribute power with, continuing without", NULL);
+        attribute = -1;
+    }
+    health_init(&health, &sched);
+    if (publish_health(&health, &sched, health_path, &sv) != 0) {
+        log_error("Cannot write health snapshot, continuing without: ", health_path);
+        health_path = NULL;
+    }
+
+    while (!stop_requested && (count == 0 || taken < count)) {
+        struct sample s;
+        struct timespec now;
+        char line[WRITER_LINE_MAX];
+        int64_t left, woke, t0;
+        int len;
+
+        /* Answer viewers and push batches while waiting, leaving the
+         * last millisecond to sched_wait so the deadline stays as
+         * precise as without them */
+        while (!stop_requested && (sv.fd >= 0 || push_active(&push)) &&
+               (left = sched.deadline_ns - sched_now_ns()) > 2000000) {
+            int ms = (int)((left - 1000000) / 1000000);
+
+            if (!push_active(&push)) {
+                serve_poll(&sv, ms);
+                continue;
+            }
+            if (sv.fd >= 0) {
+                serve_poll(&sv, 0);
+                ms = ms > 10 ? 10 : ms;
+            }
+            push_poll(&push, ms);
+        }
+
+        if (sched_wait(&sched) != 0)
+            continue;
+
+        woke = sched_now_ns();
+        clock_gettime(CLOCK_REALTIME, &now);
+        probes_read(&probes, &s);
+        health_probed(&health, &probes, &s, woke - sched.deadline_ns);
+        if (have_cpu) {
+            t0 = sched_now_ns();
+            cpu_read(&cpu, &s, t0);
+            health_time(&health, HEALTH_CPU, sched_now_ns() - t0);
+        }
+        energy_add(&energy, &s, sched_now_ns());
+        if (attribute >= 0) {
+            t0 = sched_now_ns();
+            attrib_read(&attrib, &s, t0);
+            health_time(&health, HEALTH_ATTRIB, sched_now_ns() - t0);
+        }
+        len = format_sample(line, sizeof(line), &now, &s, &energy,
+                            have_cpu ? &cpu : NULL, attribute >= 0 ? &attrib : NULL);
+        if (len > 0) {
+            int64_t t_ns = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+            enum adapt_verdict v = adaptive != NULL ?
+                adapt_check(&adapt, &s, sched_now_ns()) : ADAPT_KEEP;
+
+            /* A change writes the reading held before it first, so the
+             * plateau it ends keeps its last point */
+            if (v == ADAPT_CHANGE && adapt.held_len > 0) {
+                if (persist(&writer, &tindex, push_url != NULL ? &push : NULL, &health,
+                            adapt.held, adapt.held_len, adapt.held_t_ns) != 0) {
+                    log_error("Write failed: ", strerror(errno));
+                    break;
+                }
+                adapt.written++;
+            }
+            if (v == ADAPT_SKIP) {
+                adapt_hold(&adapt, line, (size_t)len, t_ns);
+            } else {
+                if (persist(&writer, &tindex, push_url != NULL ? &push : NULL, &health,
+                            line, (size_t)len, t_ns) != 0) {
+                    log_error("Write failed: ", strerror(errno));
+                    break;
+                }
+                if (adaptive != NULL)
+                    adapt_wrote(&adapt, &s, sched_now_ns());
+            }
+
+            if (sv.fd >= 0) {
+                char event[SERVE_EVENT_MAX];
+                int n;
+
+                live_add(&live, &s, t_ns);
+                n = live_format(&live, event, sizeof(event), line, (size_t)len);
+                if (n > 0 && (size_t)n < sizeof(event))
+                    serve_publish(&sv, event, (size_t)n);
+            }
+            health_time(&health, HEALTH_SAMPLE, sched_now_ns() - woke);
+        }
+        taken++;
+
+        /* Markers carry their arrival time, so draining them here, off
+         * the deadline, loses no precision */
+        mark_drain(&mk);
+        if (health_due(&health, sched_now_ns()))
+            publish_health(&health, &sched, health_path, &sv);
+
+        sched_advance(&sched);
+    }
+
+    /* The run ends at its last reading, written or not */
+    if (adaptive != NULL && adapt.held_len > 0) {
+        if (persist(&writer, &tindex, push_url != NULL ? &push : NULL, &health,
+                    adapt.held, adapt.held_len, adapt.held_t_ns) != 0)
+            log_error("Write failed: ", strerror(errno));
+        else
+            adapt.written++;
+    }
+    publish_health(&health, &sched, health_path, &sv);
+
+    probes_close(&probes);
+    if (have_cpu)
+        cpu_close(&cpu);
+    serve_close(&sv);
+    mark_close(&mk);
+    if (writer_close(&writer) != 0)
+        log_error("Final flush failed: ", strerror(errno));
+    if (tindex_close(&tindex) != 0)
+        log_error("Cannot write time index: ", index);
+    if (push_url != NULL && push_drain(&push, PUSH_DRAIN_MS) != 0)
+        log_error("Cannot push the last samples, they are kept locally only: ", push_url);
+
+    if (stats != NULL && write_stats(stats, &sched, &writer, &energy,
+                                     attribute >= 0 ? &attrib : NULL,
+                                     push_url != NULL ? &push : NULL,
+                                     adaptive != NULL ? &adapt : NULL, &health,
+                                     flush_every) != 0)
+        log_error("Cannot write statistics file: ", stats);
+    if (attribute >= 0)
+        attrib_close(&attrib);
+    push_close(&push);
+
+    return 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * sched.c - Drift-free sampling scheduler for batlab-sampler
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <time.h>
+
+#include "sched.h"
+
+#define NSEC_PER_SEC 1000000000LL
+
+int64_t sched_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+void sched_init(struct sched *s, double hz)
+{
+    s->hz = hz;
+    s->period_ns = (int64_t)((double)NSEC_PER_SEC / hz);
+    s->start_ns = sched_now_ns();
+    s->deadline_ns = s->start_ns;
+    s->last_fired_ns = s->start_ns;
+    s->fired = 0;
+    s->skipped = 0;
+    hist_init(&s->jitter_ns);
+}
+
+int sched_wait(struct sched *s)
+{
+    struct timespec ts;
+    int64_t now;
+
+    ts.tv_sec = (time_t)(s->deadline_ns / NSEC_PER_SEC);
+    ts.tv_nsec = (long)(s->deadline_ns % NSEC_PER_SEC);
+
+#if defined(__APPLE__)
+    /* No clock_nanosleep(2) on macOS: sleep for the remaining interval */
+    now = sched_now_ns();
+    if (now < s->deadline_ns) {
+        struct timespec rel;
+        rel.tv_sec = (time_t)((s->deadline_ns - now) / NSEC_PER_SEC);
+        rel.tv_nsec = (long)((s->deadline_ns - now) % NSEC_PER_SEC);
+        if (nanosleep(&rel, NULL) != 0 && errno == EINTR)
+            return -1;
+    }
+#else
+    {
+        int rc = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        if (rc == EINTR)
+            return -1;
+    }
+#endif
+
+    now = sched_now_ns();
+    hist_add(&s->jitter_ns, now > s->deadline_ns ? (uint64_t)(now - s->deadline_ns) : 0);
+    s->fired++;
+    s->last_fired_ns = now;
+    return 0;
+}
+
+double sched_achieved_hz(const struct sched *s)
+{
+    double elapsed = (double)(s->last_fired_ns - s->start_ns) / 1e9;
+
+    if (s->fired < 2 || elapsed <= 0.0)
+        return 0.0;
+    return (double)(s->fired - 1) / elapsed;
+}
+
+void sched_advance(struct sched *s)
+{
+    int64_t now = sched_now_ns();
+
+    s->deadline_ns += s->period_ns;
+    if (now > s->deadline_ns) {
+        int64_t missed = (now - s->deadline_ns) / s->period_ns + 1;
+        s->skipped += (uint64_t)missed;
+        s->deadline_ns += missed * s->period_ns;
+    }
+}
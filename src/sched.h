@@ -0,0 +1,41 @@
+/*
+ * sched.h - Drift-free sampling scheduler for batlab-sampler
+ *
+ * Deadlines are absolute points on CLOCK_MONOTONIC, spaced exactly one
+ * period apart from the first sample. The time spent collecting a
+ * sample therefore never accumulates into the sampling rate. Deadlines
+ * that have already passed when the sampler wakes are skipped (and
+ * counted) instead of being fired in a burst.
+ */
+
+#ifndef BATLAB_SCHED_H
+#define BATLAB_SCHED_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "hist.h"
+
+#define SCHED_MAX_HZ 100.0
+
+struct sched {
+    double hz;
+    int64_t period_ns;
+    int64_t start_ns;
+    int64_t deadline_ns;
+    int64_t last_fired_ns;
+    uint64_t fired;
+    uint64_t skipped;
+    struct hist jitter_ns;
+};
+
+void sched_init(struct sched *s, double hz);
+/* Sleep until the next deadline; returns -1 if interrupted by a signal */
+int sched_wait(struct sched *s);
+/* Move to the next deadline, skipping any that were already missed */
+void sched_advance(struct sched *s);
+/* Observed rate between the first and the last fired deadline */
+double sched_achieved_hz(const struct sched *s);
+int64_t sched_now_ns(void);
+
+#endif /* BATLAB_SCHED_H */
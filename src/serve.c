@@ -0,0 +1,356 @@
+/*
+ * serve.c - Local HTTP server for the batlab-sampler live view
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "serve.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0          /* SIGPIPE is ignored in serve_open */
+#endif
+
+static const char stub_page[] =
+    "<!DOCTYPE html><html><body><p>batlab-sampler: live samples are at "
+    "<a href=\"/events\">/events</a></p></body></html>\n";
+
+static char *read_page(const char *path, size_t *len)
+{
+    FILE *f = fopen(path, "rb");
+    char *buf;
+    long size;
+
+    if (f == NULL)
+        return NULL;
+    if (fseek(f, 0, SEEK_END) != 0 || (size = ftell(f)) < 0 || fseek(f, 0, SEEK_SET) != 0) {
+        fclose(f);
+        return NULL;
+    }
+    buf = malloc((size_t)size + 1);
+    if (buf == NULL || fread(buf, 1, (size_t)size, f) != (size_t)size) {
+        free(buf);
+        fclose(f);
+        return NULL;
+    }
+    fclose(f);
+    *len = (size_t)size;
+    return buf;
+}
+
+int serve_open(struct serve *sv, const char *addr, const char *page_path)
+{
+    struct addrinfo hints, *res, *ai;
+    char host[256] = "127.0.0.1";
+    const char *port = addr;
+    const char *colon = strrchr(addr, ':');
+    int i, one = 1;
+
+    memset(sv, 0, sizeof(*sv));
+    sv->fd = -1;
+    for (i = 0; i < SERVE_MAX_CLIENTS; i++)
+        sv->clients[i].fd = -1;
+
+    if (colon != NULL) {
+        size_t n = (size_t)(colon - addr);
+
+        if (n >= sizeof(host))
+            return -1;
+        if (n > 0) {
+            memcpy(host, addr, n);
+            host[n] = '\0';
+        }
+        port = colon + 1;
+    }
+
+    if (page_path != NULL) {
+        sv->page = read_page(page_path, &sv->page_len);
+        if (sv->page == NULL)
+            return -1;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    if (getaddrinfo(host, port, &hints, &res) != 0)
+        return -1;
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        sv->fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (sv->fd < 0)
+            continue;
+        setsockopt(sv->fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(sv->fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(sv->fd, 8) == 0)
+            break;
+        close(sv->fd);
+        sv->fd = -1;
+    }
+    freeaddrinfo(res);
+    if (sv->fd < 0)
+        return -1;
+
+    fcntl(sv->fd, F_SETFL, fcntl(sv->fd, F_GETFL) | O_NONBLOCK);
+    fcntl(sv->fd, F_SETFD, FD_CLOEXEC);
+    /* A client closing its connection must not kill the sampler */
+    signal(SIGPIPE, SIG_IGN);
+    return 0;
+}
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void drop(struct serve_client *c)
+{
+    close(c->fd);
+    c->fd = -1;
+    c->streaming = 0;
+    c->replying = 0;
+    c->subscribe = 0;
+    c->req_len = 0;
+}
+
+/* Send what the socket takes of the reply, never waiting for it */
+static void write_reply(struct serve_client *c)
+{
+    for (;;) {
+        const char *p = c->out + c->out_sent;
+        size_t left = c->out_len - c->out_sent;
+        ssize_t n;
+
+        if (c->out_sent >= c->out_len) {
+            p = c->body + (c->out_sent - c->out_len);
+            left = c->body != NULL ? c->body_len - (c->out_sent - c->out_len) : 0;
+        }
+        if (left == 0)
+            break;
+        n = send(c->fd, p, left, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            return;             /* the rest goes from a later poll */
+        if (n <= 0) {
+            drop(c);
+            return;
+        }
+        c->out_sent += (size_t)n;
+    }
+    if (!c->subscribe) {
+        drop(c);
+        return;
+    }
+    c->replying = 0;
+    c->streaming = 1;
+}
+
+static void respond(struct serve *sv, struct serve_client *c)
+{
+    const char *page = sv->page ? sv->page : stub_page;
+    size_t page_len = sv->page ? sv->page_len : sizeof(stub_page) - 1;
+    int n;
+
+    c->body = NULL;
+    c->body_len = 0;
+
+    if (strncmp(c->req, "GET /events", 11) == 0 && (c->req[11] == ' ' || c->req[11] == '?')) {
+        static const char sse[] =
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Type: text/event-stream\r\n"
+            "Cache-Control: no-cache\r\n"
+            "Connection: keep-alive\r\n"
+            "\r\n"
+            "retry: 2000\n\n";
+
+        n = snprintf(c->out, sizeof(c->out), "%s%.*s", sse, (int)sv->last_len, sv->last);
+        c->subscribe = 1;
+    } else if (strncmp(c->req, "GET / ", 6) == 0 || strncmp(c->req, "GET /index.html ", 16) == 0) {
+        n = snprintf(c->out, sizeof(c->out),
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Type: text/html; charset=utf-8\r\n"
+            "Content-Length: %lu\r\n"
+            "Cache-Control: no-cache\r\n"
+            "Connection: close\r\n"
+            "\r\n", (unsigned long)page_len);
+        c->body = page;
+        c->body_len = page_len;
+    } else if (strncmp(c->req, "GET /health", 11) == 0 &&
+               (c->req[11] == ' ' || c->req[11] == '?')) {
+        n = snprintf(c->out, sizeof(c->out),
+            "HTTP/1.1 200 OK\r\n"
+            "Content-Type: application/json\r\n"
+            "Content-Length: %lu\r\n"
+            "Cache-Control: no-cache\r\n"
+            "Connection: close\r\n"
+            "\r\n"
+            "%.*s", (unsigned long)sv->health_len, (int)sv->health_len, sv->health);
+    } else {
+        static const char not_found[] =
+            "HTTP/1.1 404 Not Found\r\n"
+            "Content-Length: 0\r\n"
+            "Connection: close\r\n"
+            "\r\n";
+
+        n = snprintf(c->out, sizeof(c->out), "%s", not_found);
+    }
+    if (n < 0 || (size_t)n >= sizeof(c->out)) {
+        drop(c);
+        return;
+    }
+    c->out_len = (size_t)n;
+    c->out_sent = 0;
+    c->replying = 1;
+    c->since_ns = now_ns();
+    write_reply(c);
+}
+
+static void accept_clients(struct serve *sv)
+{
+    for (;;) {
+        int fd = accept(sv->fd, NULL, NULL);
+        int i;
+
+        if (fd < 0)
+            return;
+        for (i = 0; i < SERVE_MAX_CLIENTS && sv->clients[i].fd >= 0; i++)
+            ;
+        if (i == SERVE_MAX_CLIENTS) {
+            close(fd);
+            continue;
+        }
+        /* Accepted sockets inherit O_NONBLOCK on the BSDs but not on Linux */
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        sv->clients[i].fd = fd;
+        sv->clients[i].streaming = 0;
+        sv->clients[i].replying = 0;
+        sv->clients[i].subscribe = 0;
+        sv->clients[i].req_len = 0;
+    }
+}
+
+static void read_request(struct serve *sv, struct serve_client *c)
+{
+    ssize_t n = recv(c->fd, c->req + c->req_len, sizeof(c->req) - 1 - c->req_len, MSG_DONTWAIT);
+
+    if (n <= 0) {
+        if (n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+            drop(c);
+        return;
+    }
+    if (c->streaming)
+        return;                 /* nothing more is expected from a subscriber */
+    c->req_len += (size_t)n;
+    c->req[c->req_len] = '\0';
+    if (strstr(c->req, "\r\n\r\n") != NULL || strstr(c->req, "\n\n") != NULL)
+        respond(sv, c);
+    else if (c->req_len == sizeof(c->req) - 1)
+        drop(c);
+}
+
+void serve_poll(struct serve *sv, int timeout_ms)
+{
+    struct pollfd pfd[SERVE_MAX_CLIENTS + 1];
+    int slot[SERVE_MAX_CLIENTS + 1];
+    int nfds = 0;
+    long long now;
+    int i;
+
+    if (sv->fd < 0)
+        return;
+    pfd[nfds].fd = sv->fd;
+    pfd[nfds].events = POLLIN;
+    slot[nfds++] = -1;
+    now = now_ns();
+    for (i = 0; i < SERVE_MAX_CLIENTS; i++) {
+        struct serve_client *c = &sv->clients[i];
+
+        if (c->fd < 0)
+            continue;
+        if (c->replying && now - c->since_ns > SERVE_REPLY_TIMEOUT_NS) {
+            drop(c);            /* stopped reading its reply */
+            continue;
+        }
+        pfd[nfds].fd = c->fd;
+        pfd[nfds].events = c->replying ? POLLOUT : POLLIN;
+        slot[nfds++] = i;
+    }
+
+    if (poll(pfd, (nfds_t)nfds, timeout_ms) <= 0)
+        return;
+    for (i = 1; i < nfds; i++) {
+        struct serve_client *c = &sv->clients[slot[i]];
+
+        if (c->replying && (pfd[i].revents & (POLLOUT | POLLHUP | POLLERR)))
+            write_reply(c);
+        else if (!c->replying && (pfd[i].revents & (POLLIN | POLLHUP | POLLERR)))
+            read_request(sv, c);
+    }
+    if (pfd[0].revents & POLLIN)
+        accept_clients(sv);
+}
+
+void serve_publish(struct serve *sv, const char *data, size_t len)
+{
+    int n, i;
+
+    if (sv->fd < 0)
+        return;
+    n = snprintf(sv->last, sizeof(sv->last), "data: %.*s\n\n", (int)len, data);
+    if (n < 0 || (size_t)n >= sizeof(sv->last)) {
+        sv->last_len = 0;
+        return;
+    }
+    sv->last_len = (size_t)n;
+
+    for (i = 0; i < SERVE_MAX_CLIENTS; i++) {
+        struct serve_client *c = &sv->clients[i];
+        ssize_t sent;
+
+        if (c->fd < 0 || !c->streaming)
+            continue;
+        /* A whole event or nothing: a full socket buffer means a stalled
+         * client, which is dropped rather than waited for */
+        sent = send(c->fd, sv->last, sv->last_len, MSG_DONTWAIT | MSG_NOSIGNAL);
+        if (sent != (ssize_t)sv->last_len)
+            drop(c);
+    }
+}
+
+void serve_health(struct serve *sv, const char *json, size_t len)
+{
+    if (len > sizeof(sv->health))
+        return;
+    memcpy(sv->health, json, len);
+    sv->health_len = len;
+}
+
+void serve_close(struct serve *sv)
+{
+    int i;
+
+    for (i = 0; i < SERVE_MAX_CLIENTS; i++)
+        if (sv->clients[i].fd >= 0)
+            drop(&sv->clients[i]);
+    if (sv->fd >= 0)
+        close(sv->fd);
+    sv->fd = -1;
+    free(sv->page);
+    sv->page = NULL;
+}
@@ -0,0 +1,66 @@
+/*
+ * serve.h - Local HTTP server for the batlab-sampler live view
+ *
+ * A single-threaded, non-blocking server polled from the sampling loop
+ * between deadlines. GET / returns the dashboard page, GET /events a
+ * server-sent event stream with one event per sample, GET /health the
+ * sampler's latest health snapshot (see health.h). Replies go out as
+ * the socket takes them, from later polls; clients that cannot keep up
+ * are dropped rather than allowed to stall sampling;
+ * EventSource reconnects them and the last event is replayed on
+ * connect, so a new client renders current aggregates at once.
+ */
+
+#ifndef BATLAB_SERVE_H
+#define BATLAB_SERVE_H
+
+#include <stddef.h>
+
+#define SERVE_MAX_CLIENTS 16
+#define SERVE_REQUEST_MAX 2048
+#define SERVE_EVENT_MAX 4096
+#define SERVE_HEALTH_MAX 4096
+/* Reply head with its body copied in: the health snapshot or last event */
+#define SERVE_REPLY_MAX (SERVE_HEALTH_MAX + 256)
+#define SERVE_REPLY_TIMEOUT_NS 5000000000LL
+
+struct serve_client {
+    int fd;                     /* -1 when the slot is free */
+    int streaming;              /* subscribed to /events */
+    int replying;               /* a reply is being sent */
+    int subscribe;              /* streams once the reply is sent */
+    size_t req_len;
+    char req[SERVE_REQUEST_MAX];
+    char out[SERVE_REPLY_MAX];
+    size_t out_len;
+    size_t out_sent;            /* of out, then of the page */
+    const char *body;           /* the page, sent after out; NULL for none */
+    size_t body_len;
+    long long since_ns;         /* when the reply was queued */
+};
+
+struct serve {
+    int fd;
+    char *page;
+    size_t page_len;
+    struct serve_client clients[SERVE_MAX_CLIENTS];
+    char last[SERVE_EVENT_MAX];
+    size_t last_len;
+    char health[SERVE_HEALTH_MAX];
+    size_t health_len;
+};
+
+/*
+ * Listen on addr, "PORT" or "HOST:PORT" (default host 127.0.0.1), and
+ * serve page_path as the dashboard; NULL serves a stub page
+ */
+int serve_open(struct serve *sv, const char *addr, const char *page_path);
+/* Accept and answer requests for up to timeout_ms (0 polls once) */
+void serve_poll(struct serve *sv, int timeout_ms);
+/* Send one event to every /events client */
+void serve_publish(struct serve *sv, const char *data, size_t len);
+/* Replace the JSON document GET /health returns */
+void serve_health(struct serve *sv, const char *json, size_t len);
+void serve_close(struct serve *sv);
+
+#endif /* BATLAB_SERVE_H */
@@ -0,0 +1,166 @@
+/*
+ * stats.c - Streaming run statistics
+ */
+
+#include <math.h>
+#include <string.h>
+
+#include "stats.h"
+
+#define STATS_KEYS 17
+
+const char *stats_num(char *buf, size_t len, double v)
+{
+    if (v == (double)(long long)v && v > -1e15 && v < 1e15)
+        snprintf(buf, len, "%lld", (long long)v);
+    else
+        snprintf(buf, len, "%.6g", v);
+    return buf;
+}
+
+void stats_row_from_jsonl(struct stats_row *r, const struct jsonl_row *jr, int64_t t0_ns)
+{
+    r->hours = (double)(jr->t_ns - t0_ns) / 3.6e12;
+    r->pct = jr->pct;
+    r->watts = jr->watts;
+    r->cpu = jr->has_cpu_pct ? jr->cpu_pct : jr->cpu_load * 100;
+    r->temp = jr->has_temp ? jr->temp_c : 0.0;
+}
+
+void stats_init(struct stats *s)
+{
+    memset(s, 0, sizeof(*s));
+}
+
+static void sketch_add(struct stats *s, double v)
+{
+    static double log_gamma;
+    double x;
+    long k;
+
+    if (v > -1e-9 && v < 1e-9) {
+        s->zero++;
+        return;
+    }
+    if (log_gamma == 0)
+        log_gamma = log((1 + STATS_SKETCH_ALPHA) / (1 - STATS_SKETCH_ALPHA));
+    x = log(v < 0 ? -v : v) / log_gamma;
+    k = (long)x;
+    if (k < x)
+        k++;
+    if (k < -STATS_SKETCH_BINS / 2)
+        k = -STATS_SKETCH_BINS / 2;
+    if (k >= STATS_SKETCH_BINS / 2)
+        k = STATS_SKETCH_BINS / 2 - 1;
+    (v > 0 ? s->pos : s->neg)[k + STATS_SKETCH_BINS / 2]++;
+}
+
+void stats_add(struct stats *s, const struct stats_row *r)
+{
+    if (s->count == 0) {
+        s->start_pct = r->pct;
+        s->min_watts = s->max_watts = r->watts;
+        s->min_cpu = s->max_cpu = r->cpu;
+        s->min_temp = s->max_temp = r->temp;
+    }
+    /* Trapezoidal energy, weighted by the time each pair of samples spans */
+    if (s->count > 0 && r->hours > s->prev_hours)
+        s->energy_wh += (s->prev_watts + r->watts) / 2.0 * (r->hours - s->prev_hours);
+    s->prev_hours = r->hours;
+    s->prev_watts = r->watts;
+    s->duration = r->hours;
+    s->end_pct = r->pct;
+    if (r->watts < s->min_watts) s->min_watts = r->watts;
+    if (r->watts > s->max_watts) s->max_watts = r->watts;
+    if (r->cpu < s->min_cpu) s->min_cpu = r->cpu;
+    if (r->cpu > s->max_cpu) s->max_cpu = r->cpu;
+    if (r->temp < s->min_temp) s->min_temp = r->temp;
+    if (r->temp > s->max_temp) s->max_temp = r->temp;
+    s->sum_watts += r->watts;
+    sketch_add(s, r->watts);
+    s->sum_cpu += r->cpu;
+    s->sum_temp += r->temp;
+    s->count++;
+}
+
+/* The summary keys in batlab-stats.awk order, with their values */
+static void derive(const struct stats *s, const char **keys, double *v)
+{
+    double n = (double)s->count;
+    double drain = s->start_pct - s->end_pct;
+    double rate = s->count > 1 && s->duration > 0 ? drain / s->duration : 0.0;
+    int i = 0;
+
+#define KV(key, value) (keys[i] = key, v[i++] = value)
+    KV("duration", s->duration);
+    KV("samples", n);
+    KV("start_pct", s->start_pct);
+    KV("end_pct", s->end_pct);
+    KV("battery_drain", drain);
+    KV("drain_rate", rate);
+    KV("avg_watts", s->sum_watts / n);
+    KV("min_watts", s->min_watts);
+    KV("max_watts", s->max_watts);
+    KV("avg_cpu", s->sum_cpu / n);
+    KV("min_cpu", s->min_cpu);
+    KV("max_cpu", s->max_cpu);
+    KV("avg_temp", s->sum_temp / n);
+    KV("min_temp", s->min_temp);
+    KV("max_temp", s->max_temp);
+    KV("energy_wh", s->energy_wh);
+    KV("projected_hours", rate > 0 ? 100.0 / rate : 0.0);
+#undef KV
+}
+
+static void print_bins(const unsigned long long *b, FILE *f)
+{
+    const char *sep = "";
+    int i;
+
+    fputc('{', f);
+    for (i = 0; i < STATS_SKETCH_BINS; i++) {
+        if (b[i] != 0) {
+            fprintf(f, "%s\"%d\":%llu", sep, i - STATS_SKETCH_BINS / 2, b[i]);
+            sep = ",";
+        }
+    }
+    fputc('}', f);
+}
+
+void stats_print_sketch(const struct stats *s, FILE *f)
+{
+    fprintf(f, "{\"alpha\":%g,\"zero\":%llu,\"pos\":", STATS_SKETCH_ALPHA, s->zero);
+    print_bins(s->pos, f);
+    fprintf(f, ",\"neg\":");
+    print_bins(s->neg, f);
+    fputc('}', f);
+}
+
+void stats_print(const struct stats *s, FILE *f)
+{
+    const char *keys[STATS_KEYS];
+    double v[STATS_KEYS];
+    char buf[32];
+    int i;
+
+    derive(s, keys, v);
+    for (i = 0; i < STATS_KEYS; i++)
+        fprintf(f, "%s:%s\n", keys[i], stats_num(buf, sizeof(buf), v[i]));
+    fprintf(f, "watts_sketch:");
+    stats_print_sketch(s, f);
+    fputc('\n', f);
+}
+
+void stats_print_json(const struct stats *s, FILE *f)
+{
+    const char *keys[STATS_KEYS];
+    double v[STATS_KEYS];
+    char buf[32];
+    int i;
+
+    derive(s, keys, v);
+    fputc('{', f);
+    for (i = 0; i < STATS_KEYS; i++)
+        fprintf(f, "%s\"%s\": %s", i ? ", " : "", keys[i], stats_num(buf, sizeof(buf), v[i]));
+    fputc('}', f);
+}
@@ -0,0 +1,65 @@
+/*
+ * stats.h - Streaming run statistics
+ *
+ * The key:value summary lib/batlab-stats.awk prints, kept one row at a
+ * time in constant memory: duration, battery drain, watts, CPU and
+ * temperature ranges, trapezoidal energy and the mergeable watts
+ * quantile sketch. batlab-data stats fills one from a whole run;
+ * batlab-aggregator keeps one per run and adds rows as batches arrive,
+ * so a summary never needs the run re-read.
+ */
+
+#ifndef BATLAB_STATS_H
+#define BATLAB_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "jsonl.h"
+
+/*
+ * Watts quantile sketch, as lib/batlab-stats.awk builds it: bucket
+ * ceil(log_gamma |v|), gamma = (1 + alpha) / (1 - alpha), zero apart
+ */
+#define STATS_SKETCH_ALPHA 0.01
+#define STATS_SKETCH_BINS 4096  /* bucket indexes -2048..2047 */
+
+/* One decoded sample, in the units of the report table */
+struct stats_row {
+    double hours;
+    double pct;
+    double watts;
+    double cpu;             /* cpu_pct, or cpu_load * 100 */
+    double temp;            /* 0 when missing, like the awk table */
+};
+
+struct stats {
+    unsigned long long count;
+    unsigned long long zero;
+    unsigned long long pos[STATS_SKETCH_BINS];
+    unsigned long long neg[STATS_SKETCH_BINS];
+    double duration;
+    double start_pct, end_pct;
+    double min_watts, max_watts, sum_watts;
+    double prev_hours, prev_watts, energy_wh;
+    double min_cpu, max_cpu, sum_cpu;
+    double min_temp, max_temp, sum_temp;
+};
+
+/* Format a number the way awk prints it: integers exactly, else %.6g */
+const char *stats_num(char *buf, size_t len, double v);
+
+/* Table row for a parsed sample, hours counted from t0_ns */
+void stats_row_from_jsonl(struct stats_row *r, const struct jsonl_row *jr, int64_t t0_ns);
+
+void stats_init(struct stats *s);
+void stats_add(struct stats *s, const struct stats_row *r);
+
+/* "key:value" lines and a watts_sketch:JSON line, as batlab-stats.awk */
+void stats_print(const struct stats *s, FILE *f);
+/* The same statistics as a JSON object, and the sketch on its own */
+void stats_print_json(const struct stats *s, FILE *f);
+void stats_print_sketch(const struct stats *s, FILE *f);
+
+#endif /* BATLAB_STATS_H */
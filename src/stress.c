@@ -0,0 +1,529 @@
+/*
+ * batlab-stress - Calibrated CPU stress workload for batlab
+ *
+ * Replaces the sha256sum subshell loops of workload/stress.sh. One
+ * worker thread per CPU, each pinned to its CPU where the system allows,
+ * runs a work kernel for the first INTENSITY percent of every period
+ * and sleeps for the rest. Periods are absolute deadlines on the same
+ * drift-free scheduler as batlab-sampler, a few milliseconds long by
+ * default, so the load seen by a 1 Hz sampler is flat instead of the
+ * one-second square wave of the shell loop.
+ *
+ * The load each worker actually achieved is measured from its thread
+ * CPU time and reported per worker at exit (and every --interval).
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <sched.h>
+#elif defined(__FreeBSD__)
+#include <sys/param.h>
+#include <sys/cpuset.h>
+#include <pthread_np.h>
+#elif defined(__NetBSD__)
+#include <sched.h>
+#endif
+
+#include "kernel.h"
+#include "sched.h"
+
+#define PROGRAM_NAME "batlab-stress"
+#define VERSION "2.0.0"
+
+#define DEFAULT_PERIOD_US 5000
+#define MIN_PERIOD_US 100
+#define MAX_PERIOD_US 1000000
+#define MAX_WORKERS 1024
+
+/* Kernel calls are sized to take about this long, so a duty cycle
+ * overshoots its end by no more than that */
+#define CHUNK_TARGET_NS 20000
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void handle_stop(int sig)
+{
+    (void)sig;
+    stop_requested = 1;
+}
+
+struct worker {
+    pthread_t thread;
+    int index;
+    int cpu;                    /* CPU to pin to, -1 for none */
+    int pinned;
+    struct kernel kernel;
+    int64_t period_ns;
+    int64_t work_ns;
+
+    /* Published by the worker after every period, read by main */
+    pthread_mutex_t lock;
+    uint64_t units;
+    int64_t cpu_ns;
+    uint64_t periods;
+    uint64_t skipped;
+};
+
+/* Counters of one worker at one point in time */
+struct snapshot {
+    int64_t wall_ns;
+    uint64_t units;
+    int64_t cpu_ns;
+    uint64_t periods;
+    uint64_t skipped;
+};
+
+static void usage(FILE *out)
+{
+    fprintf(out,
+        "%s %s - Calibrated CPU stress workload for batlab\n"
+        "\n"
+        "USAGE:\n"
+        "    %s [--intensity PCT] [--duration SEC] [--threads N]\n"
+        "        [--kernel int|fp|stream] [--period-us US] [--interval SEC]\n"
+        "        [--no-pin] [--json]\n"
+        "\n"
+        "OPTIONS:\n"
+        "    --intensity PCT  Load per worker, 0 to 100 (default: 25)\n"
+        "    --duration SEC   Stop after SEC seconds (default: run until signalled)\n"
+        "    --threads N      Number of workers (default: one per available CPU)\n"
+        "    --kernel K       'int' (default), 'fp' (SIMD multiply-add) or\n"
+        "                     'stream' (memory bandwidth triad)\n"
+        "    --stream-mb MB   Working set per stream worker (default: %d)\n"
+        "    --period-us US   Duty cycle period, %d to %d (default: %d)\n"
+        "    --interval SEC   Also report achieved load every SEC seconds\n"
+        "    --no-pin         Let the scheduler place workers instead of pinning\n"
+        "    --json           Report as JSON objects instead of a table\n"
+        "    --help           Show this help\n"
+        "    --version        Show version\n",
+        PROGRAM_NAME, VERSION, PROGRAM_NAME, KERNEL_STREAM_DEFAULT_MB,
+        MIN_PERIOD_US, MAX_PERIOD_US, DEFAULT_PERIOD_US);
+}
+
+static void log_error(const char *msg, const char *arg)
+{
+    fprintf(stderr, "[ERROR] %s%s\n", msg, arg ? arg : "");
+}
+
+static int64_t thread_cpu_ns(void)
+{
+    struct timespec ts;
+
+    if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+        return 0;
+    return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/*
+ * CPUs this process may run on, in order, into cpus[]; returns how many.
+ * Where affinity cannot be queried, all online CPUs are assumed.
+ */
+static int available_cpus(int *cpus, int max)
+{
+    int n = 0;
+
+#if defined(__linux__)
+    cpu_set_t set;
+    int c;
+
+    if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (c = 0; c < CPU_SETSIZE && n < max; c++)
+            if (CPU_ISSET(c, &set))
+                cpus[n++] = c;
+    }
+#elif defined(__FreeBSD__)
+    cpuset_t set;
+    int c;
+
+    if (cpuset_getaffinity(CPU_LEVEL_WHICH, CPU_WHICH_PID, -1, sizeof(set), &set) == 0) {
+        for (c = 0; c < CPU_SETSIZE && n < max; c++)
+            if (CPU_ISSET(c, &set))
+                cpus[n++] = c;
+    }
+#endif
+    if (n == 0) {
+        long online = sysconf(_SC_NPROCESSORS_ONLN);
+
+        if (online < 1)
+            online = 1;
+        for (n = 0; n < online && n < max; n++)
+            cpus[n] = n;
+    }
+    return n;
+}
+
+/* Pin the calling thread to one CPU; returns -1 where that is not possible */
+static int pin_self(int cpu)
+{
+#if defined(__linux__)
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0 ? 0 : -1;
+#elif defined(__FreeBSD__)
+    cpuset_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0 ? 0 : -1;
+#elif defined(__NetBSD__)
+    cpuset_t *set = cpuset_create();
+    int rc = -1;
+
+    if (set != NULL) {
+        cpuset_set((cpuid_t)cpu, set);
+        rc = pthread_setaffinity_np(pthread_self(), cpuset_size(set), set) == 0 ? 0 : -1;
+        cpuset_destroy(set);
+    }
+    return rc;
+#else
+    /* OpenBSD and macOS have no thread affinity API */
+    (void)cpu;
+    return -1;
+#endif
+}
+
+static void *worker_main(void *arg)
+{
+    struct worker *w = arg;
+    struct sched sc;
+    unsigned chunk = 1;
+    uint64_t units = 0;
+    int64_t cpu0;
+
+    if (w->cpu >= 0)
+        w->pinned = pin_self(w->cpu) == 0;
+
+    cpu0 = thread_cpu_ns();
+    sched_init(&sc, 1e9 / (double)w->period_ns);
+
+    while (!stop_requested) {
+        int64_t end;
+
+        if (sched_wait(&sc) != 0)
+            continue;
+
+        /* Work for work_ns from the wakeup, so timer latency does not
+         * eat into the duty cycle, but never into the next period: 100%
+         * is continuous work rather than a run of skipped periods */
+        end = sc.last_fired_ns + w->work_ns;
+        sched_advance(&sc);
+        if (end > sc.deadline_ns)
+            end = sc.deadline_ns;
+
+        for (;;) {
+            int64_t t0 = sched_now_ns(), dt;
+
+            if (t0 >= end)
+                break;
+            kernel_run(&w->kernel, chunk);
+            units += chunk;
+            dt = sched_now_ns() - t0;
+            if (dt < CHUNK_TARGET_NS / 2 && chunk < (1u << 20))
+                chunk *= 2;
+            else if (dt > CHUNK_TARGET_NS * 2 && chunk > 1)
+                chunk /= 2;
+        }
+
+        pthread_mutex_lock(&w->lock);
+        w->units = units;
+        w->cpu_ns = thread_cpu_ns() - cpu0;
+        w->periods = sc.fired;
+        w->skipped = sc.skipped;
+        pthread_mutex_unlock(&w->lock);
+    }
+    return NULL;
+}
+
+static void take_snapshot(struct worker *w, struct snapshot *s)
+{
+    s->wall_ns = sched_now_ns();
+    pthread_mutex_lock(&w->lock);
+    s->units = w->units;
+    s->cpu_ns = w->cpu_ns;
+    s->periods = w->periods;
+    s->skipped = w->skipped;
+    pthread_mutex_unlock(&w->lock);
+}
+
+/* Load (percent of one CPU) and rate (millions of units/s) between two snapshots */
+static void measure(const struct worker *w, const struct snapshot *from,
+                    const struct snapshot *to, double *load, double *rate)
+{
+    double secs = (double)(to->wall_ns - from->wall_ns) / 1e9;
+
+    *load = 0.0;
+    *rate = 0.0;
+    if (secs <= 0.0)
+        return;
+    *load = 100.0 * (double)(to->cpu_ns - from->cpu_ns) / 1e9 / secs;
+    *rate = (double)(to->units - from->units) * kernel_unit_amount(&w->kernel) / 1e6 / secs;
+}
+
+/* One line (or JSON object) summarising all workers since the last report */
+static void report_interval(struct worker *workers, int n, struct snapshot *last,
+                            int64_t start_ns, int json)
+{
+    double total_load = 0.0, total_rate = 0.0, lo = 0.0, hi = 0.0;
+    int i;
+
+    for (i = 0; i < n; i++) {
+        struct snapshot now;
+        double load, rate;
+
+        take_snapshot(&workers[i], &now);
+        measure(&workers[i], &last[i], &now, &load, &rate);
+        last[i] = now;
+        total_load += load;
+        total_rate += rate;
+        if (i == 0 || load < lo)
+            lo = load;
+        if (i == 0 || load > hi)
+            hi = load;
+    }
+
+    if (json)
+        printf("{\"t\": %.1f, \"load_pct\": %.2f, \"min_load_pct\": %.2f, "
+               "\"max_load_pct\": %.2f, \"rate\": %.1f}\n",
+               (double)(sched_now_ns() - start_ns) / 1e9,
+               total_load / n, lo, hi, total_rate);
+    else
+        printf("%8.1fs  load %6.2f%%  (min %.2f%%, max %.2f%%)  %.1f %s\n",
+               (double)(sched_now_ns() - start_ns) / 1e9,
+               total_load / n, lo, hi, total_rate, kernel_rate_unit(&workers[0].kernel));
+    fflush(stdout);
+}
+
+static void report_final(struct worker *workers, int n, const struct snapshot *first,
+                         double intensity, int64_t period_ns, int json)
+{
+    const struct kernel *k = &workers[0].kernel;
+    double total_load = 0.0, total_rate = 0.0, secs = 0.0;
+    uint64_t periods = 0, skipped = 0;
+    int i;
+
+    if (json)
+        printf("{\"kernel\": \"%s\", \"variant\": \"%s\", \"intensity\": %g, "
+               "\"period_us\": %lld, \"rate_unit\": \"%s\", \"workers\": [",
+               kernel_name(k->kind), k->variant, intensity,
+               (long long)(period_ns / 1000), kernel_rate_unit(k));
+    else
+        printf("%-6s %4s %7s %9s %14s %10s %8s\n",
+               "worker", "cpu", "target", "achieved", kernel_rate_unit(k), "periods", "skipped");
+
+    for (i = 0; i < n; i++) {
+        struct snapshot end;
+        double load, rate;
+
+        take_snapshot(&workers[i], &end);
+        measure(&workers[i], &first[i], &end, &load, &rate);
+        secs = (double)(end.wall_ns - first[i].wall_ns) / 1e9;
+        total_load += load;
+        total_rate += rate;
+        periods += end.periods;
+        skipped += end.skipped;
+
+        if (json)
+            printf("%s{\"worker\": %d, \"cpu\": %d, \"pinned\": %s, \"load_pct\": %.2f, "
+                   "\"rate\": %.1f, \"periods\": %llu, \"skipped\": %llu}",
+                   i ? ", " : "", i, workers[i].pinned ? workers[i].cpu : -1,
+                   workers[i].pinned ? "true" : "false", load, rate,
+                   (unsigned long long)end.periods, (unsigned long long)end.skipped);
+        else if (workers[i].pinned)
+            printf("%-6d %4d %6.1f%% %8.2f%% %14.1f %10llu %8llu\n",
+                   i, workers[i].cpu, intensity, load, rate,
+                   (unsigned long long)end.periods, (unsigned long long)end.skipped);
+        else
+            printf("%-6d %4s %6.1f%% %8.2f%% %14.1f %10llu %8llu\n",
+                   i, "-", intensity, load, rate,
+                   (unsigned long long)end.periods, (unsigned long long)end.skipped);
+    }
+
+    if (json)
+        printf("], \"duration_s\": %.3f, \"load_pct\": %.2f, \"rate\": %.1f, "
+               "\"periods\": %llu, \"skipped\": %llu}\n",
+               secs, total_load / n, total_rate,
+               (unsigned long long)periods, (unsigned long long)skipped);
+    else
+        printf("%-6s %4s %6.1f%% %8.2f%% %14.1f %10llu %8llu\n",
+               "all", "-", intensity, total_load / n, total_rate,
+               (unsigned long long)periods, (unsigned long long)skipped);
+}
+
+int main(int argc, char **argv)
+{
+    static int cpus[MAX_WORKERS];
+    struct worker *workers;
+    struct snapshot *first, *last;
+    struct sigaction sa;
+    sigset_t block, old;
+    enum kernel_kind kind = KERNEL_INT;
+    double intensity = 25.0;
+    double duration = 0.0;
+    double interval = 0.0;
+    long period_us = DEFAULT_PERIOD_US;
+    long stream_mb = KERNEL_STREAM_DEFAULT_MB;
+    long threads = 0;
+    int64_t start_ns, next_report_ns;
+    int ncpus, pin = 1, json = 0;
+    int i, started = 0, rc = 0;
+
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--intensity") == 0 && i + 1 < argc) {
+            intensity = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--duration") == 0 && i + 1 < argc) {
+            duration = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = strtol(argv[++i], NULL, 10);
+            if (threads < 1 || threads > MAX_WORKERS) {
+                log_error("Invalid --threads value: ", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--kernel") == 0 && i + 1 < argc) {
+            if (kernel_parse(argv[++i], &kind) != 0) {
+                log_error("Unknown kernel: ", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--stream-mb") == 0 && i + 1 < argc) {
+            stream_mb = strtol(argv[++i], NULL, 10);
+            if (stream_mb < 1) {
+                log_error("Invalid --stream-mb value: ", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--period-us") == 0 && i + 1 < argc) {
+            period_us = strtol(argv[++i], NULL, 10);
+            if (period_us < MIN_PERIOD_US || period_us > MAX_PERIOD_US) {
+                log_error("Invalid --period-us value: ", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--interval") == 0 && i + 1 < argc) {
+            interval = strtod(argv[++i], NULL);
+        } else if (strcmp(argv[i], "--no-pin") == 0) {
+            pin = 0;
+        } else if (strcmp(argv[i], "--json") == 0) {
+            json = 1;
+        } else if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+            usage(stdout);
+            return 0;
+        } else if (strcmp(argv[i], "--version") == 0 || strcmp(argv[i], "-v") == 0) {
+            printf("%s %s\n", PROGRAM_NAME, VERSION);
+            return 0;
+        } else {
+            log_error("Unknown option: ", argv[i]);
+            usage(stderr);
+            return 1;
+        }
+    }
+
+    if (intensity < 0.0 || intensity > 100.0) {
+        log_error("Intensity must be between 0 and 100", NULL);
+        return 1;
+    }
+    if (duration < 0.0 || interval < 0.0) {
+        log_error("Durations must not be negative", NULL);
+        return 1;
+    }
+
+    ncpus = available_cpus(cpus, MAX_WORKERS);
+    if (threads == 0)
+        threads = ncpus;
+
+    workers = calloc((size_t)threads, sizeof(*workers));
+    first = calloc((size_t)threads, sizeof(*first));
+    last = calloc((size_t)threads, sizeof(*last));
+    if (workers == NULL || first == NULL || last == NULL) {
+        log_error("Cannot allocate workers", NULL);
+        return 1;
+    }
+
+    for (i = 0; i < threads; i++) {
+        struct worker *w = &workers[i];
+
+        w->index = i;
+        w->cpu = pin ? cpus[i % ncpus] : -1;
+        w->period_ns = (int64_t)period_us * 1000;
+        w->work_ns = (int64_t)((double)w->period_ns * intensity / 100.0);
+        pthread_mutex_init(&w->lock, NULL);
+        if (kernel_init(&w->kernel, kind, (size_t)stream_mb << 20, (unsigned)i) != 0) {
+            log_error("Cannot allocate kernel buffers", NULL);
+            return 1;
+        }
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = handle_stop;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    /* Workers inherit a mask with the stop signals blocked, so only the
+     * main thread is interrupted and their sleeps keep their deadlines */
+    sigemptyset(&block);
+    sigaddset(&block, SIGINT);
+    sigaddset(&block, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &block, &old);
+
+    for (i = 0; i < threads; i++) {
+        take_snapshot(&workers[i], &first[i]);
+        if (pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]) != 0) {
+            log_error("Cannot start worker thread", NULL);
+            stop_requested = 1;
+            rc = 1;
+            break;
+        }
+        started++;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    memcpy(last, first, (size_t)threads * sizeof(*first));
+
+    start_ns = sched_now_ns();
+    next_report_ns = start_ns + (int64_t)(interval * 1e9);
+    while (!stop_requested) {
+        int64_t now = sched_now_ns();
+        int64_t wake = duration > 0.0 ? start_ns + (int64_t)(duration * 1e9) : INT64_MAX;
+        struct timespec ts;
+
+        if (interval > 0.0 && now >= next_report_ns) {
+            report_interval(workers, started, last, start_ns, json);
+            next_report_ns += (int64_t)(interval * 1e9);
+        }
+        if (now >= wake)
+            break;
+        if (interval > 0.0 && next_report_ns < wake)
+            wake = next_report_ns;
+        if (wake - now > 100000000)
+            wake = now + 100000000;
+
+        ts.tv_sec = (time_t)((wake - now) / 1000000000);
+        ts.tv_nsec = (long)((wake - now) % 1000000000);
+        nanosleep(&ts, NULL);
+    }
+
+    stop_requested = 1;
+    for (i = 0; i < started; i++)
+        pthread_join(workers[i].thread, NULL);
+
+    if (started > 0)
+        report_final(workers, started, first, intensity, (int64_t)period_us * 1000, json);
+
+    for (i = 0; i < threads; i++) {
+        kernel_free(&workers[i].kernel);
+        pthread_mutex_destroy(&workers[i].lock);
+    }
+    free(workers);
+    free(first);
+    free(last);
+    return rc;
+}
@@ -0,0 +1,73 @@
+/*
+ * tindex.c - Sparse time index for JSONL runs (.idx sidecar)
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "tindex.h"
+
+int tindex_open(struct tindex_writer *ix, const char *path, unsigned every)
+{
+    long pos;
+
+    memset(ix, 0, sizeof(*ix));
+    ix->every = every > 0 ? every : TINDEX_DEFAULT_EVERY;
+    ix->f = fopen(path, "a");
+    if (ix->f == NULL)
+        return -1;
+
+    /* Entries reach the disk with the samples, at each batch flush */
+    setvbuf(ix->f, NULL, _IOFBF, 1 << 16);
+    fseek(ix->f, 0, SEEK_END);
+    pos = ftell(ix->f);
+    if (pos == 0)
+        fprintf(ix->f, "# batlab-idx 1 every %u\n", ix->every);
+    return 0;
+}
+
+void tindex_note(struct tindex_writer *ix, int64_t t_ns, uint64_t offset)
+{
+    if (ix->f != NULL && ix->seen++ % ix->every == 0)
+        fprintf(ix->f, "%lld %llu\n", (long long)(t_ns / 1000000),
+                (unsigned long long)offset);
+}
+
+int tindex_flush(struct tindex_writer *ix)
+{
+    return ix->f != NULL ? fflush(ix->f) : 0;
+}
+
+int tindex_close(struct tindex_writer *ix)
+{
+    int rc = 0;
+
+    if (ix->f != NULL)
+        rc = fclose(ix->f);
+    ix->f = NULL;
+    return rc;
+}
+
+uint64_t tindex_seek(const char *path, int64_t t_ns, uint64_t data_len)
+{
+    FILE *f = fopen(path, "r");
+    long long target = (long long)(t_ns / 1000000);
+    uint64_t best = 0;
+    char line[128];
+
+    if (f == NULL)
+        return 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        long long ms;
+        unsigned long long off;
+
+        if (line[0] == '#' || sscanf(line, "%lld %llu", &ms, &off) != 2)
+            continue;
+        if (ms >= target)
+            break;
+        if (off < data_len)
+            best = off;
+    }
+    fclose(f);
+    return best;
+}
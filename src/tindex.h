@@ -0,0 +1,48 @@
+/*
+ * tindex.h - Sparse time index for JSONL runs (.idx sidecar)
+ *
+ * batlab-sampler records the timestamp and byte offset of every Nth
+ * sample it appends, so readers can seek straight to a time window
+ * instead of parsing a long run from the top. The file is plain text:
+ *
+ *   # batlab-idx 1 every 60
+ *   1757655795619 0
+ *   1757655855633 7740
+ *
+ * Each entry is milliseconds since the epoch and the offset of the
+ * line holding that sample. Entries are written only after the samples
+ * they point at have been flushed, and readers ignore any offset past
+ * the end of the data file.
+ */
+
+#ifndef BATLAB_TINDEX_H
+#define BATLAB_TINDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define TINDEX_DEFAULT_EVERY 60
+
+struct tindex_writer {
+    FILE *f;
+    unsigned every;
+    uint64_t seen;
+};
+
+/* Append to path; every is the sample interval between entries */
+int tindex_open(struct tindex_writer *ix, const char *path, unsigned every);
+/* Called once per sample with the offset its line will be written at */
+void tindex_note(struct tindex_writer *ix, int64_t t_ns, uint64_t offset);
+/* Push entries out; call after the data file has been flushed */
+int tindex_flush(struct tindex_writer *ix);
+int tindex_close(struct tindex_writer *ix);
+
+/*
+ * Offset of the last indexed sample taken before t_ns, or 0 when
+ * the index is missing or has no such entry. data_len bounds the
+ * offsets that are trusted.
+ */
+uint64_t tindex_seek(const char *path, int64_t t_ns, uint64_t data_len);
+
+#endif /* BATLAB_TINDEX_H */
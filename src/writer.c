@@ -0,0 +1,146 @@
+/*
+ * writer.c - Batched JSONL writer for batlab-sampler
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "writer.h"
+
+int writer_parse_flush(const char *arg, unsigned *count, double *seconds)
+{
+    char *end;
+    double value = strtod(arg, &end);
+
+    if (end == arg || value <= 0.0)
+        return -1;
+
+    if (*end == 's' && end[1] == '\0') {
+        *count = 0;
+        *seconds = value;
+    } else if (*end == '\0' && value == (double)(unsigned)value) {
+        *count = (unsigned)value;
+        *seconds = 0.0;
+    } else {
+        return -1;
+    }
+    return 0;
+}
+
+int writer_parse_fsync(const char *arg, enum writer_fsync *policy)
+{
+    if (strcmp(arg, "never") == 0)
+        *policy = WRITER_FSYNC_NEVER;
+    else if (strcmp(arg, "flush") == 0)
+        *policy = WRITER_FSYNC_FLUSH;
+    else
+        return -1;
+    return 0;
+}
+
+int writer_init(struct writer *w, int fd, unsigned flush_count, double flush_seconds,
+                double hz, enum writer_fsync policy)
+{
+    /* Time-based batches hold about flush_seconds * hz samples; the
+     * product is taken in double, it overflows unsigned for long intervals */
+    double batch = flush_count > 0 ? (double)flush_count : flush_seconds * hz + 1.0;
+
+    if (batch < 1.0)
+        batch = 1.0;
+
+    memset(w, 0, sizeof(*w));
+    w->fd = fd;
+    w->cap = batch * WRITER_LINE_MAX < (double)WRITER_BUFFER_MAX
+             ? (size_t)batch * WRITER_LINE_MAX : WRITER_BUFFER_MAX;
+    w->buf = malloc(w->cap);
+    if (w->buf == NULL)
+        return -1;
+    w->flush_count = flush_count;
+    w->flush_interval_ns = (int64_t)(flush_seconds * 1e9);
+    w->fsync_policy = policy;
+
+    /* Output is opened O_APPEND, so samples land after the current end */
+    {
+        off_t end = lseek(fd, 0, SEEK_END);
+
+        w->base_offset = end > 0 ? (uint64_t)end : 0;
+    }
+    return 0;
+}
+
+static int write_all(int fd, const char *buf, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(fd, buf, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        buf += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+int writer_flush(struct writer *w)
+{
+    int rc = 0;
+
+    if (w->len == 0)
+        return 0;
+    if (write_all(w->fd, w->buf, w->len) != 0)
+        return -1;
+    /* The batch is in the file either way: writing it again would
+     * duplicate it, so only the error is passed on. Pipes and terminals
+     * have nothing to sync and fail with EINVAL */
+    if (w->fsync_policy == WRITER_FSYNC_FLUSH && fsync(w->fd) != 0 && errno != EINVAL)
+        rc = -1;
+
+    w->bytes += w->len;
+    w->flushes++;
+    w->len = 0;
+    w->pending = 0;
+    return rc;
+}
+
+int writer_append(struct writer *w, const char *line, size_t len, int64_t now_ns)
+{
+    if (w->pending == 0 && w->len == 0 && w->flushes == 0)
+        w->last_flush_ns = now_ns;
+
+    if (w->len + len > w->cap && writer_flush(w) != 0)
+        return -1;
+    memcpy(w->buf + w->len, line, len);
+    w->len += len;
+    w->pending++;
+
+    if ((w->flush_count > 0 && w->pending >= w->flush_count) ||
+        (w->flush_interval_ns > 0 && now_ns - w->last_flush_ns >= w->flush_interval_ns)) {
+        w->last_flush_ns = now_ns;
+        return writer_flush(w);
+    }
+    return 0;
+}
+
+uint64_t writer_offset(const struct writer *w)
+{
+    return w->base_offset + w->bytes + w->len;
+}
+
+int writer_close(struct writer *w)
+{
+    int rc = writer_flush(w);
+
+    if (w->fd > STDERR_FILENO)
+        close(w->fd);
+    free(w->buf);
+    w->buf = NULL;
+    return rc;
+}
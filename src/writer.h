@@ -0,0 +1,62 @@
+/*
+ * writer.h - Batched JSONL writer for batlab-sampler
+ *
+ * Samples are formatted into an in-memory batch and written out when
+ * the batch holds flush_count samples or flush_interval has elapsed,
+ * whichever comes first. Each flush is one write(2), optionally
+ * followed by fsync(2), so the disk can stay in a low-power state
+ * between batches. writer_close() always flushes, which is how
+ * buffered samples survive SIGINT/SIGTERM.
+ *
+ * The batch buffer is sized for the batch but never more than
+ * WRITER_BUFFER_MAX; a long interval at a high rate flushes whenever
+ * the buffer fills, so memory stays bounded whatever --flush-every says.
+ */
+
+#ifndef BATLAB_WRITER_H
+#define BATLAB_WRITER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define WRITER_LINE_MAX 2048
+#define WRITER_BUFFER_MAX (1u << 20)
+
+enum writer_fsync {
+    WRITER_FSYNC_NEVER,     /* leave write-back to the kernel */
+    WRITER_FSYNC_FLUSH      /* fsync after every batch */
+};
+
+struct writer {
+    int fd;
+    char *buf;
+    size_t cap;
+    size_t len;
+    unsigned pending;
+    unsigned flush_count;
+    int64_t flush_interval_ns;
+    int64_t last_flush_ns;
+    enum writer_fsync fsync_policy;
+    uint64_t flushes;
+    uint64_t bytes;
+    uint64_t base_offset;   /* size of the output file when opened */
+};
+
+/*
+ * Parse a --flush-every value: "N" flushes every N samples, "Ns" every
+ * N seconds. Returns -1 on a malformed value.
+ */
+int writer_parse_flush(const char *arg, unsigned *count, double *seconds);
+int writer_parse_fsync(const char *arg, enum writer_fsync *policy);
+
+/* fd is taken over by the writer; hz sizes the batch for time-based flushing */
+int writer_init(struct writer *w, int fd, unsigned flush_count, double flush_seconds,
+                double hz, enum writer_fsync policy);
+int writer_append(struct writer *w, const char *line, size_t len, int64_t now_ns);
+/* File offset the next appended line will be written at */
+uint64_t writer_offset(const struct writer *w);
+/* Write the batch out, and fsync it under WRITER_FSYNC_FLUSH; -1 if either fails */
+int writer_flush(struct writer *w);
+int writer_close(struct writer *w);
+
+#endif /* BATLAB_WRITER_H */
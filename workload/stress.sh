@@ -6,6 +6,8 @@
 # Default values
 intensity=25    # CPU load percentage (1-100)
 duration=36000   # Default 10 hours
+kernel=int      # Work kernel of the native engine: int, fp or stream
+threads=""      # Workers (default: one per CPU)
 
 # Parse command line arguments
 while [ $# -gt 0 ]; do
@@ -18,10 +20,20 @@ while [ $# -gt 0 ]; do
             duration="$2"
             shift 2
             ;;
+        --kernel)
+            kernel="$2"
+            shift 2
+            ;;
+        --threads)
+            threads="$2"
+            shift 2
+            ;;
         --help|-h)
-            echo "Usage: $0 [--intensity PERCENT] [--duration SECONDS]"
-            echo "  --intensity  CPU load percentage (1-100, default: 50)"
-            echo "  --duration   How long to run (default: 3600 seconds = 1 hour)"
+            echo "Usage: $0 [--intensity PERCENT] [--duration SECONDS] [--kernel int|fp|stream] [--threads N]"
+            echo "  --intensity  CPU load percentage (1-100, default: 25)"
+            echo "  --duration   How long to run (default: 36000 seconds = 10 hours)"
+            echo "  --kernel     Work done by batlab-stress: int, fp (SIMD) or stream (memory)"
+            echo "  --threads    Number of workers (default: one per CPU)"
             echo ""
             echo "Examples:"
             echo "  $0 --intensity 75 --duration 1800  # 75% CPU for 30 minutes"
@@ -87,14 +99,45 @@ cleanup() {
     exit 0
 }
 
+# Mark a phase in the run being logged, when started by 'batlab run'
+mark_phase() {
+    if [ -n "$BATLAB" ]; then
+        "$BATLAB" mark phase "$*" 2>/dev/null || true
+    fi
+}
+
 # Set up signal handlers
 trap cleanup INT TERM
 
 # Start suspension prevention
 prevent_suspension
 
+# Prefer the native engine: pinned workers with a millisecond duty cycle
+# and achieved load reported per core
+stress_bin="$(dirname "$0")/../bin/batlab-stress"
+if [ ! -x "$stress_bin" ]; then
+    stress_bin=$(command -v batlab-stress 2>/dev/null || true)
+fi
+
+if [ -n "$stress_bin" ]; then
+    echo "Using $stress_bin ($kernel kernel)"
+    mark_phase "load $kernel ${intensity}%"
+    set -- --intensity "$intensity" --duration "$duration" --kernel "$kernel" --interval 60
+    if [ -n "$threads" ]; then
+        set -- "$@" --threads "$threads"
+    fi
+    "$stress_bin" "$@" &
+    stress_pid=$!
+    # Ctrl+C interrupts wait; pass it on so the final report is printed
+    trap 'kill -INT "$stress_pid" 2>/dev/null; wait "$stress_pid"; cleanup' INT TERM
+    wait "$stress_pid"
+    cleanup
+fi
+
+echo "batlab-stress not built (run 'make stress'), falling back to shell workers"
+
 # Get number of CPU cores
-ncpu=$(nproc 2>/dev/null || sysctl -n hw.ncpu 2>/dev/null || echo "1")
+ncpu=${threads:-$(nproc 2>/dev/null || sysctl -n hw.ncpu 2>/dev/null || echo "1")}
 echo "Using $ncpu CPU cores"
 
 # Calculate work and sleep ratios based on intensity
@@ -105,6 +148,7 @@ sleep_time=$(echo "scale=3; 1 - $work_time" | bc 2>/dev/null || awk "BEGIN {prin
 echo "Work ratio: ${work_time}s work, ${sleep_time}s sleep per second"
 
 # Start CPU stress workers
+mark_phase "load shell ${intensity}%"
 i=0
 while [ $i -lt "$ncpu" ]; do
     (